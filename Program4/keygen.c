@@ -5,7 +5,12 @@
  * Assignment: Program 4
  * Overview: Create a key file from a specified length.  Characters will be
  * 	randomly generated from 27 allowed characters, A-Z and the space
- * 	character.  
+ * 	character.  The key is written a block at a time, so a key of any
+ * 	length takes the same memory.
+ * 	keygen -s writes a seed instead: a ChaCha20 key and nonce from
+ * 	/dev/urandom in hex, which otp_enc and otp_dec take with --seed in
+ * 	place of a key file.  keygen -b writes a binary key of raw bytes from
+ * 	/dev/urandom and no newline, for otp_enc and otp_dec --binary.
  * Last Update: 05/31/2016
  * Sources: Random number generator - www.cplusplus.com/reference/cstdlib/srand/
  * 	Allocate block for string - www.cplusplus.com/reference/cstlib/malloc/
@@ -14,7 +19,11 @@
 // Include Libraries
 #include <stdio.h>		// General IO, including printf to redirect file
 #include <stdlib.h>		// Randomization and exit
+#include <string.h>		// Checking for -s and -b
 #include <time.h>		// Seeding the time
+#include "otp_proto.h"		// Layout of a seed
+
+#define KEY_BLOCK	65536	// Characters generated and written at a time
 
 /*
  * Function: getKeyString
@@ -40,6 +49,73 @@ void getKeyString(int str_length, char *key_string)
 	key_string[str_length] = 0; 
 }
 
+/*
+ * Function: printSeed
+ * Parameters: none
+ * Overview: Prints a new seed in hex.  A seed stands in for a whole key,
+ * 	so it comes from the system's random source, not rand.
+ * Pre: none
+ * Post: Seed and its newline are on stdout, exits with 1 on failure
+ */
+void printSeed(void)
+{
+	// Set variables
+	struct otp_seed seed;		// Key, then nonce, as otp_enc and otp_dec read it
+	unsigned char *bytes = (unsigned char *)&seed;	// The seed byte by byte
+	FILE *random_file;		// The system's random source
+	size_t i;			// Helps with loop
+
+	random_file = fopen("/dev/urandom", "rb");
+	if (random_file == NULL || fread(bytes, 1, sizeof(seed), random_file) != sizeof(seed))
+	{
+		fprintf(stderr, "keygen: could not read /dev/urandom\n");
+		exit(1);
+	}
+	fclose(random_file);
+	for (i = 0; i < sizeof(seed); i++)
+		printf("%02x", bytes[i]);
+	printf("\n");
+}
+
+/*
+ * Function: printBytes
+ * Parameters: bytes of the key
+ * Overview: Prints a binary key a block at a time.  Every byte is used,
+ * 	so it comes from the system's random source, not rand.
+ * Pre: none
+ * Post: Key is on stdout without a newline, exits with 1 on failure
+ */
+void printBytes(unsigned long long length)
+{
+	// Set variables
+	char block[KEY_BLOCK];		// Bytes of this block
+	FILE *random_file;		// The system's random source
+	unsigned long long done;	// Bytes written so far
+	size_t n;			// Bytes of this block
+
+	random_file = fopen("/dev/urandom", "rb");
+	if (random_file == NULL)
+	{
+		fprintf(stderr, "keygen: could not read /dev/urandom\n");
+		exit(1);
+	}
+	for (done = 0; done < length; done += n)
+	{
+		n = length - done < KEY_BLOCK ? (size_t)(length - done) : KEY_BLOCK;
+		if (fread(block, 1, n, random_file) != n)
+		{
+			fprintf(stderr, "keygen: could not read /dev/urandom\n");
+			exit(1);
+		}
+		if (fwrite(block, 1, n, stdout) != n)
+		{
+			fprintf(stderr, "keygen: write failed\n");
+			exit(1);
+		}
+	}
+	fclose(random_file);
+}
+
 /*
  * Function: main
  * Parameters: number of arguments, arguments
@@ -48,28 +124,54 @@ void getKeyString(int str_length, char *key_string)
 int main(int argc, char** argv)
 {
 	// Set variables
-	char *key_string;	// Randomly generated string from length
-	int str_length;		// Length of the string for the key
+	char *key_string;		// Randomly generated block of the key
+	unsigned long long str_length;	// Length of the string for the key
+	unsigned long long done;	// Characters written so far
+	int n;				// Characters of this block
 	
 	// Initialize random number generator
 	srand(time(NULL));
 
-	// Check to be sure there are only 2 arguments, otherwise print error and exit
-	if (argc !=2)
+	// Check to be sure there are only 2 arguments, or 3 with -b, otherwise print error and exit
+	if (argc == 3 && strcmp(argv[1], "-b") == 0)
+	{
+		printBytes(strtoull(argv[2], NULL, 10));
+		return 0;
+	}
+	else if (argc != 2 || strcmp(argv[1], "-b") == 0)
 	{
-		fprintf(stderr, "keygen usage: keygen <number_of_characters>\n");
+		fprintf(stderr, "keygen usage: keygen <number_of_characters>\n\tkeygen -b <number_of_bytes>\n\tkeygen -s\n");
 		exit(1);
 	}	
+	else if (strcmp(argv[1], "-s") == 0)
+	{
+		printSeed();
+		return 0;
+	}
 	else
 	{
-		// Get the length of the string	
-		str_length = atoi(argv[1]);
+		// Get the length of the string, which may be past what an int holds
+		str_length = strtoull(argv[1], NULL, 10);
 		// Allocate a block of size bytes of memeory for the key string
-		key_string = (char*)malloc(sizeof(char)*(str_length + 1));
-		// Function to get teh key string
-		getKeyString(str_length, key_string);
-		// Print the generated key and with a newline char
-		printf("%s\n", key_string);
+		key_string = (char*)malloc(sizeof(char)*(KEY_BLOCK + 1));
+		if (key_string == NULL)
+		{
+			fprintf(stderr, "keygen: out of memory\n");
+			exit(1);
+		}
+		// Generate and print the key a block at a time
+		for (done = 0; done < str_length; done += n)
+		{
+			n = str_length - done < KEY_BLOCK ? (int)(str_length - done) : KEY_BLOCK;
+			getKeyString(n, key_string);
+			if (fwrite(key_string, 1, n, stdout) != (size_t)n)
+			{
+				fprintf(stderr, "keygen: write failed\n");
+				exit(1);
+			}
+		}
+		// Print the newline at the end of the key
+		printf("\n");
 	}
 
 	// Unallocate (free) the block of memory for the key string
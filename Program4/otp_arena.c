@@ -0,0 +1,185 @@
+/*
+ * File otp_arena.c
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Bump allocator for the buffers of a single request.  Chunks are
+ * 	mapped on demand and kept on a list.  A reset only rewinds to the first
+ * 	chunk; every other chunk is rewound when the arena reaches it again, so
+ * 	the reset does the same amount of work however much was allocated.
+ * Last Update: 06/03/2016
+ * Sources: Region-based memory management - https://en.wikipedia.org/wiki/Region-based_memory_management
+ */
+
+// Include Libraries
+#include <string.h>	// memcpy for arenaGrow
+#include <sys/mman.h>	// Chunks come straight from the kernel
+#include "otp_arena.h"
+
+/* Function: roundUp
+ * Parameters: some size
+ * Overview: Rounds a size up to the arena alignment
+ * Pre: none
+ * Post: Returns the rounded size
+ */
+static size_t roundUp(size_t size)
+{
+	return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+/* Function: newChunk
+ * Parameters: arena, bytes the chunk must hold
+ * Overview: Maps a chunk big enough for the request, at least chunk_size
+ * Pre: Arena is set up
+ * Post: Returns the chunk, or NULL if the mapping failed
+ */
+static struct arena_chunk *newChunk(struct arena *a, size_t need)
+{
+	// Set variables
+	struct arena_chunk *chunk;	// New chunk
+	size_t header;			// Bytes the chunk header takes
+	size_t total;			// Bytes to map
+	void *mem;			// Mapping
+
+	header = roundUp(sizeof(struct arena_chunk));
+	total = header + (need > a->chunk_size ? roundUp(need) : a->chunk_size);
+	mem = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		return NULL;
+
+	chunk = mem;
+	chunk->next = NULL;
+	chunk->size = total - header;
+	chunk->used = 0;
+	chunk->data = (char *)mem + header;
+	a->mapped += total;
+	return chunk;
+}
+
+/* Function: arenaInit
+ * Parameters: arena, chunk size (0 for ARENA_CHUNK)
+ * Overview: Sets up an arena with its first chunk
+ * Pre: none
+ * Post: Returns 0, or -1 if the first chunk could not be mapped
+ */
+int arenaInit(struct arena *a, size_t chunk_size)
+{
+	memset(a, 0, sizeof(*a));
+	a->chunk_size = chunk_size == 0 ? ARENA_CHUNK : roundUp(chunk_size);
+	a->head = newChunk(a, a->chunk_size);
+	if (a->head == NULL)
+		return -1;
+	a->cur = a->head;
+	return 0;
+}
+
+/* Function: arenaAlloc
+ * Parameters: arena, size
+ * Overview: Hands out size bytes, moving on to the next kept chunk or
+ * 	mapping a new one when the current chunk is full
+ * Pre: Arena is set up
+ * Post: Returns aligned memory that lives until the next reset, or NULL
+ */
+void *arenaAlloc(struct arena *a, size_t size)
+{
+	// Set variables
+	struct arena_chunk *chunk = a->cur;	// Chunk being tried
+	struct arena_chunk *fresh;		// Newly mapped chunk
+	void *ptr;				// Memory handed out
+
+	size = roundUp(size == 0 ? 1 : size);
+
+	// Walk forward over kept chunks until one has room, rewinding each
+	while (chunk->size - chunk->used < size)
+	{
+		if (chunk->next == NULL || chunk->next->size < size)
+		{
+			// Put a new chunk right after this one so kept chunks stay in order
+			fresh = newChunk(a, size);
+			if (fresh == NULL)
+				return NULL;
+			fresh->next = chunk->next;
+			chunk->next = fresh;
+		}
+		chunk = chunk->next;
+		chunk->used = 0;
+	}
+	a->cur = chunk;
+
+	ptr = chunk->data + chunk->used;
+	chunk->used += size;
+	a->in_use += size;
+	if (a->in_use > a->peak)
+		a->peak = a->in_use;
+	a->last = ptr;
+	return ptr;
+}
+
+/* Function: arenaGrow
+ * Parameters: arena, allocation, its size, the size it needs
+ * Overview: Makes an allocation bigger, in place when it is the latest one
+ * 	and its chunk has room, otherwise by copying it to a new allocation
+ * Pre: ptr came from this arena since the last reset
+ * Post: Returns the grown allocation, or NULL
+ */
+void *arenaGrow(struct arena *a, void *ptr, size_t old_size, size_t new_size)
+{
+	// Set variables
+	struct arena_chunk *chunk = a->cur;	// Chunk of the latest allocation
+	size_t old_round = roundUp(old_size == 0 ? 1 : old_size);
+	size_t new_round = roundUp(new_size == 0 ? 1 : new_size);
+	void *moved;				// New home of the allocation
+
+	if (new_round <= old_round)
+		return ptr;
+
+	// The latest allocation can simply be extended
+	if (ptr == a->last && chunk->size - chunk->used >= new_round - old_round)
+	{
+		chunk->used += new_round - old_round;
+		a->in_use += new_round - old_round;
+		if (a->in_use > a->peak)
+			a->peak = a->in_use;
+		return ptr;
+	}
+
+	moved = arenaAlloc(a, new_size);
+	if (moved != NULL && ptr != NULL)
+		memcpy(moved, ptr, old_size);
+	return moved;
+}
+
+/* Function: arenaReset
+ * Parameters: arena
+ * Overview: Releases every allocation at once
+ * Pre: Nothing handed out since the last reset is still used
+ * Post: Arena is empty, chunks are kept for the next request
+ */
+void arenaReset(struct arena *a)
+{
+	a->cur = a->head;
+	a->head->used = 0;
+	a->in_use = 0;
+	a->last = NULL;
+}
+
+/* Function: arenaDestroy
+ * Parameters: arena
+ * Overview: Unmaps every chunk
+ * Pre: Arena is set up
+ * Post: Arena must be set up again before it is used
+ */
+void arenaDestroy(struct arena *a)
+{
+	// Set variables
+	struct arena_chunk *chunk = a->head;	// Chunk being unmapped
+	struct arena_chunk *next;		// Chunk after it
+
+	while (chunk != NULL)
+	{
+		next = chunk->next;
+		munmap(chunk, (size_t)(chunk->data - (char *)chunk) + chunk->size);
+		chunk = next;
+	}
+	memset(a, 0, sizeof(*a));
+}
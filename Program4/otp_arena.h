@@ -0,0 +1,49 @@
+/*
+ * File otp_arena.h
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Bump allocator for the buffers of a single request.  A worker
+ * 	sets up one arena, every buffer a request needs is carved out of it,
+ * 	and the whole arena is reset in O(1) when the request is done.  Memory
+ * 	comes from mmap in large chunks that are kept across requests, so once
+ * 	the chunks are warm no allocator is called at all.
+ * Last Update: 06/03/2016
+ */
+
+#ifndef OTP_ARENA_H
+#define OTP_ARENA_H
+
+#include <stddef.h>	// size_t
+
+#define ARENA_ALIGN	16		// Alignment of every allocation
+#define ARENA_CHUNK	(1 << 20)	// Default chunk size, 1 MiB
+
+/* One mapped block of memory */
+struct arena_chunk
+{
+	struct arena_chunk *next;	// Next chunk in the list
+	size_t size;			// Usable bytes in data
+	size_t used;			// Bytes handed out since the last reset
+	char *data;			// Start of the usable bytes
+};
+
+/* The arena of one worker */
+struct arena
+{
+	struct arena_chunk *head;	// First chunk, never freed
+	struct arena_chunk *cur;	// Chunk allocations come from
+	size_t chunk_size;		// Size of new chunks
+	size_t in_use;			// Bytes handed out since the last reset
+	size_t peak;			// Most bytes ever in use at once
+	size_t mapped;			// Bytes mapped for all chunks
+	void *last;			// Most recent allocation, for arenaGrow
+};
+
+int arenaInit(struct arena *a, size_t chunk_size);
+void *arenaAlloc(struct arena *a, size_t size);
+void *arenaGrow(struct arena *a, void *ptr, size_t old_size, size_t new_size);
+void arenaReset(struct arena *a);
+void arenaDestroy(struct arena *a);
+
+#endif
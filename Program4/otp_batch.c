@@ -0,0 +1,288 @@
+/*
+ * File otp_batch.c
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Batches of small requests.  The requests of a batch are laid
+ * 	out one after the other in a text, a key and a result buffer, each
+ * 	behind room for its status, and a descriptor per request says where
+ * 	it sits.  The room in front of a request is filled with spaces in
+ * 	the text and key, so the whole batch is checked and cyphered by one
+ * 	codecFused over all three buffers.  When that pass stops on a bad
+ * 	character the descriptors tell whose it is, that request is marked
+ * 	and the pass goes on from the next one.  Each result then goes out
+ * 	behind its status in one send, straight from the result buffer.
+ * 	Uploads are taken as they arrive from whichever client is ready, so
+ * 	a slow client holds up the others no longer than its own deadline.
+ * Last Update: 06/03/2016
+ */
+
+// Include Libraries
+#include <stdio.h>	// General IO, including printf to redirect files
+#include <stdlib.h>	// General purpose functions
+#include <string.h>	// Manipulation of C strings and arrays
+#include <errno.h>	// Checking results of non-blocking calls
+#include <time.h>	// Monotonic clock for deadlines
+#include <poll.h>	// Waiting on every upload at once
+#include <unistd.h>	// Provides access to the POSIX API
+#include <sys/socket.h>	// Makes available for the use of sockets
+#include "otp_batch.h"
+#include "otp_codec.h"
+#include "otp_io.h"
+#include "otp_memtrace.h"
+#include "otp_metrics.h"
+
+#define BATCH_ALIGN	sizeof(struct otp_status)	// Every request starts on this boundary
+
+/* Where one request of a batch sits in the batch buffers */
+struct batch_desc
+{
+	int sock;			// Client socket, -1 once dropped
+	int with_status;		// Client asked for a status
+	size_t off;			// First byte of its text, key and result
+	size_t n;			// Bytes of text
+	size_t got;			// Bytes of text and key received
+	size_t bad;			// First bad character, n if none
+	struct io_phase phase;		// Deadline of its upload, then its download
+};
+
+/* Function: batchNow
+ * Parameters: none
+ * Overview: Reads the clock io_phase deadlines are kept in
+ * Pre: none
+ * Post: Returns the time in milliseconds
+ */
+static unsigned long long batchNow(void)
+{
+	// Set variables
+	struct timespec ts;		// Current time
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Function: batchDrop
+ * Parameters: descriptor, text and key buffers
+ * Overview: Drops a client of the batch.  Its part of the buffers is filled
+ * 	with spaces so the pass over the batch goes straight through it.
+ * Pre: Client is still in the batch
+ * Post: Client is reset, nothing more is sent to it
+ */
+static void batchDrop(struct batch_desc *d, char *text, char *key)
+{
+	ioAbort(d->sock);
+	d->sock = -1;
+	memset(text + d->off, ' ', d->n);
+	memset(key + d->off, ' ', d->n);
+}
+
+/* Function: batchRecv
+ * Parameters: descriptors, requests, text and key buffers, poll set and
+ * 	the request of each entry, daemon name for messages
+ * Overview: Receives the text and then the key of every request, reading
+ * 	from whichever client has data until all are in or out of time
+ * Pre: Every client was told to go and its upload phase started
+ * Post: Every request still in the batch is complete, the others dropped
+ */
+static void batchRecv(struct batch_desc *d, int count, char *text, char *key, struct pollfd *fds, int *which, const char *prog)
+{
+	// Set variables
+	unsigned long long now;		// Current time
+	int wait;			// Longest poll
+	int nfds;			// Entries in the poll set
+	char *dst;			// Where the next bytes go
+	size_t want;			// Bytes still wanted there
+	ssize_t n;			// Result of recv
+	int i;				// For the loops
+	int j;				// For the loops
+
+	while (1)
+	{
+		// Poll every client that still owes bytes and is within its deadline
+		now = batchNow();
+		wait = -1;
+		nfds = 0;
+		for (i = 0; i < count; i++)
+		{
+			if (d[i].sock == -1 || d[i].got == 2 * d[i].n)
+				continue;
+			if (now >= d[i].phase.deadline)
+			{
+				metricsEmit("io_timeout phase=%s bytes=%llu of=%llu elapsed_ms=%llu",
+					d[i].phase.name, d[i].phase.done, d[i].phase.total, now - d[i].phase.start);
+				fprintf(stderr, "%s ERROR: Client sent %llu of %llu bytes\n", prog,
+					d[i].phase.done, d[i].phase.total);
+				batchDrop(&d[i], text, key);
+				continue;
+			}
+			if (wait == -1 || d[i].phase.deadline - now < (unsigned long long)wait)
+				wait = (int)(d[i].phase.deadline - now);
+			fds[nfds].fd = d[i].sock;
+			fds[nfds].events = POLLIN;
+			which[nfds] = i;
+			nfds++;
+		}
+		if (nfds == 0)
+			return;
+		if (poll(fds, nfds, wait) == -1 && errno != EINTR)
+		{
+			fprintf(stderr, "%s ERROR: Failed to poll the batch\n", prog);
+			exit(1);
+		}
+
+		for (j = 0; j < nfds; j++)
+		{
+			if (fds[j].revents == 0)
+				continue;
+			i = which[j];
+			if (d[i].got < d[i].n)
+			{
+				dst = text + d[i].off + d[i].got;
+				want = d[i].n - d[i].got;
+			}
+			else
+			{
+				dst = key + d[i].off + d[i].got - d[i].n;
+				want = 2 * d[i].n - d[i].got;
+			}
+			n = recv(d[i].sock, dst, want, MSG_DONTWAIT);
+			if (n > 0)
+			{
+				d[i].got += n;
+				d[i].phase.done += n;
+			}
+			else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+			{
+				fprintf(stderr, "%s ERROR: Client sent %llu of %llu bytes\n", prog,
+					d[i].phase.done, d[i].phase.total);
+				batchDrop(&d[i], text, key);
+			}
+		}
+	}
+}
+
+/* Function: batchRun
+ * Parameters: client sockets, their hellos, number of requests, request
+ * 	arena, CODEC_ENC or CODEC_DEC, daemon name for messages
+ * Overview: Serves a batch of one-shot requests: tells every client to go,
+ * 	receives them all, cyphers them in one pass and answers each one.  A
+ * 	client that fails or sends bad input is dealt with the way a worker
+ * 	of its own would, without holding up the rest of the batch.
+ * Pre: Daemon admitted every request, none asked to keep its connection
+ * Post: Every client got its result or was dropped, every socket is closed
+ */
+void batchRun(int *client_socks, struct otp_hello *hellos, int count, struct arena *arena, int dir, const char *prog)
+{
+	// Set variables
+	struct batch_desc *d;		// Descriptor of every request
+	struct pollfd *fds;		// Poll set of the uploads
+	int *which;			// Request of each poll entry
+	struct otp_status *status;	// Status in front of a result
+	char *text;			// Text of every request
+	char *key;			// Key of every request
+	char *out;			// Result of every request
+	char go = REPLY_GO;		// Tells a client to send
+	size_t total = 0;		// Bytes of the buffers
+	size_t pos;			// Where the pass goes on from
+	size_t bad;			// Where the pass stopped
+	size_t prev;			// End of the request before
+	size_t len;			// Bytes to send a client
+	int i;				// For the loops
+
+	d = reqAlloc(arena, count * sizeof(*d));
+	fds = reqAlloc(arena, count * sizeof(*fds));
+	which = reqAlloc(arena, count * sizeof(*which));
+	if (d == NULL || fds == NULL || which == NULL)
+	{
+		fprintf(stderr, "%s ERROR: Out of memory for the batch\n", prog);
+		exit(1);
+	}
+
+	// Lay the requests out one after the other, each behind room for its status
+	for (i = 0; i < count; i++)
+	{
+		total = (total + BATCH_ALIGN - 1) / BATCH_ALIGN * BATCH_ALIGN + sizeof(*status);
+		d[i].sock = client_socks[i];
+		d[i].with_status = (ntohl(hellos[i].flags) & HELLO_STATUS) != 0;
+		d[i].off = total;
+		d[i].n = helloLength(&hellos[i]);
+		d[i].got = 0;
+		d[i].bad = d[i].n;
+		total += d[i].n;
+	}
+	text = reqAlloc(arena, total);
+	key = reqAlloc(arena, total);
+	out = reqAlloc(arena, total);
+	if (text == NULL || key == NULL || out == NULL)
+	{
+		fprintf(stderr, "%s ERROR: Out of memory for the batch\n", prog);
+		exit(1);
+	}
+	for (i = 0, prev = 0; i < count; i++)
+	{
+		memset(text + prev, ' ', d[i].off - prev);
+		memset(key + prev, ' ', d[i].off - prev);
+		prev = d[i].off + d[i].n;
+	}
+
+	// Tell every client to go, then take the uploads as they come
+	for (i = 0; i < count; i++)
+	{
+		ioPhase(&d[i].phase, "upload", 2ULL * d[i].n);
+		if (send(d[i].sock, &go, 1, MSG_NOSIGNAL) != 1)
+		{
+			fprintf(stderr, "%s ERROR: Failed to send confirmation\n", prog);
+			batchDrop(&d[i], text, key);
+		}
+	}
+	batchRecv(d, count, text, key, fds, which, prog);
+
+	// One pass over the whole batch, a bad character only stops its own request
+	for (pos = 0, i = 0; pos < total; pos = d[i].off + d[i].n)
+	{
+		bad = pos + codecFused(text + pos, key + pos, out + pos, total - pos, dir);
+		if (bad == total)
+			break;
+		while (d[i].off + d[i].n <= bad)
+			i++;
+		d[i].bad = bad - d[i].off;
+	}
+
+	// Answer every client, its result behind its status if asked for
+	for (i = 0; i < count; i++)
+	{
+		if (d[i].sock == -1)
+			continue;
+		status = (struct otp_status *)(out + d[i].off) - 1;
+		memset(status, 0, sizeof(*status));
+		if (d[i].bad < d[i].n)
+		{
+			status->code = codecCheck(text + d[i].off + d[i].bad, 1) == 0 ? STATUS_BAD_TEXT : STATUS_BAD_KEY;
+			status->offset = htobe64(d[i].bad);
+			metricsEmit("bad_input which=%s offset=%llu length=%llu",
+				status->code == STATUS_BAD_TEXT ? "text" : "key", (unsigned long long)d[i].bad, (unsigned long long)d[i].n);
+			if (!d[i].with_status)
+			{
+				// The client would take whatever comes back as its result
+				fprintf(stderr, "%s ERROR: Bad character at offset %llu of the %s\n", prog,
+					(unsigned long long)d[i].bad, status->code == STATUS_BAD_TEXT ? "text" : "key");
+				ioAbort(d[i].sock);
+				continue;
+			}
+			len = sizeof(*status);
+		}
+		else
+		{
+			status->code = STATUS_OK;
+			len = d[i].with_status ? sizeof(*status) + d[i].n : d[i].n;
+		}
+		ioPhase(&d[i].phase, "download", len);
+		if (ioSend(d[i].sock, d[i].with_status ? (char *)status : out + d[i].off, len, &d[i].phase) == -1)
+		{
+			fprintf(stderr, "%s ERROR: Issue with sending data to client\n", prog);
+			ioAbort(d[i].sock);
+			continue;
+		}
+		close(d[i].sock);
+	}
+}
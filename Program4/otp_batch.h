@@ -0,0 +1,22 @@
+/*
+ * File otp_batch.h
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Batches of small requests in a daemon worker.  The daemon
+ * 	gathers small one-shot requests for a short window and hands them to
+ * 	one worker, which receives all of them at once, checks and cyphers
+ * 	them in a single pass and answers each client.  The fork, the arena
+ * 	and the kernel setup are paid once per batch instead of per request.
+ * Last Update: 06/03/2016
+ */
+
+#ifndef OTP_BATCH_H
+#define OTP_BATCH_H
+
+#include "otp_arena.h"
+#include "otp_proto.h"
+
+void batchRun(int *client_socks, struct otp_hello *hellos, int count, struct arena *arena, int dir, const char *prog);
+
+#endif
@@ -0,0 +1,671 @@
+/*
+ * File otp_bench.c
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Open-loop latency benchmark for the otp_enc_d and otp_dec_d
+ * 	daemons.  Requests are started on a fixed arrival schedule no matter
+ * 	how many earlier requests are still outstanding, and every latency is
+ * 	measured from the time the request was supposed to be sent.  A slow
+ * 	daemon therefore cannot hide its tail by slowing the client down
+ * 	(coordinated omission).  Latencies go into an HDR style histogram and
+ * 	the program reports p50/p90/p99/p99.9/max.  Only answered requests
+ * 	are recorded, with timeouts and sends skipped at the outstanding cap
+ * 	charged the full timeout; refusals and errors are only counted, so a
+ * 	saturated daemon's fast 'M' replies can't pull the tail down.  A
+ * 	rate sweep can be run to find the saturation knee of a daemon.
+ * Last Update: 06/03/2016
+ * Sources: Operating Systems Lectures 15, 16, and 17.
+ *   Beej's Guide to Network Programming - http://beej.us/guide/bgnet/output/html/singlepage/bgnet.html
+ *   HdrHistogram - http://hdrhistogram.org/
+ *   How NOT to Measure Latency, Gil Tene - https://www.azul.com/presentations/how-not-to-measure-latency-4/
+ */
+
+// Include Libraries
+#include <stdio.h>	// General IO, including printf to redirect files
+#include <stdlib.h>	// General purpose functions
+#include <string.h>	// Manipulation of C strings and arrays
+#include <stdint.h>	// Fixed width integers for the histogram
+#include <errno.h>	// Checking results of non-blocking calls
+#include <time.h>	// Monotonic clock for the arrival schedule
+#include <signal.h>	// Ignore SIGPIPE from daemons that hang up
+#include <sys/types.h>	// For networking with sockets
+#include <sys/stat.h>	// Getting the size of payload files
+#include <fcntl.h>	// Non-blocking sockets and opening files
+#include <unistd.h>	// Provides access to the POSIX API
+#include <sys/socket.h>	// Makes available for the use of sockets
+#include <sys/epoll.h>	// Waiting on many outstanding requests at once
+#include <netinet/in.h>	// Makes available access to network addresses
+#include <arpa/inet.h>	// Makes available ports
+#include "otp_proto.h"	// Hello and replies
+
+// Histogram layout: values below 2048 are counted exactly, above that every
+// power of two is split into 1024 buckets, so each recorded value is kept
+// to three significant digits.
+#define HIST_SUB_BITS	10
+#define HIST_SUB_COUNT	(1 << HIST_SUB_BITS)
+#define HIST_MAX_SHIFT	32
+#define HIST_BUCKETS	((HIST_MAX_SHIFT + 2) * HIST_SUB_COUNT)
+
+// States a single request moves through
+#define REQ_FREE	0	// Slot is unused
+#define REQ_CONNECT	1	// Waiting for the non-blocking connect
+#define REQ_CONF	2	// Sent the hello, waiting for the S/M/U reply
+#define REQ_UPLOAD	3	// Sending the payload and key
+#define REQ_DOWNLOAD	4	// Reading the reply until the daemon hangs up
+
+/* Latency histogram in microseconds */
+struct hist
+{
+	uint64_t counts[HIST_BUCKETS];	// Count of values per bucket
+	uint64_t total;			// Number of values recorded
+	uint64_t max;			// Largest exact value recorded
+};
+
+/* One outstanding request */
+struct request
+{
+	int state;			// One of the REQ_ states
+	int fd;				// Socket to the daemon
+	uint64_t intended;		// Time the request should have been sent
+	size_t sent;			// Bytes of payload + key sent so far
+};
+
+/* Results of running one rate */
+struct run_result
+{
+	double offered;			// Requests per second asked for
+	double achieved;		// Successful requests per second
+	uint64_t ok;			// Requests answered with a reply
+	uint64_t rejected;		// Requests refused with "M" or "U"
+	uint64_t errors;		// Connect, send or receive failures
+	uint64_t timeouts;		// Requests that never finished
+	uint64_t skipped;		// Sends that hit the outstanding cap
+	struct hist lat;		// Latency of answered, timed out and skipped requests
+};
+
+/* Everything the benchmark needs to know */
+struct bench_conf
+{
+	struct sockaddr_in addr;	// Daemon address
+	char mode[4];			// "enc" or "dec"
+	struct otp_hello hello;		// Hello every request starts with
+	char *upload;			// Payload followed by the key
+	size_t payload_len;		// Length of the payload part, no newline
+	size_t upload_len;		// Length of payload plus key
+	int duration;			// Seconds to run each rate
+	int max_out;			// Cap on outstanding requests
+	int timeout_ms;			// Per request timeout
+};
+
+/* Function: nowUsec
+ * Parameters: none
+ * Overview: Reads the monotonic clock
+ * Pre: none
+ * Post: Returns the time in microseconds
+ */
+uint64_t nowUsec(void)
+{
+	// Set variables
+	struct timespec ts;		// Current time
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Function: histIndex
+ * Parameters: some value
+ * Overview: Finds the bucket a value is counted in
+ * Pre: none
+ * Post: Returns the bucket index
+ */
+int histIndex(uint64_t value)
+{
+	// Set variables
+	int shift;		// How far the value is scaled down
+
+	// Small values are counted exactly
+	if (value < 2 * HIST_SUB_COUNT)
+		return (int)value;
+
+	// Scale the value down so it lands in [1024, 2048)
+	shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+	if (shift > HIST_MAX_SHIFT)
+		return HIST_BUCKETS - 1;
+	return (shift + 1) * HIST_SUB_COUNT + (int)((value >> shift) - HIST_SUB_COUNT);
+}
+
+/* Function: histHighest
+ * Parameters: bucket index
+ * Overview: Finds the largest value that is counted in a bucket
+ * Pre: none
+ * Post: Returns the highest equivalent value of the bucket
+ */
+uint64_t histHighest(int index)
+{
+	// Set variables
+	int shift;		// How far values in the bucket were scaled
+	uint64_t sub;		// Scaled value of the bucket
+
+	if (index < 2 * HIST_SUB_COUNT)
+		return (uint64_t)index;
+	shift = index / HIST_SUB_COUNT - 1;
+	sub = (uint64_t)(index % HIST_SUB_COUNT + HIST_SUB_COUNT);
+	return ((sub + 1) << shift) - 1;
+}
+
+/* Function: histRecord
+ * Parameters: histogram, some value
+ * Overview: Counts a value in the histogram
+ * Pre: Histogram is zeroed
+ * Post: Value is counted
+ */
+void histRecord(struct hist *h, uint64_t value)
+{
+	h->counts[histIndex(value)]++;
+	h->total++;
+	if (value > h->max)
+		h->max = value;
+}
+
+/* Function: histPercentile
+ * Parameters: histogram, percentile between 0 and 100
+ * Overview: Finds the value at a percentile
+ * Pre: Values have been recorded
+ * Post: Returns the highest equivalent value at the percentile
+ */
+uint64_t histPercentile(struct hist *h, double pct)
+{
+	// Set variables
+	uint64_t wanted;	// Count to reach
+	uint64_t seen = 0;	// Count so far
+	int i;			// For the loop
+
+	if (h->total == 0)
+		return 0;
+	wanted = (uint64_t)(pct / 100.0 * h->total + 0.5);
+	if (wanted < 1)
+		wanted = 1;
+	for (i = 0; i < HIST_BUCKETS; i++)
+	{
+		seen += h->counts[i];
+		if (seen >= wanted)
+			return histHighest(i) < h->max ? histHighest(i) : h->max;
+	}
+	return h->max;
+}
+
+/* Function: readWhole
+ * Parameters: file name, length to return
+ * Overview: Reads a payload or key file into memory
+ * Pre: none
+ * Post: Returns the contents, exits if the file can't be read
+ */
+char *readWhole(char *name, size_t *length)
+{
+	// Set variables
+	int fd;			// File being read
+	struct stat st;		// Size of the file
+	char *buf;		// Contents
+	ssize_t got;		// Result of read
+	size_t total = 0;	// Bytes read so far
+
+	fd = open(name, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) == -1)
+	{
+		fprintf(stderr, "otp_bench ERROR: %s could not be opened\n", name);
+		exit(1);
+	}
+	buf = malloc(st.st_size + 1);
+	while (total < (size_t)st.st_size && (got = read(fd, buf + total, st.st_size - total)) > 0)
+		total += got;
+	close(fd);
+	*length = total;
+	return buf;
+}
+
+/* Function: randomText
+ * Parameters: buffer, length
+ * Overview: Fills a buffer with valid plaintext ending in a newline, the
+ * 	same shape as the files made by keygen
+ * Pre: buffer holds length bytes
+ * Post: buffer is filled
+ */
+void randomText(char *buf, size_t length)
+{
+	// Set variables
+	static const char poss_chars[] = " ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+	size_t i;		// For the loop
+
+	for (i = 0; i < length; i++)
+		buf[i] = poss_chars[rand() % (sizeof(poss_chars) - 1)];
+	if (length > 0)
+		buf[length - 1] = '\n';
+}
+
+/* Function: reqClose
+ * Parameters: epoll descriptor, request
+ * Overview: Tears down a request and frees its slot
+ * Pre: Request is in use
+ * Post: Socket is closed and slot is free
+ */
+void reqClose(int ep, struct request *req)
+{
+	epoll_ctl(ep, EPOLL_CTL_DEL, req->fd, NULL);
+	close(req->fd);
+	req->fd = -1;
+	req->state = REQ_FREE;
+}
+
+/* Function: reqFinish
+ * Parameters: epoll descriptor, request, result counter to bump, histogram
+ * 	to record the latency in or NULL, least latency to record
+ * Overview: Records the latency of a finished request from its intended
+ * 	send time and frees the slot.  Refused and failed requests are
+ * 	counted but not recorded, a fast 'M' is not a fast answer.
+ * Pre: Request is in use
+ * Post: Latency recorded, slot freed
+ */
+void reqFinish(int ep, struct request *req, uint64_t *counter, struct hist *lat, uint64_t least)
+{
+	// Set variables
+	uint64_t now = nowUsec();	// Time the request finished
+	uint64_t took = now > req->intended ? now - req->intended : 0;	// Its latency
+
+	if (lat != NULL)
+		histRecord(lat, took > least ? took : least);
+	(*counter)++;
+	reqClose(ep, req);
+}
+
+/* Function: reqStart
+ * Parameters: epoll descriptor, request slot, intended send time, config
+ * Overview: Starts a non-blocking connection to the daemon
+ * Pre: Slot is free
+ * Post: Returns 0 if started, -1 if the connection failed at once
+ */
+int reqStart(int ep, struct request *req, uint64_t intended, struct bench_conf *conf)
+{
+	// Set variables
+	struct epoll_event ev;		// Registration for the socket
+
+	req->intended = intended;
+	req->sent = 0;
+	req->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (req->fd == -1)
+		return -1;
+	if (connect(req->fd, (struct sockaddr *)&conf->addr, sizeof(conf->addr)) == -1 && errno != EINPROGRESS)
+	{
+		close(req->fd);
+		return -1;
+	}
+	req->state = REQ_CONNECT;
+	ev.events = EPOLLOUT;
+	ev.data.ptr = req;
+	epoll_ctl(ep, EPOLL_CTL_ADD, req->fd, &ev);
+	return 0;
+}
+
+/* Function: reqUpload
+ * Parameters: request, config
+ * Overview: Sends as much of the payload and key as the socket takes
+ * Pre: Daemon answered "S"
+ * Post: Returns 1 when everything is sent, 0 if more is left, -1 on error
+ */
+int reqUpload(struct request *req, struct bench_conf *conf)
+{
+	// Set variables
+	ssize_t n;		// Result of send
+
+	while (req->sent < conf->upload_len)
+	{
+		n = send(req->fd, conf->upload + req->sent, conf->upload_len - req->sent, MSG_NOSIGNAL);
+		if (n == -1)
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		req->sent += n;
+	}
+	return 1;
+}
+
+/* Function: reqEvent
+ * Parameters: epoll descriptor, request, config, results
+ * Overview: Moves a request along when its socket is ready
+ * Pre: Request is in use
+ * Post: Request advanced, finished or failed
+ */
+void reqEvent(int ep, struct request *req, struct bench_conf *conf, struct run_result *res)
+{
+	// Set variables
+	struct epoll_event ev;		// New registration
+	char buf[4096];			// Reply bytes, thrown away
+	int err = 0;			// Socket error
+	socklen_t err_len = sizeof(err);
+	ssize_t n;			// Result of recv
+	int done;			// Result of upload
+
+	switch (req->state)
+	{
+	case REQ_CONNECT:
+		getsockopt(req->fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+		if (err != 0 || send(req->fd, &conf->hello, sizeof(conf->hello), MSG_NOSIGNAL) != sizeof(conf->hello))
+		{
+			reqFinish(ep, req, &res->errors, NULL, 0);
+			return;
+		}
+		req->state = REQ_CONF;
+		ev.events = EPOLLIN;
+		ev.data.ptr = req;
+		epoll_ctl(ep, EPOLL_CTL_MOD, req->fd, &ev);
+		return;
+	case REQ_CONF:
+		n = recv(req->fd, buf, 1, 0);
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		if (n != 1)
+		{
+			reqFinish(ep, req, &res->errors, NULL, 0);
+			return;
+		}
+		if (buf[0] != REPLY_GO)
+		{
+			reqFinish(ep, req, &res->rejected, NULL, 0);
+			return;
+		}
+		req->state = REQ_UPLOAD;
+		ev.events = EPOLLOUT;
+		ev.data.ptr = req;
+		epoll_ctl(ep, EPOLL_CTL_MOD, req->fd, &ev);
+		/* fall through - start sending right away */
+	case REQ_UPLOAD:
+		done = reqUpload(req, conf);
+		if (done == -1)
+		{
+			reqFinish(ep, req, &res->errors, NULL, 0);
+			return;
+		}
+		if (done == 0)
+			return;
+		req->state = REQ_DOWNLOAD;
+		ev.events = EPOLLIN;
+		ev.data.ptr = req;
+		epoll_ctl(ep, EPOLL_CTL_MOD, req->fd, &ev);
+		return;
+	case REQ_DOWNLOAD:
+		// The daemon hangs up once the reply is sent
+		while ((n = recv(req->fd, buf, sizeof(buf), 0)) > 0)
+			;
+		if (n == 0)
+			reqFinish(ep, req, &res->ok, &res->lat, 0);
+		else if (errno != EAGAIN && errno != EWOULDBLOCK)
+			reqFinish(ep, req, &res->errors, NULL, 0);
+		return;
+	}
+}
+
+/* Function: runRate
+ * Parameters: config, rate in requests per second, results
+ * Overview: Fires requests at a fixed rate for the configured duration,
+ * 	then waits for the stragglers.  A request that could not be started
+ * 	on time is still measured from its intended start, and one that hit
+ * 	the outstanding cap is charged the full timeout.
+ * Pre: Config is filled in
+ * Post: Results are filled in
+ */
+void runRate(struct bench_conf *conf, double rate, struct run_result *res)
+{
+	// Set variables
+	struct request *reqs;		// Outstanding requests
+	struct epoll_event events[256];	// Ready sockets
+	int ep;				// epoll descriptor
+	uint64_t start;			// Time the run started
+	uint64_t end;			// Time the schedule ends
+	uint64_t next;			// Intended time of the next request
+	uint64_t interval;		// Time between requests
+	uint64_t now;			// Current time
+	uint64_t timeout = (uint64_t)conf->timeout_ms * 1000;	// Request timeout in usec
+	uint64_t sent = 0;		// Requests scheduled so far
+	int outstanding = 0;		// Requests in flight
+	int free_slot = 0;		// Where to look for a free slot
+	int wait_ms;			// Time to sleep in epoll
+	int ready;			// Number of ready sockets
+	int i;				// For the loops
+
+	memset(res, 0, sizeof(*res));
+	res->offered = rate;
+	reqs = calloc(conf->max_out, sizeof(struct request));
+	ep = epoll_create1(0);
+	interval = (uint64_t)(1000000.0 / rate);
+	if (interval == 0)
+		interval = 1;
+
+	start = nowUsec();
+	end = start + (uint64_t)conf->duration * 1000000;
+	next = start;
+	while (1)
+	{
+		now = nowUsec();
+
+		// Start every request that is due, even if the daemon is behind
+		while (next < end && next <= now)
+		{
+			if (outstanding >= conf->max_out)
+			{
+				// Never sent, so it would have waited at least the timeout
+				res->skipped++;
+				histRecord(&res->lat, now - next > timeout ? now - next : timeout);
+			}
+			else
+			{
+				while (reqs[free_slot].state != REQ_FREE)
+					free_slot = (free_slot + 1) % conf->max_out;
+				if (reqStart(ep, &reqs[free_slot], next, conf) == 0)
+					outstanding++;
+				else
+					res->errors++;
+			}
+			sent++;
+			next = start + sent * interval;
+		}
+
+		// Expire requests that took too long
+		for (i = 0; i < conf->max_out; i++)
+		{
+			if (reqs[i].state != REQ_FREE && now - reqs[i].intended > timeout)
+			{
+				reqFinish(ep, &reqs[i], &res->timeouts, &res->lat, timeout);
+				outstanding--;
+			}
+		}
+
+		// Stop once the schedule is over and nothing is left
+		if (next >= end && outstanding == 0)
+			break;
+
+		// Sleep until the next send is due or a socket is ready
+		if (next < end)
+			wait_ms = next > now ? (int)((next - now + 999) / 1000) : 0;
+		else
+			wait_ms = 10;
+		ready = epoll_wait(ep, events, 256, wait_ms);
+		for (i = 0; i < ready; i++)
+		{
+			reqEvent(ep, events[i].data.ptr, conf, res);
+			if (((struct request *)events[i].data.ptr)->state == REQ_FREE)
+				outstanding--;
+		}
+	}
+
+	res->achieved = res->ok / (double)conf->duration;
+	close(ep);
+	free(reqs);
+}
+
+/* Function: printResult
+ * Parameters: results of one rate
+ * Overview: Prints the counts and latency percentiles of a run
+ * Pre: Run is complete
+ * Post: Report is on stdout
+ */
+void printResult(struct run_result *res)
+{
+	printf("rate %9.1f/s  achieved %9.1f/s  ok %llu  rejected %llu  errors %llu  timeouts %llu  skipped %llu\n",
+		res->offered, res->achieved, (unsigned long long)res->ok,
+		(unsigned long long)res->rejected, (unsigned long long)res->errors,
+		(unsigned long long)res->timeouts, (unsigned long long)res->skipped);
+	printf("  latency usec  p50 %llu  p90 %llu  p99 %llu  p99.9 %llu  max %llu\n",
+		(unsigned long long)histPercentile(&res->lat, 50.0),
+		(unsigned long long)histPercentile(&res->lat, 90.0),
+		(unsigned long long)histPercentile(&res->lat, 99.0),
+		(unsigned long long)histPercentile(&res->lat, 99.9),
+		(unsigned long long)res->lat.max);
+	fflush(stdout);
+}
+
+/* Function: usage
+ * Parameters: none
+ * Overview: Prints how to run the benchmark
+ * Pre: none
+ * Post: Exits with 1
+ */
+void usage(void)
+{
+	fprintf(stderr, "otp_bench Usage: otp_bench [-m enc|dec] [-f payload] [-k key] [-s size]\n"
+		"\t[-r rate | -S start:end:step] [-d seconds] [-c max_outstanding]\n"
+		"\t[-t timeout_ms] [-K knee_factor] <port>\n");
+	exit(1);
+}
+
+/* Function: main
+ * Parameters: number of arguments, the arguments
+ * Overview: Handles arguments, runs a single rate or a rate sweep
+ */
+int main(int argc, char *argv[])
+{
+	// Set variables
+	struct bench_conf conf;		// Benchmark settings
+	struct run_result res;		// Results of one rate
+	char *payload_name = NULL;	// Payload file, random if not given
+	char *key_name = NULL;		// Key file, random if not given
+	char *payload;			// Payload contents
+	char *key;			// Key contents
+	size_t key_len;			// Length of the key
+	size_t size = 64;		// Size of a random payload
+	double rate = 100;		// Single rate to run
+	double sweep_start = 0;		// First rate of a sweep
+	double sweep_end = 0;		// Last rate of a sweep
+	double sweep_step = 0;		// Rate increase per step of a sweep
+	double knee_factor = 5.0;	// p99 growth that marks the knee
+	uint64_t base_p99 = 0;		// p99 of the first sweep step
+	double knee = 0;		// Last rate before the knee
+	int found_knee = 0;		// Whether the knee was reached
+	int opt;			// Current option
+
+	memset(&conf, 0, sizeof(conf));
+	strcpy(conf.mode, "enc");
+	conf.duration = 5;
+	conf.max_out = 1024;
+	conf.timeout_ms = 10000;
+
+	while ((opt = getopt(argc, argv, "m:f:k:s:r:S:d:c:t:K:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'm':
+			if (strcmp(optarg, "enc") != 0 && strcmp(optarg, "dec") != 0)
+				usage();
+			strcpy(conf.mode, optarg);
+			break;
+		case 'f': payload_name = optarg; break;
+		case 'k': key_name = optarg; break;
+		case 's': size = strtoul(optarg, NULL, 10); break;
+		case 'r': rate = atof(optarg); break;
+		case 'S':
+			if (sscanf(optarg, "%lf:%lf:%lf", &sweep_start, &sweep_end, &sweep_step) != 3 ||
+				sweep_start <= 0 || sweep_step <= 0 || sweep_end < sweep_start)
+				usage();
+			break;
+		case 'd': conf.duration = atoi(optarg); break;
+		case 'c': conf.max_out = atoi(optarg); break;
+		case 't': conf.timeout_ms = atoi(optarg); break;
+		case 'K': knee_factor = atof(optarg); break;
+		default: usage();
+		}
+	}
+	if (optind != argc - 1 || rate <= 0 || conf.duration <= 0 || conf.max_out <= 0 || size < 2)
+		usage();
+
+	// Daemons are always on this host
+	conf.addr.sin_family = AF_INET;
+	conf.addr.sin_port = htons(atoi(argv[optind]));
+	inet_pton(AF_INET, "127.0.0.1", &conf.addr.sin_addr);
+
+	// Build the upload once: the payload followed by as much key, the
+	// trailing newline is left off the same way otp_enc leaves it off
+	if (payload_name != NULL)
+		payload = readWhole(payload_name, &conf.payload_len);
+	else
+	{
+		conf.payload_len = size;
+		payload = malloc(size);
+		randomText(payload, size);
+	}
+	if (conf.payload_len > 0 && payload[conf.payload_len - 1] == '\n')
+		conf.payload_len--;
+	if (key_name != NULL)
+		key = readWhole(key_name, &key_len);
+	else
+	{
+		key_len = conf.payload_len + 1;
+		key = malloc(key_len);
+		randomText(key, key_len);
+	}
+	if (key_len < conf.payload_len)
+	{
+		fprintf(stderr, "otp_bench ERROR: key is shorter than the payload\n");
+		exit(1);
+	}
+	conf.upload_len = conf.payload_len * 2;
+	conf.upload = malloc(conf.upload_len);
+	memcpy(conf.upload, payload, conf.payload_len);
+	memcpy(conf.upload + conf.payload_len, key, conf.payload_len);
+	memset(&conf.hello, 0, sizeof(conf.hello));
+	strncpy(conf.hello.tag, conf.mode, sizeof(conf.hello.tag));
+	conf.hello.length = htonl(conf.payload_len);
+	free(payload);
+	free(key);
+
+	signal(SIGPIPE, SIG_IGN);
+
+	// Just one rate
+	if (sweep_step == 0)
+	{
+		runRate(&conf, rate, &res);
+		printResult(&res);
+		free(conf.upload);
+		return 0;
+	}
+
+	// Sweep the rates until achieved throughput falls behind or the tail blows up
+	for (rate = sweep_start; rate <= sweep_end; rate += sweep_step)
+	{
+		runRate(&conf, rate, &res);
+		printResult(&res);
+		if (base_p99 == 0)
+			base_p99 = histPercentile(&res.lat, 99.0) + 1;
+		if (res.achieved < 0.9 * rate || histPercentile(&res.lat, 99.0) > knee_factor * base_p99)
+		{
+			found_knee = 1;
+			break;
+		}
+		knee = rate;
+	}
+	if (found_knee && knee > 0)
+		printf("saturation knee: about %.1f requests/s (first saturated rate %.1f)\n", knee, rate);
+	else if (found_knee)
+		printf("saturation knee: below %.1f requests/s\n", sweep_start);
+	else
+		printf("saturation knee: not reached up to %.1f requests/s\n", sweep_end);
+
+	free(conf.upload);
+	return 0;
+}
@@ -0,0 +1,1004 @@
+/*
+ * File otp_client.c
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Connecting side shared by otp_enc and otp_dec.  Every client on
+ * 	the host maps the same small state file (OTP_CLIENT_STATE, by default
+ * 	otp_client.state in XDG_RUNTIME_DIR, else /tmp/otp_client_<uid>.state)
+ * 	holding per daemon counts of requests outstanding and recent failures.
+ * 	Counts are changed with atomic adds so clients never wait on each
+ * 	other, only adding a daemon to the file takes a lock.  A count nobody
+ * 	has touched for a minute is taken to be left over from a killed
+ * 	client and starts again from zero.  Without the file, or when it
+ * 	isn't a file of this user, the choice falls back to two random picks
+ * 	and local health.
+ * Last Update: 06/03/2016
+ * Sources: Mitzenmacher, The Power of Two Choices in Randomized Load Balancing, 2001
+ */
+
+// Include Libraries
+#include <stdio.h>	// General IO, including printf to redirect files
+#include <stdlib.h>	// General purpose functions
+#include <string.h>	// Manipulation of C strings and arrays
+#include <errno.h>	// Checking the non-blocking connect
+#include <time.h>	// Clock for health and seeding
+#include <poll.h>	// Connect time out
+#include <pthread.h>	// One thread per stripe
+#include <fcntl.h>	// Opening the state file
+#include <unistd.h>	// Provides access to the POSIX API
+#include <sys/stat.h>	// Size of the state file
+#include <sys/file.h>	// flock of the state file
+#include <sys/mman.h>	// Mapping the state file
+#include <sys/socket.h>	// Makes available for the use of sockets
+#include <netdb.h>	// Resolving host names
+#include <netinet/tcp.h>	// TCP_NODELAY
+#include <arpa/inet.h>	// Makes available ports
+#include "otp_proto.h"
+#include "otp_client.h"
+#include "otp_crc.h"
+
+#define SHARED_SLOTS	64	// Daemons the state file remembers
+#define SHARED_MAGIC	0x4f545043	// "OTPC"
+#define STALE_MS	60000	// Untouched counts older than this are reset
+#define CONNECT_MS	1000	// Longest wait for a connect
+#define DOWN_MS		100	// First back off of a failing daemon, doubles
+
+/* What every client on the host knows about one daemon */
+struct shared_endpoint
+{
+	char key[32];				// "a.b.c.d:port"
+	int outstanding;			// Requests sent and not done
+	int fails;				// Failures in a row
+	unsigned long long down_until;		// Time it may be tried again
+	unsigned long long touched;		// Last change of outstanding
+};
+
+/* The state file */
+struct shared_state
+{
+	unsigned int magic;			// SHARED_MAGIC once set up
+	struct shared_endpoint eps[SHARED_SLOTS];	// Daemons seen
+};
+
+static struct shared_state *shared = NULL;	// Mapped state, NULL without one
+static int shared_fd = -1;			// State file, for the lock
+
+/* Function: nowMsec
+ * Parameters: none
+ * Overview: Reads the monotonic clock, the same for every process
+ * Pre: none
+ * Post: Returns the time in milliseconds
+ */
+static unsigned long long nowMsec(void)
+{
+	// Set variables
+	struct timespec ts;		// Current time
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Function: sharedOpen
+ * Parameters: none
+ * Overview: Maps the state file, creating it if needed.  The file is only
+ * 	used when it is a regular file of this user, not a link, and either
+ * 	new or the size of the state, so a file planted under the name by
+ * 	someone else is never truncated or cleared.
+ * Pre: none
+ * Post: shared points at the state, or stays NULL if it can't be had
+ */
+static void sharedOpen(void)
+{
+	// Set variables
+	char path[256];			// State file
+	char *env = getenv("OTP_CLIENT_STATE");	// Path override
+	char *run = getenv("XDG_RUNTIME_DIR");	// Private directory of the user
+	struct stat st;			// Owner and size of the file
+	void *map;			// The mapping
+
+	if (env != NULL && env[0] != 0)
+		snprintf(path, sizeof(path), "%s", env);
+	else if (run != NULL && run[0] == '/')
+		snprintf(path, sizeof(path), "%s/otp_client.state", run);
+	else
+		snprintf(path, sizeof(path), "/tmp/otp_client_%d.state", (int)getuid());
+	shared_fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if (shared_fd == -1)
+		return;
+	flock(shared_fd, LOCK_EX);
+	if (fstat(shared_fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_uid != getuid() || st.st_nlink != 1 ||
+		(st.st_size != 0 && st.st_size != (off_t)sizeof(struct shared_state)) ||
+		(st.st_size == 0 && ftruncate(shared_fd, sizeof(struct shared_state)) == -1))
+	{
+		// Not ours to write, go without
+		close(shared_fd);
+		shared_fd = -1;
+		return;
+	}
+	map = mmap(NULL, sizeof(struct shared_state), PROT_READ | PROT_WRITE, MAP_SHARED, shared_fd, 0);
+	if (map != MAP_FAILED)
+	{
+		shared = map;
+		if (shared->magic != SHARED_MAGIC)
+		{
+			memset(shared, 0, sizeof(*shared));
+			shared->magic = SHARED_MAGIC;
+		}
+	}
+	flock(shared_fd, LOCK_UN);
+}
+
+/* Function: sharedFind
+ * Parameters: daemon address
+ * Overview: Finds the daemon's entry in the state file, adding it if new.
+ * 	When the file is full the entry untouched the longest is reused.
+ * Pre: State file is mapped
+ * Post: Returns the entry number
+ */
+static int sharedFind(struct sockaddr_in *addr)
+{
+	// Set variables
+	char key[32];			// "a.b.c.d:port"
+	char ip[INET_ADDRSTRLEN];	// Dotted address
+	int oldest = 0;			// Entry untouched the longest
+	int i;				// For the loop
+
+	inet_ntop(AF_INET, &addr->sin_addr, ip, sizeof(ip));
+	snprintf(key, sizeof(key), "%s:%d", ip, ntohs(addr->sin_port));
+
+	flock(shared_fd, LOCK_EX);
+	for (i = 0; i < SHARED_SLOTS; i++)
+	{
+		if (strcmp(shared->eps[i].key, key) == 0)
+			break;
+		if (shared->eps[i].key[0] == 0)
+		{
+			memset(&shared->eps[i], 0, sizeof(struct shared_endpoint));
+			strcpy(shared->eps[i].key, key);
+			break;
+		}
+		if (shared->eps[i].touched < shared->eps[oldest].touched)
+			oldest = i;
+	}
+	if (i == SHARED_SLOTS)
+	{
+		i = oldest;
+		memset(&shared->eps[i], 0, sizeof(struct shared_endpoint));
+		strcpy(shared->eps[i].key, key);
+	}
+	flock(shared_fd, LOCK_UN);
+	return i;
+}
+
+/* Function: clientParseEndpoints
+ * Parameters: settings, comma separated list of port or host:port
+ * Overview: Resolves every daemon of the list
+ * Pre: prog, tag and daemon are set
+ * Post: Returns 0 with the endpoints filled in, -1 with a message if an
+ * 	entry can't be used
+ */
+int clientParseEndpoints(struct client_conf *conf, const char *list)
+{
+	// Set variables
+	const char *start = list;	// Start of the current entry
+	const char *end;		// Its end
+	char host[64];			// Host part, 127.0.0.1 if none
+	const char *port;		// Port part
+	struct client_endpoint *ep;	// Endpoint being filled in
+	struct addrinfo hints;		// Only IPv4 streams
+	struct addrinfo *res;		// Resolved address
+	size_t len;			// Length of the entry
+	char *colon;			// Host and port separator
+
+	conf->list = list;
+	conf->count = 0;
+	conf->flags = 0;
+	conf->seed = NULL;
+	srand((unsigned int)(getpid() ^ nowMsec()));
+	sharedOpen();
+
+	while (*start != 0)
+	{
+		end = strchr(start, ',');
+		len = end == NULL ? strlen(start) : (size_t)(end - start);
+		if (len == 0 || len >= sizeof(ep->name) || conf->count == CLIENT_MAX_ENDPOINTS)
+		{
+			fprintf(stderr, "%s Error: bad port list %s\n", conf->prog, list);
+			return -1;
+		}
+		ep = &conf->endpoints[conf->count];
+		memcpy(ep->name, start, len);
+		ep->name[len] = 0;
+
+		colon = strrchr(ep->name, ':');
+		if (colon == NULL)
+		{
+			strcpy(host, "127.0.0.1");
+			port = ep->name;
+		}
+		else
+		{
+			snprintf(host, sizeof(host), "%.*s", (int)(colon - ep->name), ep->name);
+			port = colon + 1;
+		}
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		if (atoi(port) <= 0 || getaddrinfo(host, port, &hints, &res) != 0)
+		{
+			fprintf(stderr, "%s Error: could not resolve %s\n", conf->prog, ep->name);
+			return -1;
+		}
+		memcpy(&ep->addr, res->ai_addr, sizeof(ep->addr));
+		freeaddrinfo(res);
+		ep->shared = shared != NULL ? sharedFind(&ep->addr) : -1;
+		conf->count++;
+
+		if (end == NULL)
+			break;
+		start = end + 1;
+	}
+	if (conf->count == 0)
+	{
+		fprintf(stderr, "%s Error: no port given\n", conf->prog);
+		return -1;
+	}
+	return 0;
+}
+
+/* Function: outstanding
+ * Parameters: endpoint
+ * Overview: Reads the requests outstanding at a daemon, clearing a count
+ * 	that has gone stale
+ * Pre: none
+ * Post: Returns the count, 0 without shared state
+ */
+static int outstanding(struct client_endpoint *ep)
+{
+	// Set variables
+	struct shared_endpoint *s;	// Shared entry
+
+	if (ep->shared == -1)
+		return 0;
+	s = &shared->eps[ep->shared];
+	if (__atomic_load_n(&s->outstanding, __ATOMIC_RELAXED) > 0 &&
+		nowMsec() - __atomic_load_n(&s->touched, __ATOMIC_RELAXED) > STALE_MS)
+		__atomic_store_n(&s->outstanding, 0, __ATOMIC_RELAXED);
+	return __atomic_load_n(&s->outstanding, __ATOMIC_RELAXED);
+}
+
+/* Function: addOutstanding
+ * Parameters: endpoint, +1 or -1
+ * Overview: Counts a request going to or coming back from a daemon
+ * Pre: none
+ * Post: Shared count is changed
+ */
+static void addOutstanding(struct client_endpoint *ep, int delta)
+{
+	// Set variables
+	struct shared_endpoint *s;	// Shared entry
+
+	if (ep->shared == -1)
+		return;
+	s = &shared->eps[ep->shared];
+	if (__atomic_add_fetch(&s->outstanding, delta, __ATOMIC_RELAXED) < 0)
+		__atomic_store_n(&s->outstanding, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->touched, nowMsec(), __ATOMIC_RELAXED);
+}
+
+/* Function: markHealth
+ * Parameters: endpoint, 1 if it worked, 0 if it failed
+ * Overview: A daemon that fails is left alone for a back off that doubles
+ * 	with every failure in a row, up to five seconds
+ * Pre: none
+ * Post: Shared health is updated
+ */
+static void markHealth(struct client_endpoint *ep, int ok)
+{
+	// Set variables
+	struct shared_endpoint *s;	// Shared entry
+	unsigned long long wait;	// Back off
+	int fails;			// Failures in a row
+
+	if (ep->shared == -1)
+		return;
+	s = &shared->eps[ep->shared];
+	if (ok)
+	{
+		__atomic_store_n(&s->fails, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&s->down_until, 0, __ATOMIC_RELAXED);
+		return;
+	}
+	fails = __atomic_add_fetch(&s->fails, 1, __ATOMIC_RELAXED);
+	wait = fails > 6 ? 5000 : (unsigned long long)DOWN_MS << (fails - 1);
+	if (wait > 5000)
+		wait = 5000;
+	__atomic_store_n(&s->down_until, nowMsec() + wait, __ATOMIC_RELAXED);
+}
+
+/* Function: isDown
+ * Parameters: endpoint, current time
+ * Overview: Checks whether a daemon is backing off
+ * Pre: none
+ * Post: Returns 1 if it shouldn't be tried yet
+ */
+static int isDown(struct client_endpoint *ep, unsigned long long now)
+{
+	if (ep->shared == -1)
+		return 0;
+	return __atomic_load_n(&shared->eps[ep->shared].down_until, __ATOMIC_RELAXED) > now;
+}
+
+/* Function: pickEndpoint
+ * Parameters: settings, endpoints already tried
+ * Overview: Power of two choices: of two daemons picked at random among the
+ * 	healthy ones not tried yet, the one with fewer requests outstanding.
+ * 	When every untried daemon is down they are all candidates.
+ * Pre: none
+ * Post: Returns the endpoint, -1 when every one has been tried
+ */
+static int pickEndpoint(struct client_conf *conf, const char *tried)
+{
+	// Set variables
+	int cand[CLIENT_MAX_ENDPOINTS];	// Candidates
+	int ncand = 0;			// Number of them
+	unsigned long long now = nowMsec();	// For health
+	int a;				// First pick
+	int b;				// Second pick
+	int i;				// For the loops
+
+	for (i = 0; i < conf->count; i++)
+	{
+		if (!tried[i] && !isDown(&conf->endpoints[i], now))
+			cand[ncand++] = i;
+	}
+	if (ncand == 0)
+	{
+		for (i = 0; i < conf->count; i++)
+		{
+			if (!tried[i])
+				cand[ncand++] = i;
+		}
+	}
+	if (ncand == 0)
+		return -1;
+	if (ncand == 1)
+		return cand[0];
+
+	a = rand() % ncand;
+	b = rand() % (ncand - 1);
+	if (b >= a)
+		b++;
+	a = cand[a];
+	b = cand[b];
+	return outstanding(&conf->endpoints[b]) < outstanding(&conf->endpoints[a]) ? b : a;
+}
+
+/* Function: connectTo
+ * Parameters: endpoint
+ * Overview: Connects to a daemon, giving up after CONNECT_MS
+ * Pre: none
+ * Post: Returns a blocking socket, -1 on failure
+ */
+static int connectTo(struct client_endpoint *ep)
+{
+	// Set variables
+	int socket_fd;			// socket file descriptor
+	struct pollfd pfd;		// Waiting for the connect
+	int err = 0;			// Result of the connect
+	socklen_t err_len = sizeof(err);
+	int one = 1;			// For TCP_NODELAY
+
+	if ((socket_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) == -1)
+		return -1;
+	if (connect(socket_fd, (struct sockaddr *)&ep->addr, sizeof(ep->addr)) == -1)
+	{
+		if (errno != EINPROGRESS)
+		{
+			close(socket_fd);
+			return -1;
+		}
+		pfd.fd = socket_fd;
+		pfd.events = POLLOUT;
+		if (poll(&pfd, 1, CONNECT_MS) != 1 ||
+			getsockopt(socket_fd, SOL_SOCKET, SO_ERROR, &err, &err_len) == -1 || err != 0)
+		{
+			close(socket_fd);
+			return -1;
+		}
+	}
+	fcntl(socket_fd, F_SETFL, fcntl(socket_fd, F_GETFL) & ~O_NONBLOCK);
+	// Text and key go out as separate sends, don't let the key wait on the
+	// daemon's delayed ack of the text
+	setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return socket_fd;
+}
+
+/* Function: tryEndpoint
+ * Parameters: settings, endpoint, hello
+ * Overview: Connects to one daemon and confirms with it that it takes the
+ * 	request, then sends the seed if there is one
+ * Pre: none
+ * Post: Returns the socket on 'S', otherwise -1 with the failure in *why
+ */
+static int tryEndpoint(struct client_conf *conf, struct client_endpoint *ep, struct otp_hello *hello, int *why)
+{
+	// Set variables
+	int socket_fd;			// socket file descriptor
+	char recv_string[2] = {0};	// Recieved string
+
+	socket_fd = connectTo(ep);
+	if (socket_fd == -1)
+	{
+		*why = CLIENT_FAIL_CONNECT;
+		return -1;
+	}
+	if (send(socket_fd, hello, sizeof(*hello), MSG_NOSIGNAL) < (int)sizeof(*hello))
+	{
+		close(socket_fd);
+		*why = CLIENT_FAIL_CONNECT;
+		return -1;
+	}
+
+	// Recieve confirmation from server, a seeded request starts with its seed
+	recv(socket_fd, recv_string, 1, 0);
+	if (recv_string[0] == REPLY_GO && conf->seed != NULL &&
+		send(socket_fd, conf->seed, sizeof(*conf->seed), MSG_NOSIGNAL) < (int)sizeof(*conf->seed))
+	{
+		close(socket_fd);
+		*why = CLIENT_FAIL_CONNECT;
+		return -1;
+	}
+	if (recv_string[0] == REPLY_GO)
+		return socket_fd;
+	close(socket_fd);
+	*why = recv_string[0] == REPLY_BUSY ? CLIENT_FAIL_BUSY : CLIENT_FAIL_WRONG;
+	return -1;
+}
+
+/* Function: clientOpen
+ * Parameters: settings, length of the text, where the text starts in the
+ * 	file, set to the daemon that took it, set to how the last try failed
+ * Overview: Gets a daemon to take the request, failing over to the next
+ * 	pick on a refused connection or a reply other than 'S'
+ * Pre: Endpoints are parsed
+ * Post: Returns a socket ready for the text, -1 with *why set when no
+ * 	daemon takes it
+ */
+int clientOpen(struct client_conf *conf, unsigned long long text_length, unsigned long long offset, int *chosen, int *why)
+{
+	// Set variables
+	struct otp_hello hello;		// sent message to server
+	char tried[CLIENT_MAX_ENDPOINTS] = {0};	// Daemons tried
+	struct client_endpoint *ep;	// Daemon being tried
+	int socket_fd;			// socket file descriptor
+	int i;				// Daemon picked
+
+	// Get a hello ready to send, the daemon learns up front how much is coming
+	memset(&hello, 0, sizeof(hello));
+	strncpy(hello.tag, conf->tag, sizeof(hello.tag));
+	helloSetLength(&hello, text_length);
+	hello.offset = htobe64(offset);
+	hello.flags = htonl(conf->flags | (conf->seed != NULL ? HELLO_SEED : 0));
+
+	*why = CLIENT_FAIL_CONNECT;
+	*chosen = 0;
+	while ((i = pickEndpoint(conf, tried)) != -1)
+	{
+		tried[i] = 1;
+		*chosen = i;
+		ep = &conf->endpoints[i];
+		addOutstanding(ep, 1);
+		socket_fd = tryEndpoint(conf, ep, &hello, why);
+		if (socket_fd != -1)
+		{
+			markHealth(ep, 1);
+			return socket_fd;
+		}
+		addOutstanding(ep, -1);
+		markHealth(ep, 0);
+	}
+	return -1;
+}
+
+/* Function: noDaemon
+ * Parameters: settings, daemon tried last, how that try failed
+ * Overview: Reports that no daemon took a request, the way the last one
+ * 	failed, for the command line clients
+ * Pre: clientOpen returned -1
+ * Post: Exits with 2
+ */
+static void noDaemon(struct client_conf *conf, int chosen, int why)
+{
+	if (why == CLIENT_FAIL_CONNECT)
+		fprintf(stderr, "%s Error: could not contact %s on port %s\n", conf->prog, conf->daemon, conf->endpoints[chosen].name);
+	else if (why == CLIENT_FAIL_BUSY)
+		fprintf(stderr, "%s Error: Server has max number of processes\n", conf->prog);
+	else
+		fprintf(stderr, "%s Error: Client could not connect to %s on port %s\n", conf->prog, conf->daemon, conf->endpoints[chosen].name);
+	exit(2);
+}
+
+/* Function: clientConnect
+ * Parameters: settings, length of the text, where the text starts in the
+ * 	file, set to the daemon that took it
+ * Overview: clientOpen for the command line clients
+ * Pre: Endpoints are parsed
+ * Post: Returns a socket ready for the text, exits with 2 when no daemon
+ * 	takes it
+ */
+int clientConnect(struct client_conf *conf, unsigned long long text_length, unsigned long long offset, int *chosen)
+{
+	// Set variables
+	int socket_fd;			// socket file descriptor
+	int why;			// How the last try failed
+
+	socket_fd = clientOpen(conf, text_length, offset, chosen, &why);
+	if (socket_fd == -1)
+		noDaemon(conf, *chosen, why);
+	return socket_fd;
+}
+
+/* Function: clientBegin
+ * Parameters: settings, daemon a kept connection goes to
+ * Overview: Counts a request sent over a kept connection as outstanding,
+ * 	as clientOpen does for a new one
+ * Pre: none
+ * Post: Daemon's count is up, clientDone takes it back down
+ */
+void clientBegin(struct client_conf *conf, int chosen)
+{
+	if (chosen < 0 || chosen >= conf->count)
+		return;
+	addOutstanding(&conf->endpoints[chosen], 1);
+}
+
+/* Function: clientDone
+ * Parameters: settings, daemon the request went to
+ * Overview: Counts the request as no longer outstanding
+ * Pre: clientConnect returned
+ * Post: Daemon's count is back down
+ */
+void clientDone(struct client_conf *conf, int chosen)
+{
+	if (chosen < 0 || chosen >= conf->count)
+		return;
+	addOutstanding(&conf->endpoints[chosen], -1);
+}
+
+/* Function: clientSendRange
+ * Parameters: socket, file, where to start, bytes, buffer of STRIPE_BUF,
+ * 	CRC32C carried on over what is sent or NULL
+ * Overview: Sends one range of a file without moving its file offset, so
+ * 	several connections can read the same file at once
+ * Pre: The daemon answered 'S'
+ * Post: Returns 0 once the range is sent, -1 if the file or socket failed
+ */
+int clientSendRange(int socket_fd, int file, unsigned long long start, unsigned long long length, char *buf, uint32_t *crc)
+{
+	// Set variables
+	unsigned long long total_sent = 0;	// Bytes of the range sent so far
+	ssize_t size_read;			// Size read from the file
+	ssize_t size_sent;			// Size of the sent piece
+	ssize_t piece;				// Bytes wanted this time around
+
+	while (total_sent < length)
+	{
+		piece = length - total_sent < STRIPE_BUF ? (ssize_t)(length - total_sent) : STRIPE_BUF;
+		size_read = pread(file, buf, piece, start + total_sent);
+		if (size_read <= 0)
+			return -1;
+		if (crc != NULL)
+			*crc = crc32c(*crc, buf, size_read);
+		size_sent = 0;
+		while (size_sent < size_read)
+		{
+			piece = send(socket_fd, buf + size_sent, size_read - size_sent, MSG_NOSIGNAL);
+			if (piece <= 0)
+				return -1;
+			size_sent += piece;
+		}
+		total_sent += size_sent;
+	}
+	return 0;
+}
+
+/* Function: clientRecvRange
+ * Parameters: socket, output file, where to write, bytes, buffer of STRIPE_BUF,
+ * 	CRC32C carried on over what is received or NULL
+ * Overview: Receives a result and writes it at its offset of the output
+ * Pre: Text and key were sent
+ * Post: Returns 0 once the range is written, -1 if the socket or file failed
+ */
+int clientRecvRange(int socket_fd, int out_fd, unsigned long long start, unsigned long long length, char *buf, uint32_t *crc)
+{
+	// Set variables
+	unsigned long long got;		// Bytes received so far
+	ssize_t n;			// Result of recv
+
+	for (got = 0; got < length; got += n)
+	{
+		n = recv(socket_fd, buf, length - got < STRIPE_BUF ? length - got : STRIPE_BUF, 0);
+		if (n <= 0)
+			return -1;
+		if (crc != NULL)
+			*crc = crc32c(*crc, buf, n);
+		if (pwrite(out_fd, buf, n, start + got) != n)
+			return -1;
+	}
+	return 0;
+}
+
+/* Function: clientRecvStatus
+ * Parameters: socket, where the offset of a bad character goes, where the
+ * 	CRC32C of the result goes or NULL
+ * Overview: Receives the status a daemon sends in front of the result when
+ * 	the hello had HELLO_STATUS
+ * Pre: Text and key were sent
+ * Post: Returns the STATUS_ code, -1 if the socket failed.  bad holds the
+ * 	offset within the request on STATUS_BAD_TEXT, STATUS_BAD_KEY and
+ * 	STATUS_BAD_CRC.
+ */
+int clientRecvStatus(int socket_fd, unsigned long long *bad, uint32_t *crc)
+{
+	// Set variables
+	struct otp_status status;	// Status as sent
+
+	if (recv(socket_fd, &status, sizeof(status), MSG_WAITALL) != sizeof(status))
+		return -1;
+	*bad = be64toh(status.offset);
+	if (crc != NULL)
+		*crc = ntohl(status.crc);
+	return status.code;
+}
+
+/* Function: sendCrc
+ * Parameters: socket, CRC32C of a frame
+ * Overview: Sends the CRC32C that closes a frame with HELLO_CRC
+ * Pre: The frame was sent
+ * Post: Returns 0 once it is sent, -1 if the socket failed
+ */
+static int sendCrc(int socket_fd, uint32_t crc)
+{
+	// Set variables
+	uint32_t wire = htonl(crc);	// CRC32C, big endian
+
+	return send(socket_fd, &wire, sizeof(wire), MSG_NOSIGNAL) == sizeof(wire) ? 0 : -1;
+}
+
+/* Function: stripeWorker
+ * Parameters: the striped upload
+ * Overview: One connection's worth of a striped upload.  Takes the next
+ * 	range nobody has taken until none are left, so a fast daemon ends up
+ * 	doing more of them than a slow one.  Each range is its own request:
+ * 	hello with the range's offset, its text, its key, and the result is
+ * 	written at the same offset of the output.  The daemon checks the
+ * 	characters of the range as it ciphers them and says where a bad one is.
+ * 	With HELLO_CRC the range and its result are checked as they go by.
+ * Pre: stripe is filled in
+ * Post: Every range it took is written, exits with 2 on failure and 1 on
+ * 	a bad character
+ */
+static void *stripeWorker(void *arg)
+{
+	// Set variables
+	struct client_stripe *stripe = arg;	// The striped upload
+	char *buf;			// Piece being sent or received
+	unsigned long long range;	// Range taken
+	unsigned long long start;	// Its offset
+	unsigned long long length;	// Its length
+	int socket_fd;			// socket file descriptor
+	int chosen = -1;		// Daemon the range went to
+	int code;			// Status of the range
+	unsigned long long bad;		// Where its bad character is
+	unsigned char c = 0;		// The bad character
+	int with_crc = (stripe->conf->flags & HELLO_CRC) != 0;	// Frames carry a CRC32C
+	uint32_t sent_crc;		// CRC32C of the text and key sent
+	uint32_t got_crc;		// CRC32C of the result received
+	uint32_t want_crc = 0;		// CRC32C the daemon gave the result
+
+	buf = malloc(STRIPE_BUF);
+	if (buf == NULL)
+	{
+		fprintf(stderr, "%s ERROR: out of memory\n", stripe->conf->prog);
+		exit(1);
+	}
+	while ((range = __atomic_fetch_add(&stripe->next, 1, __ATOMIC_RELAXED)) < stripe->ranges)
+	{
+		start = range * stripe->range_len;
+		length = stripe->length - start < stripe->range_len ? stripe->length - start : stripe->range_len;
+
+		sent_crc = 0;
+		got_crc = 0;
+		socket_fd = clientConnect(stripe->conf, length, start, &chosen);
+		if (clientSendRange(socket_fd, stripe->text_fd, start, length, buf, with_crc ? &sent_crc : NULL) == -1 ||
+			(stripe->key_fd != -1 && clientSendRange(socket_fd, stripe->key_fd, start, length, buf, with_crc ? &sent_crc : NULL) == -1) ||
+			(with_crc && sendCrc(socket_fd, sent_crc) == -1) ||
+			(code = clientRecvStatus(socket_fd, &bad, &want_crc)) == -1 ||
+			(code == STATUS_OK && clientRecvRange(socket_fd, stripe->out_fd, start, length, buf, with_crc ? &got_crc : NULL) == -1))
+		{
+			fprintf(stderr, "%s Error: stripe at %llu failed\n", stripe->conf->prog, start);
+			exit(2);
+		}
+		if (code == STATUS_BAD_CRC || (with_crc && code == STATUS_OK && got_crc != want_crc))
+		{
+			fprintf(stderr, "%s Error: stripe at %llu failed its CRC32C on the way %s %s\n", stripe->conf->prog,
+				start, code == STATUS_OK ? "from" : "to", stripe->conf->daemon);
+			exit(2);
+		}
+		if (code != STATUS_OK)
+		{
+			pread(code == STATUS_BAD_KEY ? stripe->key_fd : stripe->text_fd, &c, 1, start + bad);
+			fprintf(stderr, "Error: File has invalid char 0x%02x at offset %llu of the %s\n",
+				c, start + bad, code == STATUS_BAD_KEY ? "key" : "text");
+			exit(1);
+		}
+		close(socket_fd);
+		clientDone(stripe->conf, chosen);
+	}
+	free(buf);
+	return NULL;
+}
+
+/* Function: clientStripe
+ * Parameters: settings, text file, key file or -1 with a seed, length of
+ * 	the text, output file, connections to use at once
+ * Overview: Splits the text and key into page aligned ranges and sends them
+ * 	over several connections at once as independent requests.  Results are
+ * 	put back in order by writing each one at its own offset, followed by
+ * 	the trailing newline unless the text is binary.  Every range asks for
+ * 	a status, so the text and key need no pass of their own to check
+ * 	them first.
+ * Pre: Endpoints are parsed, output is a regular file open for writing
+ * Post: Output holds the whole result, exits with 2 when a range fails and
+ * 	with 1 on a bad character
+ */
+void clientStripe(struct client_conf *conf, int text_fd, int key_fd, unsigned long long length, int out_fd, int stripes)
+{
+	// Set variables
+	struct client_stripe stripe;	// Shared by the workers
+	pthread_t threads[STRIPE_MAX_CONNS];	// One per connection
+	int newline = !(conf->flags & HELLO_BINARY);	// Bytes after the result
+	int i;				// For the loops
+
+	if (stripes < 1)
+		stripes = 1;
+	if (stripes > STRIPE_MAX_CONNS)
+		stripes = STRIPE_MAX_CONNS;
+
+	// A few ranges per connection so the work evens out, none bigger than
+	// a daemon is likely to take in one request
+	memset(&stripe, 0, sizeof(stripe));
+	conf->flags |= HELLO_STATUS;
+	stripe.conf = conf;
+	stripe.text_fd = text_fd;
+	stripe.key_fd = key_fd;
+	stripe.out_fd = out_fd;
+	stripe.length = length;
+	stripe.range_len = (length / ((unsigned long long)stripes * STRIPE_PER_CONN) + STRIPE_ALIGN) & ~(unsigned long long)(STRIPE_ALIGN - 1);
+	if (stripe.range_len < STRIPE_MIN)
+		stripe.range_len = STRIPE_MIN;
+	if (stripe.range_len > STRIPE_MAX)
+		stripe.range_len = STRIPE_MAX;
+	stripe.ranges = (length + stripe.range_len - 1) / stripe.range_len;
+	if ((unsigned long long)stripes > stripe.ranges)
+		stripes = stripe.ranges > 0 ? (int)stripe.ranges : 1;
+
+	// Size the output up front so ranges can land in any order
+	if (ftruncate(out_fd, length + newline) == -1)
+	{
+		fprintf(stderr, "%s ERROR: could not size the output\n", conf->prog);
+		exit(1);
+	}
+	for (i = 0; i < stripes; i++)
+	{
+		if (pthread_create(&threads[i], NULL, stripeWorker, &stripe) != 0)
+		{
+			fprintf(stderr, "%s ERROR: could not start a stripe\n", conf->prog);
+			exit(1);
+		}
+	}
+	for (i = 0; i < stripes; i++)
+		pthread_join(threads[i], NULL);
+
+	if (newline && pwrite(out_fd, "\n", 1, length) != 1)
+	{
+		fprintf(stderr, "%s ERROR: write failed\n", conf->prog);
+		exit(1);
+	}
+}
+
+/* The sending side of a stream */
+struct stream_send
+{
+	int socket_fd;			// Connection of the stream
+	int text_fd;			// Text file
+	int key_fd;			// Key file, -1 when a seed was sent
+	unsigned long long key_off;	// Where the key starts in its file
+	unsigned long long length;	// Bytes of text
+	int with_crc;			// Every turn is followed by its CRC32C
+	int failed;			// Set when a send or read failed
+};
+
+/* Function: streamSender
+ * Parameters: the sending side of a stream
+ * Overview: Sends the text and key in turns of STREAM_CHUNK bytes while
+ * 	the caller receives the results, so neither side waits on the other.
+ * 	With HELLO_CRC the CRC32C of each turn is taken as it is read.
+ * Pre: The daemon answered 'S'
+ * Post: Everything is sent, failed is set if it couldn't be
+ */
+static void *streamSender(void *arg)
+{
+	// Set variables
+	struct stream_send *ss = arg;	// The stream
+	char *buf;			// Piece being sent
+	unsigned long long done;	// Bytes of text sent so far
+	unsigned long long n;		// Bytes of this turn
+	uint32_t crc;			// CRC32C of the turn
+
+	buf = malloc(STRIPE_BUF);
+	if (buf == NULL)
+	{
+		ss->failed = 1;
+		return NULL;
+	}
+	for (done = 0; done < ss->length; done += n)
+	{
+		n = ss->length - done < STREAM_CHUNK ? ss->length - done : STREAM_CHUNK;
+		crc = 0;
+		if (clientSendRange(ss->socket_fd, ss->text_fd, done, n, buf, ss->with_crc ? &crc : NULL) == -1 ||
+			(ss->key_fd != -1 && clientSendRange(ss->socket_fd, ss->key_fd, ss->key_off + done, n, buf, ss->with_crc ? &crc : NULL) == -1) ||
+			(ss->with_crc && sendCrc(ss->socket_fd, crc) == -1))
+		{
+			ss->failed = 1;
+			break;
+		}
+	}
+	free(buf);
+	return NULL;
+}
+
+/* Function: streamRun
+ * Parameters: settings, text file, key file or -1 with a seed, where the
+ * 	key starts in it, length of the text, output, where the offset of a
+ * 	bad character goes, set to the daemon tried last, set to how the
+ * 	last try failed or 0 once a daemon took it
+ * Overview: Sends a file of any length as one streamed request.  A thread
+ * 	sends the text and key a chunk at a time while this one writes each
+ * 	result out in order as it comes back, so memory stays at a few
+ * 	buffers however long the file is and the output may be a pipe.
+ * Pre: Endpoints are parsed
+ * Post: Returns the STATUS_ code of the stream, -1 if no daemon took it,
+ * 	the connection or a file failed.  bad holds the offset of the bad
+ * 	character on STATUS_BAD_TEXT and STATUS_BAD_KEY, and of the turn that
+ * 	failed its CRC32C either way on STATUS_BAD_CRC.
+ */
+static int streamRun(struct client_conf *conf, int text_fd, int key_fd, unsigned long long key_off,
+	unsigned long long length, int out_fd, unsigned long long *bad, int *chosen, int *why)
+{
+	// Set variables
+	struct client_conf own = *conf;	// Settings with streaming asked for
+	struct stream_send ss;		// The sending side
+	pthread_t sender;		// Thread running it
+	char *buf;			// Piece being received
+	unsigned long long done;	// Bytes of result written so far
+	unsigned long long n;		// Bytes of this turn
+	unsigned long long got;		// Bytes of the turn received
+	ssize_t size_recv;		// Size of the received piece
+	ssize_t size_written;		// Size written of it
+	ssize_t w;			// Result of write
+	int code = STATUS_OK;		// Status of the stream
+	uint32_t got_crc;		// CRC32C of the turn's result received
+	uint32_t want_crc = 0;		// CRC32C the daemon gave it
+
+	buf = malloc(STRIPE_BUF);
+	if (buf == NULL)
+	{
+		fprintf(stderr, "%s ERROR: out of memory\n", conf->prog);
+		exit(1);
+	}
+	own.flags |= HELLO_STREAM;
+	memset(&ss, 0, sizeof(ss));
+	ss.socket_fd = clientOpen(&own, length, 0, chosen, why);
+	if (ss.socket_fd == -1)
+	{
+		free(buf);
+		return -1;
+	}
+	*why = 0;
+	ss.text_fd = text_fd;
+	ss.key_fd = key_fd;
+	ss.key_off = key_off;
+	ss.length = length;
+	ss.with_crc = (conf->flags & HELLO_CRC) != 0;
+	if (pthread_create(&sender, NULL, streamSender, &ss) != 0)
+	{
+		fprintf(stderr, "%s ERROR: could not start the stream\n", conf->prog);
+		exit(1);
+	}
+
+	// Every turn comes back as a status and, if it was good, its result
+	for (done = 0; done < length && code == STATUS_OK; done += n)
+	{
+		n = length - done < STREAM_CHUNK ? length - done : STREAM_CHUNK;
+		code = clientRecvStatus(ss.socket_fd, bad, &want_crc);
+		got_crc = 0;
+		for (got = 0; code == STATUS_OK && got < n; got += size_recv)
+		{
+			size_recv = recv(ss.socket_fd, buf, n - got < STRIPE_BUF ? n - got : STRIPE_BUF, 0);
+			if (size_recv <= 0)
+			{
+				code = -1;
+				break;
+			}
+			if (ss.with_crc)
+				got_crc = crc32c(got_crc, buf, size_recv);
+			for (size_written = 0; size_written < size_recv; size_written += w)
+			{
+				w = write(out_fd, buf + size_written, size_recv - size_written);
+				if (w <= 0)
+				{
+					code = -1;
+					break;
+				}
+			}
+		}
+		if (code == STATUS_OK && ss.with_crc && got_crc != want_crc)
+		{
+			code = STATUS_BAD_CRC;
+			*bad = done;
+		}
+	}
+
+	// The sender may be stuck on a daemon that stopped reading
+	if (code != STATUS_OK)
+		shutdown(ss.socket_fd, SHUT_RDWR);
+	pthread_join(sender, NULL);
+	if (code == STATUS_OK && ss.failed)
+		code = -1;
+	close(ss.socket_fd);
+	clientDone(&own, *chosen);
+	free(buf);
+	return code;
+}
+
+/* Function: clientStreamTry
+ * Parameters: settings, text file, key file or -1 with a seed, where the
+ * 	key starts in it, length of the text, output, where the offset of a
+ * 	bad character goes, set to how the last try failed or 0
+ * Overview: streamRun for callers that go on when no daemon takes a file
+ * Pre: Endpoints are parsed
+ * Post: As streamRun, why is non-zero only when no daemon took it
+ */
+int clientStreamTry(struct client_conf *conf, int text_fd, int key_fd, unsigned long long key_off,
+	unsigned long long length, int out_fd, unsigned long long *bad, int *why)
+{
+	// Set variables
+	int chosen = -1;		// Daemon tried last
+
+	return streamRun(conf, text_fd, key_fd, key_off, length, out_fd, bad, &chosen, why);
+}
+
+/* Function: clientStream
+ * Parameters: settings, text file, key file or -1 with a seed, where the
+ * 	key starts in it, length of the text, output, where the offset of a
+ * 	bad character goes
+ * Overview: streamRun for the command line clients
+ * Pre: Endpoints are parsed
+ * Post: As streamRun, exits with 2 when no daemon takes it
+ */
+int clientStream(struct client_conf *conf, int text_fd, int key_fd, unsigned long long key_off,
+	unsigned long long length, int out_fd, unsigned long long *bad)
+{
+	// Set variables
+	int chosen = -1;		// Daemon tried last
+	int why;			// How the last try failed
+	int code;			// Status of the stream
+
+	code = streamRun(conf, text_fd, key_fd, key_off, length, out_fd, bad, &chosen, &why);
+	if (code == -1 && why != 0)
+		noDaemon(conf, chosen, why);
+	return code;
+}
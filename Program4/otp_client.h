@@ -0,0 +1,87 @@
+/*
+ * File otp_client.h
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Connecting side shared by otp_enc and otp_dec.  The port
+ * 	argument may be a comma separated list of daemons, each a port on
+ * 	this host or host:port.  A request goes to the better of two daemons
+ * 	picked at random, better meaning fewer requests outstanding from all
+ * 	clients on this host.  A daemon that refuses the connection or
+ * 	answers 'M' is marked down for a while and the next one is tried.
+ * 	A big file may be striped: cut into ranges that travel over several
+ * 	connections at once and are written back in place by offset.  Or it
+ * 	may be streamed over one connection a chunk at a time, with the
+ * 	results written out in order as they come back.  With a seed set
+ * 	every request sends it in place of the key, and no key file is read.
+ * Last Update: 06/03/2016
+ */
+
+#ifndef OTP_CLIENT_H
+#define OTP_CLIENT_H
+
+#include <netinet/in.h>	// Address of a daemon
+#include "otp_proto.h"	// Seed of a seeded request
+
+#define CLIENT_MAX_ENDPOINTS	32	// Daemons in one list
+// Ways a try can fail
+#define CLIENT_FAIL_CONNECT	1	// Connect refused or timed out
+#define CLIENT_FAIL_BUSY	2	// Daemon answered 'M'
+#define CLIENT_FAIL_WRONG	3	// Daemon answered 'U' or hung up
+
+#define STRIPE_MAX_CONNS	64	// Connections of one striped upload
+#define STRIPE_PER_CONN		4	// Ranges per connection, so work evens out
+#define STRIPE_ALIGN		4096	// Ranges start on a page
+#define STRIPE_MIN		65536	// Smallest range
+#define STRIPE_MAX		(16 * 1024 * 1024)	// Biggest range
+#define STRIPE_BUF		65536	// Piece sent or received at a time
+
+/* A daemon a request may go to */
+struct client_endpoint
+{
+	char name[64];			// As given, e.g. "57101" or "host:57101"
+	struct sockaddr_in addr;	// Its address
+	int shared;			// Its entry in the shared state, -1 if none
+};
+
+/* What a client is and where it may send */
+struct client_conf
+{
+	const char *prog;		// "otp_enc" or "otp_dec" for messages
+	const char *tag;		// Tag of the hello, "enc" or "dec"
+	const char *daemon;		// "otp_enc_d" or "otp_dec_d" for messages
+	const char *list;		// The port argument as given
+	struct client_endpoint endpoints[CLIENT_MAX_ENDPOINTS];	// Daemons
+	int count;			// Daemons in the list
+	unsigned int flags;		// HELLO_ flags of every request, 0 by default
+	const struct otp_seed *seed;	// Sent instead of the key, NULL by default
+};
+
+/* A striped upload, shared by its connections */
+struct client_stripe
+{
+	struct client_conf *conf;	// Where the ranges may go
+	int text_fd;			// Text file
+	int key_fd;			// Key file, -1 when a seed is sent
+	int out_fd;			// Result file, written by offset
+	unsigned long long length;	// Bytes of text
+	unsigned long long range_len;	// Bytes of a range, the last may be short
+	unsigned long long ranges;	// Number of ranges
+	unsigned long long next;	// Next range nobody has taken
+};
+
+int clientParseEndpoints(struct client_conf *conf, const char *list);
+int clientOpen(struct client_conf *conf, unsigned long long text_length, unsigned long long offset, int *chosen, int *why);
+int clientConnect(struct client_conf *conf, unsigned long long text_length, unsigned long long offset, int *chosen);
+void clientBegin(struct client_conf *conf, int chosen);
+void clientDone(struct client_conf *conf, int chosen);
+int clientSendRange(int socket_fd, int file, unsigned long long start, unsigned long long length, char *buf, uint32_t *crc);
+int clientRecvRange(int socket_fd, int out_fd, unsigned long long start, unsigned long long length, char *buf, uint32_t *crc);
+int clientRecvStatus(int socket_fd, unsigned long long *bad, uint32_t *crc);
+void clientStripe(struct client_conf *conf, int text_fd, int key_fd, unsigned long long length, int out_fd, int stripes);
+int clientStream(struct client_conf *conf, int text_fd, int key_fd, unsigned long long key_off,
+	unsigned long long length, int out_fd, unsigned long long *bad);
+int clientStreamTry(struct client_conf *conf, int text_fd, int key_fd, unsigned long long key_off,
+	unsigned long long length, int out_fd, unsigned long long *bad, int *why);
+
+#endif
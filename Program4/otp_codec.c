@@ -0,0 +1,630 @@
+/*
+ * File otp_codec.c
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Cipher kernels for the 27 character one-time pad.  The allowed
+ * 	characters are the space (0x20) and A-Z (0x41-0x5A).  For all of them
+ * 	the value 0-26 is just the low five bits of the character, and the
+ * 	character of a value v is 0x20 for 0 and 0x40 + v otherwise.  The table,
+ * 	packed and SIMD kernels are built on that, the reference kernel keeps
+ * 	the lookup the daemons first used.  Binary requests skip all of it,
+ * 	their bytes are XORed with the key a vector at a time.
+ * Last Update: 06/03/2016
+ * Sources: Bit Twiddling Hacks - https://graphics.stanford.edu/~seander/bithacks.html
+ *   GCC Vector Extensions - https://gcc.gnu.org/onlinedocs/gcc/Vector-Extensions.html
+ */
+
+// Include Libraries
+#include <string.h>	// memcpy for unaligned loads and stores
+#include <stdint.h>	// Fixed width words for the packed kernel
+#include <pthread.h>	// Threads of codecRun
+#include "otp_codec.h"
+
+static void fusedKernel(const char *text, const char *key, char *out, size_t length, int dir);
+
+// Every kernel, in the order they are reported
+const struct codec_kernel codec_kernels[] = {
+	{ "ref", codecRef },
+	{ "table", codecTable },
+	{ "packed", codecPacked },
+	{ "simd", codecSimd },
+	{ "fused", fusedKernel },
+	{ NULL, NULL }
+};
+
+/* Function: refFindLetter
+ * Parameter: some value, direction
+ * Overview: Returns the letter in the possible chars, same as findLetter in
+ * 	the daemons
+ * Pre: Established a value to interpret
+ * Post: Returns the letter in the possible chars
+ */
+static char refFindLetter(int some_value, int dir)
+{
+	// Set Variables
+	static const char poss_chars[] = " ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+	// Wrap around to the beginning or the end of the array
+	if (dir == CODEC_ENC && some_value > 26)
+		some_value -= 27;
+	else if (dir == CODEC_DEC && some_value < 0)
+		some_value += 27;
+	return poss_chars[some_value];
+}
+
+/* Function: refFindValue
+ * Parameter: some char
+ * Overview: Converts a char to a value by searching the possible chars, same
+ * 	as findValue in the daemons
+ * Pre: Established a character
+ * Post: Returns a value
+ */
+static int refFindValue(char some_letter)
+{
+	// Set variables
+	static const char poss_chars[] = " ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+	int j;			// For the loop
+
+	// Loop to find match with letter
+	for (j = 0; j < 27; j++)
+	{
+		if (poss_chars[j] == some_letter)
+			return j;
+	}
+	return 0;
+}
+
+/* Function: codecRef
+ * Parameters: text, key, output, length, direction
+ * Overview: One character at a time through findValue/findLetter, the
+ * 	cypherLet path the daemons had before codecFused
+ * Pre: text and key hold length valid characters
+ * Post: out holds length ciphered characters
+ */
+void codecRef(const char *text, const char *key, char *out, size_t length, int dir)
+{
+	// Set variables
+	size_t i;		// For the loop
+
+	for (i = 0; i < length; i++)
+	{
+		if (dir == CODEC_ENC)
+			out[i] = refFindLetter(refFindValue(text[i]) + refFindValue(key[i]), dir);
+		else
+			out[i] = refFindLetter(refFindValue(text[i]) - refFindValue(key[i]), dir);
+	}
+}
+
+/* Function: codecTable
+ * Parameters: text, key, output, length, direction
+ * Overview: Looks up the value of each character and the letter of each sum
+ * 	in small tables, so there is no search and no branch per character
+ * Pre: text and key hold length valid characters
+ * Post: out holds length ciphered characters
+ */
+void codecTable(const char *text, const char *key, char *out, size_t length, int dir)
+{
+	// Set variables
+	// Letter for every value 0-53, so a sum never has to be wrapped
+	static const char letters[] = " ABCDEFGHIJKLMNOPQRSTUVWXYZ ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+	int bias = dir == CODEC_ENC ? 0 : 27;	// Keeps differences positive
+	int sign = dir == CODEC_ENC ? 1 : -1;	// Add or subtract the key
+	size_t i;				// For the loop
+
+	for (i = 0; i < length; i++)
+		out[i] = letters[bias + (text[i] & 0x1F) + sign * (key[i] & 0x1F)];
+}
+
+/* Function: packedWord
+ * Parameters: eight text bytes, eight key bytes, direction
+ * Overview: Ciphers eight characters held in one 64-bit word.  Every lane
+ * 	stays below 0x100 so no carry crosses into the next character.
+ * Pre: All sixteen bytes are valid characters
+ * Post: Returns the eight ciphered characters
+ */
+static uint64_t packedWord(uint64_t t, uint64_t k, int dir)
+{
+	// Set variables
+	const uint64_t ones = 0x0101010101010101ULL;	// 1 in every lane
+	const uint64_t high = 0x8080808080808080ULL;	// Top bit of every lane
+	uint64_t sum;					// Value sum per lane, 0-53
+	uint64_t wrap;					// Lanes that are 27 or more
+	uint64_t nonzero;				// Lanes that are not a space
+
+	t &= 0x1F * ones;
+	k &= 0x1F * ones;
+	if (dir == CODEC_ENC)
+		sum = t + k;
+	else
+		sum = t + 27 * ones - k;
+
+	// The top bit of sum + 101 is set exactly when sum >= 27
+	wrap = ((sum + 101 * ones) & high) >> 7;
+	sum -= wrap * 27;
+
+	// The top bit of sum + 127 is set exactly when sum > 0
+	nonzero = ((sum + 127 * ones) & high) >> 7;
+	return sum + 0x20 * ones + nonzero * 0x20;
+}
+
+/* Function: codecPacked
+ * Parameters: text, key, output, length, direction
+ * Overview: Ciphers eight characters per step in a plain 64-bit word
+ * Pre: text and key hold length valid characters
+ * Post: out holds length ciphered characters
+ */
+void codecPacked(const char *text, const char *key, char *out, size_t length, int dir)
+{
+	// Set variables
+	uint64_t t;		// Eight text characters
+	uint64_t k;		// Eight key characters
+	size_t i = 0;		// For the loop
+
+	for (; i + 8 <= length; i += 8)
+	{
+		memcpy(&t, text + i, 8);
+		memcpy(&k, key + i, 8);
+		t = packedWord(t, k, dir);
+		memcpy(out + i, &t, 8);
+	}
+	codecTable(text + i, key + i, out + i, length - i, dir);
+}
+
+// 16 and 32 lane byte vectors, turned into SSE2/AVX2/NEON by the compiler
+typedef unsigned char v16u8 __attribute__((vector_size(16)));
+typedef unsigned char v32u8 __attribute__((vector_size(32)));
+
+/* Function: simd16
+ * Parameters: text, key, output, length, direction
+ * Overview: Ciphers sixteen characters per step with the same lane math as
+ * 	the packed kernel, but with real per lane compares
+ * Pre: text and key hold length valid characters
+ * Post: Returns the number of characters done, the rest is left for the caller
+ */
+static size_t simd16(const char *text, const char *key, char *out, size_t length, int dir)
+{
+	// Set variables
+	v16u8 t;		// Text lanes
+	v16u8 k;		// Key lanes
+	v16u8 s;		// Sums
+	size_t i = 0;		// For the loop
+
+	for (; i + 16 <= length; i += 16)
+	{
+		memcpy(&t, text + i, 16);
+		memcpy(&k, key + i, 16);
+		t &= 0x1F;
+		k &= 0x1F;
+		s = dir == CODEC_ENC ? t + k : t + 27 - k;
+		s -= (v16u8)(s > 26) & 27;
+		s += 0x20 + ((v16u8)(s != 0) & 0x20);
+		memcpy(out + i, &s, 16);
+	}
+	return i;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* Function: simd32
+ * Parameters: text, key, output, length, direction
+ * Overview: The simd16 kernel with 32 lanes, built for AVX2
+ * Pre: The CPU has AVX2
+ * Post: Returns the number of characters done, the rest is left for the caller
+ */
+__attribute__((target("avx2")))
+static size_t simd32(const char *text, const char *key, char *out, size_t length, int dir)
+{
+	// Set variables
+	v32u8 t;		// Text lanes
+	v32u8 k;		// Key lanes
+	v32u8 s;		// Sums
+	size_t i = 0;		// For the loop
+
+	for (; i + 32 <= length; i += 32)
+	{
+		memcpy(&t, text + i, 32);
+		memcpy(&k, key + i, 32);
+		t &= 0x1F;
+		k &= 0x1F;
+		s = dir == CODEC_ENC ? t + k : t + 27 - k;
+		s -= (v32u8)(s > 26) & 27;
+		s += 0x20 + ((v32u8)(s != 0) & 0x20);
+		memcpy(out + i, &s, 32);
+	}
+	return i;
+}
+#endif
+
+/* Function: codecSimd
+ * Parameters: text, key, output, length, direction
+ * Overview: Vector kernel, 32 lanes when the CPU has AVX2 and 16 otherwise
+ * Pre: text and key hold length valid characters
+ * Post: out holds length ciphered characters
+ */
+void codecSimd(const char *text, const char *key, char *out, size_t length, int dir)
+{
+	// Set variables
+	size_t done = 0;	// Characters handled by the vector loops
+
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2"))
+		done = simd32(text, key, out, length, dir);
+#endif
+	done += simd16(text + done, key + done, out + done, length - done, dir);
+	codecTable(text + done, key + done, out + done, length - done, dir);
+}
+
+/* Function: anyLane16
+ * Parameters: lanes
+ * Overview: Checks whether any lane is non-zero
+ * Pre: none
+ * Post: Returns 1 if one is
+ */
+static int anyLane16(v16u8 v)
+{
+	// Set variables
+	uint64_t w[2];		// The lanes as words
+
+	memcpy(w, &v, 16);
+	return (w[0] | w[1]) != 0;
+}
+
+/* Function: check16
+ * Parameters: buffer, length
+ * Overview: Checks sixteen characters per step for anything but a space
+ * 	or A-Z, stopping at the first step that has one
+ * Pre: none
+ * Post: Returns the start of the step with a bad character, or the end of
+ * 	the whole steps, the rest is left for the caller
+ */
+static size_t check16(const char *buf, size_t length)
+{
+	// Set variables
+	v16u8 c;		// Character lanes
+	size_t i = 0;		// For the loop
+
+	for (; i + 16 <= length; i += 16)
+	{
+		memcpy(&c, buf + i, 16);
+		if (anyLane16((v16u8)((v16u8)(c - 0x41) > 25) & (v16u8)(c != 0x20)))
+			break;
+	}
+	return i;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* Function: check32
+ * Parameters: buffer, length
+ * Overview: The check16 loop with 32 lanes, built for AVX2
+ * Pre: The CPU has AVX2
+ * Post: Returns the start of the step with a bad character, or the end of
+ * 	the whole steps, the rest is left for the caller
+ */
+__attribute__((target("avx2")))
+static size_t check32(const char *buf, size_t length)
+{
+	// Set variables
+	v32u8 c;		// Character lanes
+	v32u8 bad;		// Lanes that are not allowed
+	uint64_t w[4];		// The lanes as words
+	size_t i = 0;		// For the loop
+
+	for (; i + 32 <= length; i += 32)
+	{
+		memcpy(&c, buf + i, 32);
+		bad = (v32u8)((v32u8)(c - 0x41) > 25) & (v32u8)(c != 0x20);
+		memcpy(w, &bad, 32);
+		if ((w[0] | w[1] | w[2] | w[3]) != 0)
+			break;
+	}
+	return i;
+}
+#endif
+
+/* Function: codecCheck
+ * Parameters: buffer, length
+ * Overview: Finds the first character that isn't a space or A-Z.  Whole
+ * 	vectors are checked at once, only the one holding a bad character is
+ * 	looked at one character at a time.
+ * Pre: none
+ * Post: Returns the offset of the first bad character, length if all are good
+ */
+size_t codecCheck(const char *buf, size_t length)
+{
+	// Set variables
+	size_t i = 0;		// Characters known to be good
+
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2"))
+		i = check32(buf, length);
+#endif
+	i += check16(buf + i, length - i);
+	for (; i < length; i++)
+	{
+		if (buf[i] != ' ' && (buf[i] < 'A' || buf[i] > 'Z'))
+			return i;
+	}
+	return length;
+}
+
+/* Function: badLanes16
+ * Parameters: character lanes
+ * Overview: Marks the lanes that are neither a space nor A-Z
+ * Pre: none
+ * Post: Returns 0xFF in every bad lane, 0 in the others
+ */
+static v16u8 badLanes16(v16u8 c)
+{
+	return (v16u8)((v16u8)(c - 0x41) > 25) & (v16u8)(c != 0x20);
+}
+
+/* Function: fused16
+ * Parameters: text, key, output, length, direction
+ * Overview: The simd16 kernel checking its text and key lanes in the same
+ * 	step that ciphers them, stopping at the first step with a bad one
+ * Pre: none
+ * Post: Returns the number of characters done, the rest is left for the caller
+ */
+static size_t fused16(const char *text, const char *key, char *out, size_t length, int dir)
+{
+	// Set variables
+	v16u8 t;		// Text lanes
+	v16u8 k;		// Key lanes
+	v16u8 s;		// Sums
+	size_t i = 0;		// For the loop
+
+	for (; i + 16 <= length; i += 16)
+	{
+		memcpy(&t, text + i, 16);
+		memcpy(&k, key + i, 16);
+		if (anyLane16(badLanes16(t) | badLanes16(k)))
+			break;
+		t &= 0x1F;
+		k &= 0x1F;
+		s = dir == CODEC_ENC ? t + k : t + 27 - k;
+		s -= (v16u8)(s > 26) & 27;
+		s += 0x20 + ((v16u8)(s != 0) & 0x20);
+		memcpy(out + i, &s, 16);
+	}
+	return i;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* Function: fused32
+ * Parameters: text, key, output, length, direction
+ * Overview: The fused16 kernel with 32 lanes, built for AVX2
+ * Pre: The CPU has AVX2
+ * Post: Returns the number of characters done, the rest is left for the caller
+ */
+__attribute__((target("avx2")))
+static size_t fused32(const char *text, const char *key, char *out, size_t length, int dir)
+{
+	// Set variables
+	v32u8 t;		// Text lanes
+	v32u8 k;		// Key lanes
+	v32u8 s;		// Sums
+	uint64_t w[4];		// Bad lanes as words
+	size_t i = 0;		// For the loop
+
+	for (; i + 32 <= length; i += 32)
+	{
+		memcpy(&t, text + i, 32);
+		memcpy(&k, key + i, 32);
+		s = ((v32u8)((v32u8)(t - 0x41) > 25) & (v32u8)(t != 0x20)) |
+			((v32u8)((v32u8)(k - 0x41) > 25) & (v32u8)(k != 0x20));
+		memcpy(w, &s, 32);
+		if ((w[0] | w[1] | w[2] | w[3]) != 0)
+			break;
+		t &= 0x1F;
+		k &= 0x1F;
+		s = dir == CODEC_ENC ? t + k : t + 27 - k;
+		s -= (v32u8)(s > 26) & 27;
+		s += 0x20 + ((v32u8)(s != 0) & 0x20);
+		memcpy(out + i, &s, 32);
+	}
+	return i;
+}
+#endif
+
+/* Function: xor16
+ * Parameters: text, key, output, length
+ * Overview: XORs sixteen bytes per step
+ * Pre: none
+ * Post: Returns the number of bytes done, the rest is left for the caller
+ */
+static size_t xor16(const char *text, const char *key, char *out, size_t length)
+{
+	// Set variables
+	v16u8 t;		// Text lanes
+	v16u8 k;		// Key lanes
+	size_t i = 0;		// For the loop
+
+	for (; i + 16 <= length; i += 16)
+	{
+		memcpy(&t, text + i, 16);
+		memcpy(&k, key + i, 16);
+		t ^= k;
+		memcpy(out + i, &t, 16);
+	}
+	return i;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* Function: xor32
+ * Parameters: text, key, output, length
+ * Overview: The xor16 kernel with 32 lanes, built for AVX2, two vectors a
+ * 	step so loads of the next one overlap the stores of the last
+ * Pre: The CPU has AVX2
+ * Post: Returns the number of bytes done, the rest is left for the caller
+ */
+__attribute__((target("avx2")))
+static size_t xor32(const char *text, const char *key, char *out, size_t length)
+{
+	// Set variables
+	v32u8 t[2];		// Text lanes
+	v32u8 k[2];		// Key lanes
+	size_t i = 0;		// For the loop
+
+	for (; i + 64 <= length; i += 64)
+	{
+		memcpy(t, text + i, 64);
+		memcpy(k, key + i, 64);
+		t[0] ^= k[0];
+		t[1] ^= k[1];
+		memcpy(out + i, t, 64);
+	}
+	return i;
+}
+#endif
+
+/* Function: codecXor
+ * Parameters: text, key, output, length
+ * Overview: Cipher of a binary request, any byte goes.  The same call
+ * 	encrypts and decrypts, so it is the CODEC_XOR direction of codecFused.
+ * Pre: none
+ * Post: out holds every byte of text XORed with the byte of key under it
+ */
+void codecXor(const char *text, const char *key, char *out, size_t length)
+{
+	// Set variables
+	size_t done = 0;	// Bytes handled by the vector loops
+
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2"))
+		done = xor32(text, key, out, length);
+#endif
+	done += xor16(text + done, key + done, out + done, length - done);
+	for (; done < length; done++)
+		out[done] = text[done] ^ key[done];
+}
+
+/* Function: codecFused
+ * Parameters: text, key, output, length, direction
+ * Overview: Checks and ciphers in the same pass over the data.  Whole
+ * 	vectors of text and key are checked and ciphered together, only the
+ * 	one holding a bad character is gone through one character at a time.
+ * Pre: none
+ * Post: Returns the offset of the first position where the text or the key
+ * 	isn't a space or A-Z, length if there is none.  out holds the
+ * 	ciphered characters in front of it.  CODEC_XOR checks nothing.
+ */
+size_t codecFused(const char *text, const char *key, char *out, size_t length, int dir)
+{
+	// Set variables
+	size_t done = 0;	// Characters checked and ciphered
+
+	if (dir == CODEC_XOR)
+	{
+		codecXor(text, key, out, length);
+		return length;
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2"))
+		done = fused32(text, key, out, length, dir);
+#endif
+	done += fused16(text + done, key + done, out + done, length - done, dir);
+	for (; done < length; done++)
+	{
+		if (codecCheck(text + done, 1) == 0 || codecCheck(key + done, 1) == 0)
+			return done;
+		codecTable(text + done, key + done, out + done, 1, dir);
+	}
+	return length;
+}
+
+/* Function: fusedKernel
+ * Parameters: text, key, output, length, direction
+ * Overview: codecFused with the shape of the other kernels, for the table
+ * Pre: text and key hold length valid characters
+ * Post: out holds length ciphered characters
+ */
+static void fusedKernel(const char *text, const char *key, char *out, size_t length, int dir)
+{
+	codecFused(text, key, out, length, dir);
+}
+
+/* One thread's share of codecRun */
+struct codec_part
+{
+	const char *text;	// Its text
+	const char *key;	// Its key
+	char *out;		// Where its result goes
+	size_t length;		// Bytes of its share
+	int dir;		// Direction
+	size_t bad;		// First bad character of the share, its length if none
+	pthread_t thread;	// Thread running it
+	int started;		// Whether the thread was started
+};
+
+/* Function: codecPart
+ * Parameters: share of the work
+ * Overview: Runs the fused kernel over one share
+ * Pre: none
+ * Post: Share is checked and ciphered
+ */
+static void *codecPart(void *arg)
+{
+	// Set variables
+	struct codec_part *p = arg;	// The share
+
+	p->bad = codecFused(p->text, p->key, p->out, p->length, p->dir);
+	return NULL;
+}
+
+/* Function: codecRun
+ * Parameters: text, key, output, length, direction, most threads to use
+ * Overview: Splits the work into cache line aligned shares of at least
+ * 	CODEC_MIN_PART bytes and runs the fused kernel on each in its own
+ * 	thread, the calling thread taking the first share.  A thread that
+ * 	can't be started has its share run by the caller.
+ * Pre: none
+ * Post: Returns the offset of the first bad character of text or key,
+ * 	length if there is none.  Without one out holds length ciphered
+ * 	characters, the same as any kernel.
+ */
+size_t codecRun(const char *text, const char *key, char *out, size_t length, int dir, int threads)
+{
+	// Set variables
+	struct codec_part parts[CODEC_MAX_THREADS];	// Every share
+	size_t share;			// Bytes of a share
+	size_t start = 0;		// Start of the next share
+	int n;				// Shares in use
+	int i;				// For the loops
+
+	if (threads > CODEC_MAX_THREADS)
+		threads = CODEC_MAX_THREADS;
+	if ((size_t)threads > length / CODEC_MIN_PART)
+		threads = (int)(length / CODEC_MIN_PART);
+	if (threads < 1)
+		threads = 1;
+	share = (length / threads + 63) & ~(size_t)63;
+
+	for (n = 0; start < length || n == 0; n++)
+	{
+		parts[n].text = text + start;
+		parts[n].key = key + start;
+		parts[n].out = out + start;
+		parts[n].length = length - start < share ? length - start : share;
+		parts[n].dir = dir;
+		parts[n].started = 0;
+		start += parts[n].length;
+	}
+	for (i = 1; i < n; i++)
+		parts[i].started = pthread_create(&parts[i].thread, NULL, codecPart, &parts[i]) == 0;
+	codecPart(&parts[0]);
+	for (i = 1; i < n; i++)
+	{
+		if (parts[i].started)
+			pthread_join(parts[i].thread, NULL);
+		else
+			codecPart(&parts[i]);
+	}
+
+	// The first share with a bad character has the first one
+	for (i = 0; i < n; i++)
+	{
+		if (parts[i].bad < parts[i].length)
+			return (parts[i].text - text) + parts[i].bad;
+	}
+	return length;
+}
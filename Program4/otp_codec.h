@@ -0,0 +1,52 @@
+/*
+ * File otp_codec.h
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Cipher kernels for the 27 character one-time pad.  Every kernel
+ * 	takes a text buffer and a key buffer of the same length and writes the
+ * 	encrypted or decrypted text.  The reference kernel is the per character
+ * 	cypherLet/findValue/findLetter path the daemons first used, the others are
+ * 	faster versions that must give byte-identical output.  codecCheck
+ * 	finds the first character a kernel can't take, codecFused checks and
+ * 	ciphers in one pass, and codecRun spreads codecFused over threads.
+ * 	Those two also take CODEC_XOR, the byte cipher of binary requests.
+ * Last Update: 06/03/2016
+ */
+
+#ifndef OTP_CODEC_H
+#define OTP_CODEC_H
+
+#include <stddef.h>	// size_t
+
+// Directions a kernel can run in
+#define CODEC_ENC	0	// text + key
+#define CODEC_DEC	1	// text - key
+#define CODEC_XOR	2	// text ^ key, any byte, codecFused and codecRun only
+
+#define CODEC_MAX_THREADS	64	// Most threads of codecRun
+#define CODEC_MIN_PART		65536	// Smallest share worth a thread
+
+/* Signature every kernel has */
+typedef void (*codec_fn)(const char *text, const char *key, char *out, size_t length, int dir);
+
+/* A kernel and the name it is reported under */
+struct codec_kernel
+{
+	const char *name;	// Short name, e.g. "table"
+	codec_fn fn;		// The kernel
+};
+
+// All kernels, the reference first, ended by a NULL name
+extern const struct codec_kernel codec_kernels[];
+
+void codecRef(const char *text, const char *key, char *out, size_t length, int dir);
+void codecTable(const char *text, const char *key, char *out, size_t length, int dir);
+void codecPacked(const char *text, const char *key, char *out, size_t length, int dir);
+void codecSimd(const char *text, const char *key, char *out, size_t length, int dir);
+void codecXor(const char *text, const char *key, char *out, size_t length);
+size_t codecCheck(const char *buf, size_t length);
+size_t codecFused(const char *text, const char *key, char *out, size_t length, int dir);
+size_t codecRun(const char *text, const char *key, char *out, size_t length, int dir, int threads);
+
+#endif
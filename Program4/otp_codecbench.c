@@ -0,0 +1,316 @@
+/*
+ * File otp_codecbench.c
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Microbenchmark for the cipher kernels in otp_codec.c.  Every
+ * 	kernel is run in both directions over buffer sizes from 16 bytes up to
+ * 	1 GiB and timed in ns/byte, cycles/byte and GB/s.  Cycles come from a
+ * 	perf_event_open cycle counter when the kernel allows it and are null
+ * 	otherwise.  Results are written as JSON so runs can be kept and
+ * 	compared for regressions.  Every kernel is checked against the
+ * 	reference kernel before it is timed.
+ * Last Update: 06/03/2016
+ * Sources: perf_event_open(2) - http://man7.org/linux/man-pages/man2/perf_event_open.2.html
+ */
+
+// Include Libraries
+#include <stdio.h>	// General IO, including printf to redirect files
+#include <stdlib.h>	// General purpose functions
+#include <string.h>	// Manipulation of C strings and arrays
+#include <stdint.h>	// Fixed width integers for counters
+#include <time.h>	// Monotonic clock
+#include <unistd.h>	// Provides access to the POSIX API
+#include <sys/mman.h>	// Large buffers straight from the kernel
+#include <sys/ioctl.h>	// Starting and stopping the cycle counter
+#include <sys/syscall.h>	// perf_event_open has no libc wrapper
+#include <sys/utsname.h>	// Machine description for the report
+#include <linux/perf_event.h>	// Cycle counter settings
+#include "otp_codec.h"
+
+/* Function: nowNsec
+ * Parameters: none
+ * Overview: Reads the monotonic clock
+ * Pre: none
+ * Post: Returns the time in nanoseconds
+ */
+static uint64_t nowNsec(void)
+{
+	// Set variables
+	struct timespec ts;		// Current time
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Function: openCycles
+ * Parameters: none
+ * Overview: Opens a user space cycle counter for this process
+ * Pre: none
+ * Post: Returns the counter descriptor or -1 when perf isn't allowed
+ */
+static int openCycles(void)
+{
+	// Set variables
+	struct perf_event_attr attr;	// Counter settings
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* Function: fillText
+ * Parameters: buffer, length
+ * Overview: Fills a buffer with random valid characters
+ * Pre: buffer holds length bytes
+ * Post: buffer is filled
+ */
+static void fillText(char *buf, size_t length)
+{
+	// Set variables
+	static const char poss_chars[] = " ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+	uint64_t x = 88172645463325252ULL;	// xorshift state
+	size_t i;				// For the loop
+
+	for (i = 0; i < length; i++)
+	{
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		buf[i] = poss_chars[x % 27];
+	}
+}
+
+/* Function: checkKernels
+ * Parameters: text, key, two scratch outputs
+ * Overview: Makes sure every kernel matches the reference for a set of odd
+ * 	lengths in both directions
+ * Pre: Buffers hold at least 4096 bytes
+ * Post: Returns 0 if all match, exits with 1 otherwise
+ */
+static int checkKernels(char *text, char *key, char *want, char *got)
+{
+	// Set variables
+	static const size_t lengths[] = { 0, 1, 7, 8, 15, 16, 31, 33, 63, 100, 4096 };
+	size_t l;		// Length being checked
+	int dir;		// Direction being checked
+	int k;			// Kernel being checked
+
+	for (l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++)
+	{
+		for (dir = CODEC_ENC; dir <= CODEC_DEC; dir++)
+		{
+			codecRef(text, key, want, lengths[l], dir);
+			for (k = 1; codec_kernels[k].name != NULL; k++)
+			{
+				memset(got, 0, lengths[l]);
+				codec_kernels[k].fn(text, key, got, lengths[l], dir);
+				if (memcmp(want, got, lengths[l]) != 0)
+				{
+					fprintf(stderr, "otp_codecbench ERROR: kernel %s differs from ref at length %zu\n",
+						codec_kernels[k].name, lengths[l]);
+					exit(1);
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+/* Function: cpuModel
+ * Parameters: buffer for the name, its size
+ * Overview: Reads the CPU model name for the report
+ * Pre: none
+ * Post: buffer holds the model, or "unknown"
+ */
+static void cpuModel(char *name, size_t size)
+{
+	// Set variables
+	FILE *info;		// /proc/cpuinfo
+	char line[256];		// One line of it
+	char *colon;		// Start of the value
+	size_t i;		// For the loop
+
+	snprintf(name, size, "unknown");
+	info = fopen("/proc/cpuinfo", "r");
+	if (info == NULL)
+		return;
+	while (fgets(line, sizeof(line), info) != NULL)
+	{
+		if (strncmp(line, "model name", 10) == 0 && (colon = strchr(line, ':')) != NULL)
+		{
+			snprintf(name, size, "%s", colon + 2);
+			break;
+		}
+	}
+	fclose(info);
+
+	// Drop the newline and anything that would need escaping in JSON
+	for (i = 0; name[i] != 0; i++)
+	{
+		if (name[i] == '\n')
+			name[i] = 0;
+		else if (name[i] == '"' || name[i] == '\\')
+			name[i] = ' ';
+	}
+}
+
+/* Function: usage
+ * Parameters: none
+ * Overview: Prints how to run the benchmark
+ * Pre: none
+ * Post: Exits with 1
+ */
+static void usage(void)
+{
+	fprintf(stderr, "otp_codecbench Usage: otp_codecbench [-m min_bytes] [-M max_bytes] [-f step_factor]\n"
+		"\t[-t min_ms_per_point] [-k kernel] [-o output.json]\n");
+	exit(1);
+}
+
+/* Function: main
+ * Parameters: number of arguments, the arguments
+ * Overview: Handles arguments, times every kernel at every size and writes
+ * 	the JSON report
+ */
+int main(int argc, char *argv[])
+{
+	// Set variables
+	size_t min_size = 16;			// Smallest buffer
+	size_t max_size = (size_t)1 << 30;	// Largest buffer
+	size_t factor = 4;			// Size multiplier per step
+	size_t map_size;			// Bytes mapped per buffer
+	uint64_t min_ns = 200000000;		// Time to spend on each point
+	char *only = NULL;			// Run just this kernel
+	char *out_name = NULL;			// Report file, stdout if NULL
+	FILE *out = stdout;			// Report stream
+	char *text;				// Text buffer
+	char *key;				// Key buffer
+	char *result;				// Output buffer
+	char *scratch;				// Second output for the check
+	int cyc_fd;				// Cycle counter, -1 if not allowed
+	uint64_t cycles;			// Cycles counted for a point
+	uint64_t start;				// Time a point started
+	uint64_t elapsed;			// Time a point took
+	uint64_t iters;				// Times the kernel ran for a point
+	double bytes;				// Total bytes ciphered for a point
+	size_t size;				// Size being timed
+	char model[128];			// CPU model
+	struct utsname host;			// Kernel and machine names
+	int first = 1;				// No comma before the first result
+	int dir;				// Direction being timed
+	int k;					// Kernel being timed
+	int opt;				// Current option
+
+	while ((opt = getopt(argc, argv, "m:M:f:t:k:o:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'm': min_size = strtoull(optarg, NULL, 10); break;
+		case 'M': max_size = strtoull(optarg, NULL, 10); break;
+		case 'f': factor = strtoull(optarg, NULL, 10); break;
+		case 't': min_ns = strtoull(optarg, NULL, 10) * 1000000; break;
+		case 'k': only = optarg; break;
+		case 'o': out_name = optarg; break;
+		default: usage();
+		}
+	}
+	if (min_size == 0 || max_size < min_size || factor < 2)
+		usage();
+
+	// One mapping per buffer, sized for the largest point and the check
+	map_size = max_size < 4096 ? 4096 : max_size;
+	text = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	key = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	result = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	scratch = malloc(4096);
+	if (text == MAP_FAILED || key == MAP_FAILED || result == MAP_FAILED || scratch == NULL)
+	{
+		fprintf(stderr, "otp_codecbench ERROR: could not map %zu byte buffers\n", max_size);
+		exit(1);
+	}
+	fillText(text, map_size);
+	fillText(key, map_size);
+	// Different pads for text and key
+	memmove(key, key + 1, map_size - 1);
+
+	checkKernels(text, key, result, scratch);
+
+	if (out_name != NULL && (out = fopen(out_name, "w")) == NULL)
+	{
+		fprintf(stderr, "otp_codecbench ERROR: %s could not be opened\n", out_name);
+		exit(1);
+	}
+
+	cyc_fd = openCycles();
+	cpuModel(model, sizeof(model));
+	uname(&host);
+	fprintf(out, "{\n  \"benchmark\": \"otp_codec\",\n  \"timestamp\": %lld,\n", (long long)time(NULL));
+	fprintf(out, "  \"machine\": { \"cpu\": \"%s\", \"kernel\": \"%s\", \"arch\": \"%s\", \"cycle_counter\": %s },\n",
+		model, host.release, host.machine, cyc_fd == -1 ? "false" : "true");
+	fprintf(out, "  \"results\": [\n");
+
+	for (k = 0; codec_kernels[k].name != NULL; k++)
+	{
+		if (only != NULL && strcmp(only, codec_kernels[k].name) != 0)
+			continue;
+		for (dir = CODEC_ENC; dir <= CODEC_DEC; dir++)
+		{
+			for (size = min_size; size <= max_size; size *= factor)
+			{
+				// Warm up the caches and the page tables
+				codec_kernels[k].fn(text, key, result, size, dir);
+
+				// Run the kernel until enough time has gone by
+				iters = 0;
+				if (cyc_fd != -1)
+				{
+					ioctl(cyc_fd, PERF_EVENT_IOC_RESET, 0);
+					ioctl(cyc_fd, PERF_EVENT_IOC_ENABLE, 0);
+				}
+				start = nowNsec();
+				do {
+					codec_kernels[k].fn(text, key, result, size, dir);
+					iters++;
+					elapsed = nowNsec() - start;
+				} while (elapsed < min_ns);
+				cycles = 0;
+				if (cyc_fd != -1)
+				{
+					ioctl(cyc_fd, PERF_EVENT_IOC_DISABLE, 0);
+					if (read(cyc_fd, &cycles, sizeof(cycles)) != sizeof(cycles))
+						cycles = 0;
+				}
+
+				bytes = (double)size * iters;
+				fprintf(out, "%s    { \"kernel\": \"%s\", \"dir\": \"%s\", \"bytes\": %zu, \"iterations\": %llu, "
+					"\"ns_per_byte\": %.4f, ",
+					first ? "" : ",\n", codec_kernels[k].name, dir == CODEC_ENC ? "enc" : "dec",
+					size, (unsigned long long)iters, elapsed / bytes);
+				if (cycles != 0)
+					fprintf(out, "\"cycles_per_byte\": %.4f, ", cycles / bytes);
+				else
+					fprintf(out, "\"cycles_per_byte\": null, ");
+				fprintf(out, "\"gb_per_s\": %.4f }", bytes / elapsed);
+				fflush(out);
+				first = 0;
+
+				// Don't wrap around past the largest size
+				if (size > max_size / factor)
+					break;
+			}
+		}
+	}
+	fprintf(out, "\n  ]\n}\n");
+
+	if (out != stdout)
+		fclose(out);
+	if (cyc_fd != -1)
+		close(cyc_fd);
+	return 0;
+}
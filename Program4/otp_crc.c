@@ -0,0 +1,278 @@
+/*
+ * File otp_crc.c
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: CRC32C, the reflected polynomial 0x82F63B78 that the SSE4.2
+ * 	and ARMv8 crc32c instructions compute.  The instruction takes eight
+ * 	bytes a step but waits on the step before it, so long pieces run as
+ * 	three CRCs of three blocks side by side.  The first two are then
+ * 	moved past the blocks after them, a shift that tables of CRC_LONG and
+ * 	CRC_SHORT zero bytes do four lookups at a time, and the three XORed
+ * 	together.  That keeps a frame checked at close to the speed it is
+ * 	copied.  The table is the fallback, a byte a step.
+ * 	crc32c(crc32c(0, a), b) is the CRC of a followed by b.
+ * Last Update: 06/03/2016
+ * Sources: Adler, crc32c.c - https://stackoverflow.com/a/17646775
+ *   Castagnoli, Braeuer, Herrmann, Optimization of Cyclic Redundancy-Check
+ *   Codes with 24 and 32 Parity Bits, IEEE Trans. Communications 1993
+ *   RFC 3720 - https://tools.ietf.org/html/rfc3720#appendix-B.4
+ */
+
+// Include Libraries
+#include <string.h>	// memcpy for unaligned words
+#include <pthread.h>	// Building the table once
+#include "otp_crc.h"
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>	// __crc32cd and __crc32cb
+#endif
+
+#define CRC_POLY	0x82F63B78	// Castagnoli polynomial, reflected
+#define CRC_LONG	8192	// Bytes of a block of a long piece
+#define CRC_SHORT	256	// Bytes of a block of a short piece
+
+static uint32_t crc_table[256];		// CRC of every byte value
+static uint32_t crc_long[4][256];	// Shift past CRC_LONG zero bytes, a byte of the CRC at a time
+static uint32_t crc_short[4][256];	// Shift past CRC_SHORT zero bytes
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;	// Tables are built once
+
+/* Function: gf2Times
+ * Parameters: 32 by 32 bit matrix, vector
+ * Overview: Multiplies a vector by a matrix over GF(2)
+ * Pre: none
+ * Post: Returns the product
+ */
+static uint32_t gf2Times(const uint32_t *mat, uint32_t vec)
+{
+	// Set variables
+	uint32_t sum = 0;	// The product
+
+	for (; vec != 0; vec >>= 1, mat++)
+	{
+		if (vec & 1)
+			sum ^= *mat;
+	}
+	return sum;
+}
+
+/* Function: gf2Square
+ * Parameters: where the square goes, matrix
+ * Overview: Squares a matrix over GF(2)
+ * Pre: none
+ * Post: square holds mat times mat
+ */
+static void gf2Square(uint32_t *square, const uint32_t *mat)
+{
+	// Set variables
+	int n;			// Row
+
+	for (n = 0; n < 32; n++)
+		square[n] = gf2Times(mat, mat[n]);
+}
+
+/* Function: crcZeros
+ * Parameters: where the tables go, bytes of zeros
+ * Overview: Builds the tables that move a CRC past length zero bytes.
+ * 	The operator for one zero bit is squared up to a byte, then to
+ * 	length bytes, and the tables apply it to each byte of a CRC.
+ * Pre: length is a power of two
+ * Post: zeros is filled in
+ */
+static void crcZeros(uint32_t zeros[4][256], size_t length)
+{
+	// Set variables
+	uint32_t odd[32];	// Operator, then its squares
+	uint32_t even[32];	// Its other squares
+	uint32_t *op;		// The operator for length bytes
+	uint32_t row = 1;	// Row of the one bit operator
+	int n;			// For the loops
+
+	odd[0] = CRC_POLY;
+	for (n = 1; n < 32; n++, row <<= 1)
+		odd[n] = row;
+	gf2Square(even, odd);	// Two zero bits
+	gf2Square(odd, even);	// Four
+	op = odd;
+	do
+	{
+		gf2Square(even, odd);
+		op = even;
+		length >>= 1;
+		if (length == 0)
+			break;
+		gf2Square(odd, even);
+		op = odd;
+		length >>= 1;
+	} while (length != 0);
+
+	for (n = 0; n < 256; n++)
+	{
+		zeros[0][n] = gf2Times(op, n);
+		zeros[1][n] = gf2Times(op, n << 8);
+		zeros[2][n] = gf2Times(op, n << 16);
+		zeros[3][n] = gf2Times(op, (uint32_t)n << 24);
+	}
+}
+
+/* Function: crcShift
+ * Parameters: tables of crcZeros, CRC
+ * Overview: Moves a CRC past the zero bytes of the tables
+ * Pre: Tables are built
+ * Post: Returns the moved CRC
+ */
+static uint32_t crcShift(uint32_t zeros[4][256], uint32_t c)
+{
+	return zeros[0][c & 0xFF] ^ zeros[1][(c >> 8) & 0xFF] ^ zeros[2][(c >> 16) & 0xFF] ^ zeros[3][c >> 24];
+}
+
+/* Function: crcTableInit
+ * Parameters: none
+ * Overview: Builds the table of the fallback and the shift tables
+ * Pre: Called through pthread_once
+ * Post: Every table is filled in
+ */
+static void crcTableInit(void)
+{
+	// Set variables
+	uint32_t c;		// CRC of the byte
+	int i;			// Byte value
+	int j;			// Bit of it
+
+	for (i = 0; i < 256; i++)
+	{
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = (c >> 1) ^ (c & 1 ? CRC_POLY : 0);
+		crc_table[i] = c;
+	}
+	crcZeros(crc_long, CRC_LONG);
+	crcZeros(crc_short, CRC_SHORT);
+}
+
+/* Function: crcTable
+ * Parameters: running CRC, buffer, length
+ * Overview: The fallback, a byte at a time through the table
+ * Pre: none
+ * Post: Returns the running CRC over the buffer
+ */
+static uint32_t crcTable(uint32_t c, const unsigned char *p, size_t length)
+{
+	pthread_once(&crc_once, crcTableInit);
+	while (length-- > 0)
+		c = crc_table[(c ^ *p++) & 0xFF] ^ (c >> 8);
+	return c;
+}
+
+#if defined(__x86_64__)
+/* Function: crcSse42Blocks
+ * Parameters: running CRC, where the buffer is, bytes left of it, bytes
+ * 	of a block, shift tables for a block
+ * Overview: Runs three blocks at a time side by side through the SSE4.2
+ * 	crc32 instruction, for as long as three are left
+ * Pre: The CPU has SSE4.2, the tables are built
+ * Post: Returns the running CRC, p and length are moved past the blocks
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crcSse42Blocks(uint32_t c, const unsigned char **p, size_t *length, size_t block, uint32_t zeros[4][256])
+{
+	// Set variables
+	unsigned long long c0 = c;	// CRC of the first block
+	unsigned long long c1;		// Of the second
+	unsigned long long c2;		// Of the third
+	unsigned long long w[3];	// Eight bytes of each
+	const unsigned char *end;	// End of the first block
+
+	while (*length >= 3 * block)
+	{
+		c1 = 0;
+		c2 = 0;
+		for (end = *p + block; *p < end; *p += 8)
+		{
+			memcpy(&w[0], *p, 8);
+			memcpy(&w[1], *p + block, 8);
+			memcpy(&w[2], *p + 2 * block, 8);
+			c0 = __builtin_ia32_crc32di(c0, w[0]);
+			c1 = __builtin_ia32_crc32di(c1, w[1]);
+			c2 = __builtin_ia32_crc32di(c2, w[2]);
+		}
+		c0 = crcShift(zeros, (uint32_t)c0) ^ c1;
+		c0 = crcShift(zeros, (uint32_t)c0) ^ c2;
+		*p += 2 * block;
+		*length -= 3 * block;
+	}
+	return (uint32_t)c0;
+}
+
+/* Function: crcSse42
+ * Parameters: running CRC, buffer, length
+ * Overview: Eight bytes a step with the SSE4.2 crc32 instruction, three
+ * 	blocks at a time while the piece is long enough
+ * Pre: The CPU has SSE4.2
+ * Post: Returns the running CRC over the buffer
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crcSse42(uint32_t c, const unsigned char *p, size_t length)
+{
+	// Set variables
+	unsigned long long w;	// Eight bytes of the buffer
+
+	if (length >= 3 * CRC_SHORT)
+	{
+		pthread_once(&crc_once, crcTableInit);
+		c = crcSse42Blocks(c, &p, &length, CRC_LONG, crc_long);
+		c = crcSse42Blocks(c, &p, &length, CRC_SHORT, crc_short);
+	}
+	for (; length >= 8; p += 8, length -= 8)
+	{
+		memcpy(&w, p, 8);
+		c = (uint32_t)__builtin_ia32_crc32di(c, w);
+	}
+	for (; length > 0; p++, length--)
+		c = __builtin_ia32_crc32qi(c, *p);
+	return c;
+}
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+/* Function: crcArm
+ * Parameters: running CRC, buffer, length
+ * Overview: Eight bytes a step with the ARMv8 crc32cx instruction
+ * Pre: Built for a CPU with the CRC extension
+ * Post: Returns the running CRC over the buffer
+ */
+static uint32_t crcArm(uint32_t c, const unsigned char *p, size_t length)
+{
+	// Set variables
+	uint64_t w;		// Eight bytes of the buffer
+
+	for (; length >= 8; p += 8, length -= 8)
+	{
+		memcpy(&w, p, 8);
+		c = __crc32cd(c, w);
+	}
+	for (; length > 0; p++, length--)
+		c = __crc32cb(c, *p);
+	return c;
+}
+#endif
+
+/* Function: crc32c
+ * Parameters: CRC of what came before, 0 to start, buffer, length
+ * Overview: Carries a CRC32C on over the next piece of a frame
+ * Pre: none
+ * Post: Returns the CRC32C of everything so far
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t length)
+{
+	// Set variables
+	uint32_t c = ~crc;	// Running CRC, inverted as the instructions keep it
+
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("sse4.2"))
+		return ~crcSse42(c, buf, length);
+#endif
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+	return ~crcArm(c, buf, length);
+#endif
+	return ~crcTable(c, buf, length);
+}
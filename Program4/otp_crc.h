@@ -0,0 +1,22 @@
+/*
+ * File otp_crc.h
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: CRC32C (Castagnoli) of the frames of a request.  A frame is
+ * 	checked as its pieces go by, each piece carrying on from the CRC of
+ * 	the ones before, so nothing makes a second pass over the data.
+ * 	The CPU's crc32 instruction does it when there is one, SSE4.2 on
+ * 	x86 and the CRC extension on ARMv8, a table otherwise.
+ * Last Update: 06/03/2016
+ */
+
+#ifndef OTP_CRC_H
+#define OTP_CRC_H
+
+#include <stddef.h>	// size_t
+#include <stdint.h>	// uint32_t
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t length);
+
+#endif
@@ -8,6 +8,11 @@
  * 	also checks to be sure the encrypted file has valid characters (spaces 
  * 	and A-Z), key file is shorter than the encrypted file, reports bad 
  * 	connection port to the daemon, and output the decryption to stdout.
+ * 	A file over one stream chunk (1 MiB) is written to stdout as it comes
+ * 	back.  If it fails part way, on a bad character for one, a stdout
+ * 	file is cut back to where it began, but a pipe or terminal has
+ * 	already been given the chunks before the failure.  Only an exit
+ * 	status of 0 means the output is whole.
  * Last Update: 06/03/2016
  * Sources: Operating Systems Lectures 15, 16, and 17.
  *   Beej's Guide to Network Programming - http://beej.us/guide/bgnet/output/html/singlepage/bgnet.html
@@ -22,6 +27,7 @@
 #include <signal.h>	// Handle signals reported during program execution
 #include <sys/types.h>	// For networking with sockets
 #include <sys/stat.h>	// Returning data with the sockets
+#include <sys/mman.h>	// Mapping the text and key for libotp
 #include <fcntl.h>	// File descriptors with a socket
 #include <sys/wait.h>	// Used for such things as waitpid
 #include <unistd.h>	// Provides access to the POSIX API
@@ -29,235 +35,249 @@
 #include <netinet/in.h>	// Makes available access to network addresses
 #include <netdb.h>	// Defines the hostent structure
 #include <arpa/inet.h>	// Makes available ports
+#include <getopt.h>	// Long options of directory mode
+#include "otp_client.h"	// Picking a daemon and the hello
+#include "otp_codec.h"	// Cipher of --local
+#include "otp_fanout.h"	// Directory mode
+#include "otp_lib.h"	// libotp, sending a single file
+#include "otp_proto.h"	// Chunk and status of a stream
+#include "otp_seed.h"	// Seed file of --seed
+
+#define LOCAL_CHUNK	(16 * 1024 * 1024)	// Bytes --local ciphers at a time into stdout
+
+/* Function: reportChar
+ * Parameters: name of the file, its mapped text, offset of a bad character
+ * Overview: Reports a character that isn't a space or A-Z.  Nothing checks
+ * 	the files on their own: the daemon or the local kernel finds the first
+ * 	bad character in the same pass that ciphers, and says where it is.
+ * Pre: File is mapped
+ * Post: Doesn't return, reports where the character is and exits
+ */
+void reportChar(const char *name, const char *text, size_t bad)
+{
+	fprintf(stderr, "Error: File has invalid char 0x%02x at offset %zu of %s\n",
+		(unsigned char)text[bad], bad, name);
+	exit(1);
+}
 
-/* Function: validateChars
- * Parameters: size of file, int of open file
- * Overview: Goes through a file searching for bad characters.  A valid
- * 	character is one that is a space or A-Z
- * Pre: A file exists
- * Post: Doesn't return anything, but if invalid character is found it will exit
+/* Function: mapFile
+ * Parameters: file, bytes wanted
+ * Overview: Maps the start of a file so it can be handed to libotp
+ * Pre: File is at least length bytes
+ * Post: Returns the mapping, exits if the file can't be mapped
  */
-void validateChars(int size, int file)
+char *mapFile(int file, size_t length)
 {
 	// Set variables
-	char *text_string;	// memory for string
-	int read_result;	// Result of reading file
-	int i;			// For the looping
-	
-	// Set the file to the beginning
-	lseek(file, 0, SEEK_SET);
-
-	// Allocate memory for the text string using the size
-	text_string = malloc(size + 1);
-	// Read from file into text string
-	read_result = read(file, text_string, size);
-	// Report an error if there is issue reading the string
-	if (read_result == -1)
-	{
-		fprintf(stderr, "Error: reading file\n");
-		exit(1);
-	}
-
-	// Null terminate the string
-	text_string[size] = 0;
+	static char empty[1];	// Stands in for an empty file
+	char *map;		// The mapping
 
-	// Go through each character in string and validate
-	for (i = 0; i < size; i++)
+	if (length == 0)
+		return empty;
+	map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, file, 0);
+	if (map == MAP_FAILED)
 	{
-		// Check if the character in string is alpha or space
-		if (isalpha(text_string[i]) || isspace(text_string[i]))
-		{
-			// Do nothing because it's one of these cases
-			//printf("%c", text_string[i]);
-		}
-		// Otherwise it's an invalid character and error needs to be printed
-		else
-		{
-			fprintf(stderr, "Error: File has invalid char\n");
-			exit(1);	
-		}
+		fprintf(stderr, "otp_dec ERROR: read failed\n");
+		exit(1);
 	}
-	// Free up the text string
-	free(text_string);
-
-	// Set the file to the beginning
-	lseek(file, 0, SEEK_SET);
+	return map;
 }
 
-/* Function: recvConf
- * Parameters: client socket, port number argument
- * Overview: Confirm with the server we can successfully communicate
- * Pre: client socket
- * Post: No return, but makes confirmation with server
+
+/* Function: connToDaemon
+ * Parameters: From the 3 char * arguments: plaintext; key; and port number,
+ * 	which may be a comma separated list of port or host:port.
+ * 	Also, both files mapped, length of the text, connections to stripe
+ * 	over, the output file or -1 for stdout, encrypted and key files, the
+ * 	seed of --seed or NULL, HELLO_ flags of --binary and --crc
+ * Overview: Setup connection to daemon, send encrypted file to daemon, and
+ * 	recieve decrypted file from daemon.  Send decrypted file to stdout.
+ * Pre: Both files are mapped, only the encrypted file when there is a seed
+ * Post: decrypted file is sent to stdout, exits with 1 on a bad character
  */
-void recvConf(int socket_fd, char *port_num)
+void connToDaemon(char *enc_name, char *key_name, char *port_name, int file_enc, int file_key, const char *text, const char *key, size_t text_length, int stripes, int file_out, const struct otp_seed *seed, unsigned int flags)
 {
 	// Set variables
-	int msg_length = 512;
-	char send_msg[msg_length];	// sent message to server
-	int sent_size = 3;		// equal to size of "enc"
-	char recv_string[2];		// Recieved string
-
-	// Get a message ready to send
-	strncpy(send_msg, "dec", msg_length);
-
-	if (send(socket_fd, send_msg, sent_size, 0) < 0)
+	struct client_conf conf;	// Daemons a stripe or stream may go to
+	struct otp_pool *pool;		// libotp connection pool
+	char *result;			// Decrypted text from the daemon
+	int status;			// How the request went
+	size_t bad;			// Where a bad character is
+	unsigned long long at;		// Where a stream found one
+	struct stat st;			// Kind of file stdout is
+	off_t start = -1;		// Where a stream began in a stdout file
+	int binary = (flags & HELLO_BINARY) != 0;	// No newline after the result
+
+	if (file_out != -1 || text_length > STREAM_CHUNK || seed != NULL || flags != 0)
 	{
-		fprintf(stderr, "otp_dec Error: Failed to make initial confirmation with server\n");
-	}	
-
-	// Recieve confirmation from server
-	recv(socket_fd, recv_string, 1, 0);
-
-	// Check the response
-	// If the response is an 'S', than we connected successfully, do nothing more
-	if (strcmp(recv_string, "S") == 0)
-	{
-		// Nothing more to do here
-		//printf("I got something here");
+		conf.prog = "otp_dec";
+		conf.tag = "dec";
+		conf.daemon = "otp_dec_d";
+		if (clientParseEndpoints(&conf, port_name) == -1)
+			exit(2);
+		conf.seed = seed;
+		conf.flags = flags;
 	}
-	// If the response is a 'M', then server hit the max of processes. send message and exit 2
-	else if (strcmp(recv_string, "M") == 0)
+
+	// Writing to a file, the text may go over several connections at once
+	if (file_out != -1)
 	{
-		fprintf(stderr, "otp_dec Error: Server has max number of processes\n");
-		exit(2);
+		clientStripe(&conf, file_enc, file_key, text_length, file_out, stripes);
+		return;
 	}
-	// If the response is something else, then there is probably some unauthorization
-	else
-	{
-		fprintf(stderr, "otp_dec Error: Client could not connect to otp_dec_d on port %s\n", port_num);
-		exit(2);
-	}	
-}
 
-/* Function: sendFile
- * Parameters: socket, file to be sent
- * Overview: Sends file to server
- * Pre: Established connection with server with client
- * Post: File sent to server
- */
-void sendFile(int socket_fd, int send_file)
-{
-	// Set Variables
-	int msg_length = 512;		// Length of packets sent
-	char send_msg[msg_length];	// Message to be sent
-	int size_sent;			// Size of the sent message
-
-	// Loop to read file
-	while ((size_sent = read(send_file, send_msg, sizeof(send_msg))) > 0)
+	// A file longer than a chunk is streamed to stdout, so neither this
+	// side nor the daemon holds more than a chunk of it.  So is a seeded
+	// binary or checked one of any length, libotp only sends plain keys.
+	// Chunks are written as they come back, so a failed stream is taken
+	// back out of a stdout file; a pipe or terminal keeps what it got.
+	if (text_length > STREAM_CHUNK || seed != NULL || flags != 0)
 	{
-		// Send the message, but check to be sure it didn't fail to send, break
-		if (send(socket_fd, send_msg, size_sent, 0) < 0)
+		fflush(stdout);
+		// Appended output begins at the end, whatever the offset says
+		if (fstat(STDOUT_FILENO, &st) == 0 && S_ISREG(st.st_mode))
+			start = (fcntl(STDOUT_FILENO, F_GETFL) & O_APPEND) ? st.st_size : lseek(STDOUT_FILENO, 0, SEEK_CUR);
+		status = clientStream(&conf, file_enc, file_key, 0, text_length, STDOUT_FILENO, &at);
+		if (status != STATUS_OK && start != -1 && ftruncate(STDOUT_FILENO, start) == -1)
 		{
-			fprintf(stderr, "otp_dec Error: Sent file failed\n");
-			break;
+			// Left as it is, the error below still says it failed
 		}
-		// Put null characters into send message
-		bzero(send_msg, msg_length);
+		if (status == STATUS_BAD_TEXT)
+			reportChar(enc_name, text, at);
+		if (status == STATUS_BAD_KEY)
+			reportChar(key_name, key, at);
+		if (status == STATUS_BAD_CRC)
+			fprintf(stderr, "otp_dec Error: data to or from otp_dec_d failed its CRC32C at offset %llu\n", at);
+		if (status != STATUS_OK)
+		{
+			fprintf(stderr, "otp_dec Error: connection to otp_dec_d failed\n");
+			exit(2);
+		}
+		if (!binary)
+			printf("\n");
+		return;
 	}
-	if (size_sent < 0)
+
+	// Hand both files to libotp, it picks a daemon and confirms it takes
+	// the request, trying the others if it is down or busy
+	pool = otpOpen("dec", port_name, 1);
+	if (pool == NULL)
+		exit(2);
+	result = malloc(text_length + 1);
+	if (result == NULL)
 	{
-		fprintf(stderr, "otp_dec ERROR: recv failed\n");
+		fprintf(stderr, "otp_dec ERROR: out of memory\n");
 		exit(1);
 	}
-}
+	status = otpRun(pool, text, key, text_length, result, &bad);
+	otpClose(pool);
+	if (status == OTP_EBADTEXT)
+		reportChar(enc_name, text, bad);
+	if (status == OTP_EBADKEY)
+		reportChar(key_name, key, bad);
+	if (status == OTP_ECONNECT)
+		fprintf(stderr, "otp_dec Error: could not contact otp_dec_d on port %s\n", port_name);
+	else if (status == OTP_EWRONG)
+		fprintf(stderr, "otp_dec Error: Client could not connect to otp_dec_d on port %s\n", port_name);
+	else if (status != OTP_OK)
+		fprintf(stderr, "otp_dec Error: %s\n", otpStrerror(status));
+	if (status != OTP_OK)
+		exit(2);
 
-/* Function: recvFile
- * Parameters: socket
- * Overview: Recieves a file and prints to stdout
- * Pre: Both the encrypted and key files have been sent to server
- * Post: Sends decrypted file to stdout
+	// print out the decrypted text and its newline
+	fwrite(result, 1, text_length, stdout);
+	printf("\n");
+	free(result);
+} 
+
+
+/* Function: runLocal
+ * Parameters: names and mapped text of both files, length of the text,
+ * 	output file or -1 for stdout, threads to use, whether the files are
+ * 	binary
+ * Overview: Runs the cipher in this process instead of a daemon, on the
+ * 	mapped files and straight into the mapped output file when there is
+ * 	one.  The kernel gives the same bytes as the daemon and checks the
+ * 	characters of both files as it goes.  Binary files are XORed and
+ * 	get no newline.
+ * Pre: Both files are mapped
+ * Post: Result and its newline are in the output, exits with 1 on a bad
+ * 	character
  */
-void recvFile(int socket_fd)
+void runLocal(const char *text_name, const char *key_name, const char *text, const char *key, size_t text_length, int file_out, int threads, int binary)
 {
 	// Set variables
-	int msg_length = 512;		// Length of recieved msg
-	char recv_msg[msg_length];	// received string piece
-	int recv_size = 0;		// initialize to 0 of recieved msg
-
-	// Loop to receive message
-	while ((recv_size = recv(socket_fd, recv_msg, msg_length, 0)) > 0)
+	char *result;			// Where the cipher writes
+	size_t bad;			// Where a bad character is
+	size_t done;			// Bytes written to stdout so far
+	size_t n;			// Bytes of this piece
+	int dir = binary ? CODEC_XOR : CODEC_DEC;	// Cipher of the files
+	size_t newline = !binary;	// Bytes after the result
+
+	if (file_out != -1)
 	{
-		// print out decryption from server
-		printf("%s", recv_msg);
-		// Fill the recv_msg with null characters
-		bzero(recv_msg, msg_length);
-		// Break out of loop if at the end of the message or nothing more to recv
-		if (recv_size != 512 || recv_size == 0)
-			break;
+		if (ftruncate(file_out, text_length + newline) == -1 ||
+			(result = mmap(NULL, text_length + newline, PROT_READ | PROT_WRITE, MAP_SHARED, file_out, 0)) == MAP_FAILED)
+		{
+			fprintf(stderr, "otp_dec ERROR: could not map the output\n");
+			exit(1);
+		}
+		bad = codecRun(text, key, result, text_length, dir, threads);
+		if (newline)
+			result[text_length] = '\n';
+		munmap(result, text_length + newline);
 	}
-	// print newline to encryption file
-	printf("\n");
+	else
+	{
+		// stdout gets it a piece at a time, memory doesn't grow with the file
+		result = malloc(text_length < LOCAL_CHUNK ? text_length + 1 : LOCAL_CHUNK);
+		if (result == NULL)
+		{
+			fprintf(stderr, "otp_dec ERROR: out of memory\n");
+			exit(1);
+		}
+		for (done = 0, bad = text_length; done < text_length; done += n)
+		{
+			n = text_length - done < LOCAL_CHUNK ? text_length - done : LOCAL_CHUNK;
+			bad = codecRun(text + done, key + done, result, n, dir, threads);
+			if (bad < n)
+			{
+				bad += done;
+				break;
+			}
+			bad = text_length;
+			fwrite(result, 1, n, stdout);
+		}
+		if (newline)
+			printf("\n");
+		free(result);
+	}
+
+	if (bad < text_length && codecCheck(text + bad, 1) == 0)
+		reportChar(text_name, text, bad);
+	if (bad < text_length)
+		reportChar(key_name, key, bad);
 }
 
 
-/* Function: connToDaemon
- * Parameters: From the 3 char * arguments: plaintext; key; and port number.
- * 	Also, encrypted and key files
- * Overview: Setup connection to daemon, send encrypted file to daemon, and
- * 	recieve decrypted file from daemon.  Send decrypted file to stdout.
- * Pre: validated both files
- * Post: decrypted file is sent to stdout
+/* Function: runDir
+ * Parameters: port number argument, what directory mode was asked to do
+ * Overview: Sends every file of a directory over several connections at once
+ * Pre: Options are checked
+ * Post: Returns the exit status, 1 if any file failed
  */
-void connToDaemon(char *enc_name, char *key_name, char *port_name, int file_enc, int file_key)
+int runDir(char *port_name, struct fanout_conf *fc)
 {
 	// Set variables
-	int socket_fd;			// socket file descriptor
-	struct sockaddr_in server_addr;	// Server's address structure
-	//struct hostent *server_ip_addr;	// server's IP
-	int port_num;			// Conversion of string from arg to int
-	
-	// Ensure a socket file descriptor can be setup
-	if ((socket_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
-	{
-		fprintf(stderr, "otp_dec Error: Failed to setup socket file descriptor\n");
-		exit(2);
-	}
+	struct client_conf conf;	// Daemons the files may go to
 
-	// Convert the port number from string to integer
-	port_num = atoi(port_name);
-
-	// Stuff server_addr struct with info to connect to it
-	server_addr.sin_family = AF_INET;
-	server_addr.sin_port = htons(port_num);
-	inet_pton(AF_INET, "127.0.0.1", &server_addr.sin_addr);
-	bzero(&(server_addr.sin_zero), 8);
-
-	// Setup the Server IP address
-	//server_ip_addr = gethostbyname("localhost");
-
-	// Should the IP address not be resolved
-	//if (server_ip_addr == NULL)
-	//{
-	//	fprintf(stderr, "Error: could not resolve server host name\n");
-	//	exit(2);
-	//}
-	// Stuff server_addr struct with info to connect to it
-	//server_addr.sin_family = AF_INET;
-	//server_addr.sin_port = htons(port_num);
-	//memcpy(&server_addr.sin_addr, server_ip_addr->h_addr, server_ip_addr->h_length);
-
-	// Try to make a connection with the server port
-	if (connect(socket_fd, (struct sockaddr *)&server_addr, sizeof(struct sockaddr)) == -1)
-	{
-		fprintf(stderr, "otp_dec Error: could not contact otp_dec_d on port %s\n", port_name);
+	conf.prog = "otp_dec";
+	conf.tag = "dec";
+	conf.daemon = "otp_dec_d";
+	if (clientParseEndpoints(&conf, port_name) == -1)
 		exit(2);
-	}
-	
-	// Function to confirm there is a connection with the daemon
-	recvConf(socket_fd, port_name);
-
-	// Function to send both the plaintext and key file to the server
-	// Send the encrypted file first
-	sendFile(socket_fd, file_enc);
-	// Send the key file
-	sendFile(socket_fd, file_key);
-	// Function to recieve the decrypted text
-	recvFile(socket_fd);
-
-	// Close the socket
-	close(socket_fd);	
-} 
+	return fanoutRun(&conf, fc);
+}
 
 
 /* Function: main
@@ -269,15 +289,74 @@ int main(int argc, char ** argv)
 	// Set variables
 	int file_encrypt;	// encrypted file text
 	int file_key;		// key file generated by keygen program
-	int size_encrypt;	// size of the encrypted file
-	int size_key;		// size of the key file
-
-	// Check to be sure there are 4 arguments, otherwise print error of usage
-	if (argc != 4)
+	off_t size_encrypt;	// size of the encrypted file
+	off_t size_key;		// size of the key file
+	size_t text_length;	// size of the text without its newline
+	char last_char = 0;	// Last char of the file
+	char *text_map;		// Text, mapped
+	char *key_map;		// Key, mapped
+	int stripes = 1;	// Connections to send the text over (-j)
+	int jobs_given = 0;	// Whether -j was given
+	int local = 0;		// Run the cipher here (--local)
+	int seeded = 0;		// Key argument is a seed file (--seed)
+	struct otp_seed seed;	// The seed
+	unsigned int flags = 0;	// HELLO_BINARY of --binary, HELLO_CRC of --crc
+	char *out_name = NULL;	// File to write the result to (-o)
+	int file_out = -1;	// Result file, -1 for stdout
+	struct stat out_stat;	// Whether stdout is a file
+	struct fanout_conf fc = {0};	// Directory mode, when --dir is given
+	struct option longs[] = {	// Options of directory and local modes
+		{"dir", required_argument, NULL, 'd'},
+		{"key-dir", required_argument, NULL, 'K'},
+		{"key", required_argument, NULL, 'k'},
+		{"out", required_argument, NULL, 'O'},
+		{"local", no_argument, NULL, 'l'},
+		{"seed", no_argument, NULL, 's'},
+		{"binary", no_argument, NULL, 'b'},
+		{"crc", no_argument, NULL, 'c'},
+		{NULL, 0, NULL, 0}
+	};
+	int opt;		// Option being read
+
+	// Read the options, then check the arguments left, otherwise print error of usage
+	while ((opt = getopt_long(argc, argv, "j:o:", longs, NULL)) != -1)
+	{
+		switch (opt)
+		{
+		case 'j': stripes = atoi(optarg); jobs_given = 1; break;
+		case 'o': out_name = optarg; break;
+		case 'd': fc.in_dir = optarg; break;
+		case 'K': fc.key_dir = optarg; break;
+		case 'k': fc.key_pad = optarg; break;
+		case 'O': fc.out_dir = optarg; break;
+		case 'l': local = 1; break;
+		case 's': seeded = 1; break;
+		case 'b': flags |= HELLO_BINARY; break;
+		case 'c': flags |= HELLO_CRC; break;
+		default: stripes = 0; break;
+		}
+	}
+	if (stripes < 1 || argc - optind != (fc.in_dir != NULL ? 1 : local ? 2 : 3) || (local && fc.in_dir != NULL) ||
+		(seeded && (local || fc.in_dir != NULL || (flags & HELLO_BINARY))) || (flags != 0 && fc.in_dir != NULL) ||
+		(local && (flags & HELLO_CRC)) ||
+		(fc.in_dir != NULL && (fc.out_dir == NULL || out_name != NULL || (fc.key_dir == NULL) == (fc.key_pad == NULL))) ||
+		(fc.in_dir == NULL && (fc.out_dir != NULL || fc.key_dir != NULL || fc.key_pad != NULL)))
 	{
-		fprintf(stderr, "otp_dec Usage: otp_dec <encrypted file> <key> <port>\n");
+		fprintf(stderr, "otp_dec Usage: otp_dec [-j stripes] [-o outfile] [--seed | --binary] [--crc] <encrypted file> <key|seed> <port[,port...]>\n"
+			"\totp_dec --dir <in> --key-dir <keys> | --key <pad> --out <out> [-j jobs] <port[,port...]>\n"
+			"\totp_dec --local [--binary] [-j threads] [-o outfile] <encrypted file> <key>\n"
+			"\tOver 1 MiB, a pipe or terminal on stdout gets output as it comes; it is only\n"
+			"\twhole when otp_dec exits with 0\n");
 		exit(1);
-	}	
+	}
+
+	// Directory mode sends every file under --dir, -j at a time
+	if (fc.in_dir != NULL)
+	{
+		fc.jobs = stripes;
+		return runDir(argv[optind], &fc);
+	}
+	argv += optind - 1;
 
 	// -- Open both key and encrypted files and make some basic checks --
 	// Try to see if encrypted file is available
@@ -289,38 +368,88 @@ int main(int argc, char ** argv)
 		exit(1);
 	}
 
-	// Try to see if key file is available
-	file_key = open(argv[2], O_RDONLY);
-	// If it doesn't exist output error and exit with 1
-	if (file_key == -1)
+	// Get size of the encrypted file
+	size_encrypt = lseek(file_encrypt, 0, SEEK_END);
+
+	// A seed stands in for the key, the daemon makes a key as long as needed
+	if (seeded)
 	{
-		fprintf(stderr, "Error: key file does not exist\n");
-		exit(1);
+		if (seedRead(argv[2], &seed) == -1)
+		{
+			fprintf(stderr, "Error: %s is not a seed file from keygen -s\n", argv[2]);
+			exit(1);
+		}
+		file_key = -1;
 	}
+	else
+	{
+		// Try to see if key file is available
+		file_key = open(argv[2], O_RDONLY);
+		// If it doesn't exist output error and exit with 1
+		if (file_key == -1)
+		{
+			fprintf(stderr, "Error: key file does not exist\n");
+			exit(1);
+		}
 
-	// Check key file is greater than the encrypted file
-	// Get size of encrypted file
-	size_encrypt = lseek(file_encrypt, 0, SEEK_END);
-	// Get size of key file
-	size_key = lseek(file_key, 0, SEEK_END);
-	// Verify the condition matches criteria
-	if (size_key < size_encrypt)
+		// Check key file is greater than the encrypted file
+		// Get size of key file
+		size_key = lseek(file_key, 0, SEEK_END);
+		// Verify the condition matches criteria
+		if (size_key < size_encrypt)
+		{
+			// Send error the key used is to short
+			fprintf(stderr, "Error: key file is too short\n");
+			exit(1);
+		}
+	}
+
+	// The trailing newline is not sent, only the text in front of it.  A
+	// binary file has no newline of its own, every byte is sent
+	text_length = size_encrypt;
+	if (!(flags & HELLO_BINARY) && text_length > 0 && pread(file_encrypt, &last_char, 1, text_length - 1) == 1 && last_char == '\n')
+		text_length--;
+
+	// Map both files once, the pages are sent or ciphered straight from
+	// the mapping and checked for bad characters in the same pass
+	text_map = mapFile(file_encrypt, text_length);
+	key_map = seeded ? NULL : mapFile(file_key, text_length);
+
+	// Striping writes every range in place, so it needs a file to write to:
+	// the -o file, or stdout when that was redirected to a file
+	if (out_name != NULL)
 	{
-		// Send error the key used is to short
-		fprintf(stderr, "Error: key file is too short\n");
-		exit(1);
+		file_out = open(out_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (file_out == -1)
+		{
+			fprintf(stderr, "Error: could not open %s\n", out_name);
+			exit(1);
+		}
 	}
-	
-	// Function to check for bad characters
-	validateChars(size_encrypt, file_encrypt);
-	validateChars(size_key, file_key);	
-	
-	// Function to connect to the daemon where it will send and recieve a file
-	connToDaemon(argv[1], argv[2], argv[3], file_encrypt, file_key);
+	else if (stripes > 1 && !local)
+	{
+		fflush(stdout);
+		if (fstat(STDOUT_FILENO, &out_stat) == -1 || !S_ISREG(out_stat.st_mode))
+		{
+			fprintf(stderr, "otp_dec Error: -j needs -o or stdout redirected to a file\n");
+			exit(1);
+		}
+		file_out = STDOUT_FILENO;
+	}
+
+	// Run the cipher here when asked to, on every CPU unless -j says otherwise,
+	// otherwise connect to the daemon where it will send and recieve a file
+	if (local)
+		runLocal(argv[1], argv[2], text_map, key_map, text_length, file_out, jobs_given ? stripes : (int)sysconf(_SC_NPROCESSORS_ONLN), (flags & HELLO_BINARY) != 0);
+	else
+		connToDaemon(argv[1], argv[2], argv[3], file_encrypt, file_key, text_map, key_map, text_length, stripes, file_out, seeded ? &seed : NULL, flags);
+	if (file_out != -1 && file_out != STDOUT_FILENO)
+		close(file_out);
 
 	// Close both files
 	close(file_encrypt);
-	close(file_key);
+	if (file_key != -1)
+		close(file_key);
 
 	// Exit the program
 	return 0;
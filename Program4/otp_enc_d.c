@@ -29,222 +29,182 @@
 #include <netinet/in.h>	// Makes available access to network addresses
 #include <netdb.h>	// Defines the hostnet structure
 #include <arpa/inet.h>	// Makes available ports
+#include "otp_arena.h"	// Per worker arena for request buffers
+#include "otp_batch.h"	// Batches of small requests
+#include "otp_codec.h"	// Checking and cyphering kernel
+#include "otp_crc.h"	// CRC32C of the frames
+#include "otp_io.h"	// Deadlines on the client socket
+#include "otp_memtrace.h"	// Allocation tracing per request
+#include "otp_metrics.h"	// Metrics log
+#include "otp_pipe.h"	// Stages of a streamed request
+#include "otp_proto.h"	// Hello and replies
+#include "otp_seed.h"	// Key of a seeded request
+#include "otp_server.h"	// Accepting and admitting clients
+
+// Arena every buffer of a request comes from.  It is mapped once by the
+// daemon before any client is accepted and reset when a request is done.
+struct arena req_arena;
 
 /* Function: sendMsg
- * Parameter: encrypted message and the client socket
- * Overview: Sends the encrypted message over to the client
+ * Parameter: status or NULL, encrypted message, its length and the client socket
+ * Overview: Sends the status and the encrypted message over to the client
+ * 	in one sendmsg before the download deadline
  * Pre: Established the encrypted message
- * Post: Sends encrypted message out to client
+ * Post: Sends the whole encrypted message out to client, drops a client
+ * 	that doesn't take it in time
  */
-void sendMsg(char *encrypt_msg, int c_socket)
+void sendMsg(struct otp_status *status, char *encrypt_msg, size_t msg_length, int c_socket)
 {
 	// Set variables
-	int msg_length = 512;		// Length of each message
-	char *send_msg = malloc(msg_length * msg_length);	// Message to be sent
-	int size_sent;			// Size of the sent message
-	bzero(send_msg, msg_length);
-	//printf("my message is %s\n", encrypt_msg);
-	// Loop to read string
-	//while ((size_sent = read(enc_fd, send_msg, sizeof(send_msg))) > 0)
-	//{
-		//printf("Am I sending anything??????\n");
-		size_sent = send(c_socket, encrypt_msg, msg_length, 0);
-		// Send error if -1
-		if (size_sent < msg_length)
-		{
-			fprintf(stderr, "otp_enc_d ERROR: Issue with sending data to client");
-			exit(1);
-		}
-		bzero(send_msg, msg_length);
-		
-		// Send the message, but check to be sure it diden't fail to send, break
-		/*if (send(c_socket, send_msg, size_sent, 0) < 0)
-		{
-			fprintf(stderr, "otp_enc_d ERROR: Sent file failed\n");
-			//break;
-		}
-		// Put null characters into send message
-		bzero(send_msg, msg_length);
-		*/
-	//}
-}
+	struct io_phase download;	// Deadline of sending the result
+	struct iovec iov[2];		// The status and the message
+	int pieces = 0;			// Pieces to send
 
-/* Function: findLetter
- * Parameter: some value
- * Overview: Returns the letter in the possible chars
- * Pre: Established a value to interprut
- * Post: Returns the letter in the possible chars
- */
-char findLetter(int some_value)
-{
-	// Set Variables
-	static const char poss_chars[] = " ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-	
-	// Could the value be over 27
-	if (some_value > 26)
+	if (status != NULL)
+	{
+		iov[pieces].iov_base = status;
+		iov[pieces].iov_len = sizeof(*status);
+		pieces++;
+	}
+	iov[pieces].iov_base = encrypt_msg;
+	iov[pieces].iov_len = msg_length;
+	pieces++;
+	ioPhase(&download, "download", (status != NULL ? sizeof(*status) : 0) + msg_length);
+	if (ioSendv(c_socket, iov, pieces, &download) == -1)
 	{
-		// Subtract the value from 27, so it wraps around to begninning of array
-		some_value -= 27;
+		fprintf(stderr, "otp_enc_d ERROR: Issue with sending data to client\n");
+		ioAbort(c_socket);
+		exit(1);
 	}
-	return poss_chars[some_value];
 }
 
-/* Function: cypherLet
- * Parameter: some char
- * Overview: Converts a char to a value
- * Pre: Established a character
- * Post: Returns a value
+/* Function: encryptFile
+ * Parameters: plaintext and key buffers, their length, client socket and hello
+ * Overview: Management of encryption.  Every character of the plaintext
+ * 	and key is checked in the same pass that ciphers it, so bad input
+ * 	costs nothing more to find.  A client that asked for a status is
+ * 	told where the first bad character is instead of getting a result.
+ * 	A binary request is XORed with its key, any byte goes.  With
+ * 	HELLO_CRC the status carries the CRC32C of the result.
+ * Pre: We have the plaintext and key received into the request arena
+ * Post: sends the string of encryption, or the status of bad input.  A
+ * 	client that didn't ask for a status is dropped on bad input.
  */
-int findValue(char some_letter)
+void encryptFile(char *plain_msg, char *key_msg, size_t plain_length, int c_socket, struct otp_hello *hello)
 {
 	// Set variables
-	static const char poss_chars[] = " ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-	int j;			// For the loop
+	struct otp_status status;	// Status sent in front of the result
+	char *encrypt_msg;		// Message to be sent back to client
+	size_t bad;			// First bad character, the length if none
+	int with_status = (ntohl(hello->flags) & HELLO_STATUS) != 0;	// Client asked for a status
+	int dir = (ntohl(hello->flags) & HELLO_BINARY) ? CODEC_XOR : CODEC_ENC;	// Cipher of the request
+
+	// The status goes out from the stack with the message in one sendmsg
+	encrypt_msg = reqAlloc(&req_arena, plain_length);
+	if (encrypt_msg == NULL)
+	{
+		fprintf(stderr, "otp_enc_d ERROR: Out of memory for the encrypted message\n");
+		exit(1);
+	}
+	memset(&status, 0, sizeof(status));
 
-	// Loop to find match with letter
-	for (j = 0; j < 27; j++)
+	// Check and cypher each character in one pass
+	bad = codecFused(plain_msg, key_msg, encrypt_msg, plain_length, dir);
+	if (bad < plain_length)
 	{
-		// Does the array character match the letter
-		if (poss_chars[j] == some_letter)
-			return j;
+		status.code = codecCheck(plain_msg + bad, 1) == 0 ? STATUS_BAD_TEXT : STATUS_BAD_KEY;
+		status.offset = htobe64(bad);
+		metricsEmit("bad_input which=%s offset=%llu length=%llu",
+			status.code == STATUS_BAD_TEXT ? "text" : "key", (unsigned long long)bad, (unsigned long long)plain_length);
+		if (!with_status)
+		{
+			// The client would take whatever comes back as its result
+			fprintf(stderr, "otp_enc_d ERROR: Bad character at offset %llu of the %s\n",
+				(unsigned long long)bad, status.code == STATUS_BAD_TEXT ? "plaintext" : "key");
+			ioAbort(c_socket);
+			exit(1);
+		}
+		sendMsg(&status, NULL, 0, c_socket);
+		return;
 	}
-}  
+
+	// Send encrypted message, behind its status if asked for
+	status.code = STATUS_OK;
+	if (ntohl(hello->flags) & HELLO_CRC)
+		status.crc = htonl(crc32c(0, encrypt_msg, plain_length));
+	sendMsg(with_status ? &status : NULL, encrypt_msg, plain_length, c_socket);
+}
 
 
-/* Function: cypherLet
- * Parameters: Plaintext, key, and blank character
- * Overview: Manages calculation for the encrypted letter
- * Pre: Established plaintext and key characters
- * Post: Returns the appropriate encrypted letter
+/* Function: recvFile
+ * Parameters: length the client declared, client socket, upload phase
+ * Overview: Receives content sent by the client into a request arena buffer
+ * Pre: Client has established handshake
+ * Post: Returns the received content, drops a client that stops short or
+ * 	misses the upload deadline
  */
-char cypherLet(char plain_char, char key_char, char enc_char)
+char *recvFile(size_t total_length, int c_socket, struct io_phase *upload)
 {
 	// Set variables
-	int plain_num;		// plaintext value
-	int key_num;		// key value
-	int total_num;		// sum of plain and key
-
-	// Find the values for both the plain and key numbers
-	plain_num = findValue(plain_char);
-	key_num = findValue(key_char);
+	char *the_msg;			// Buffer the content is received into
 
-	// Add both numbers to get total
-	total_num = plain_num + key_num;	
+	the_msg = reqAlloc(&req_arena, total_length);
+	if (the_msg == NULL)
+	{
+		fprintf(stderr, "otp_enc_d ERROR: Out of memory for received file\n");
+		exit(1);
+	}
 
-	// Get the char associated with the total
-	enc_char = findLetter(total_num);
+	// Recieve the message, a slow or silent client is cut off
+	if (ioRecv(c_socket, the_msg, total_length, upload) == -1)
+	{
+		fprintf(stderr, "otp_enc_d ERROR: Client sent %llu of %llu bytes\n", upload->done, upload->total);
+		ioAbort(c_socket);
+		exit(1);
+	}
 
-	// Return the character
-	return enc_char;
+	return the_msg;
 }
 
 
-/* Function: encryptFile
- * Parameters: plaintext and key file names and size of plaintext, and client socket
- * Overview: Management of encryption
- * Pre: We have plaintext and key temp files available
- * Post: sends the string of encryption
- */
-void encryptFile(char *plain_name, char *key_name, int plain_length, int c_socket, int enc_fd, char *enc_name)
-{
-	// Set variables
-	char *encrypt_msg = malloc(plain_length * sizeof(char));	// Message to be sent back to client
-	FILE *plain_file;		// Temp plain file
-	FILE *key_file;			// Temp key file
-	int i;				// Counter for loop
-	char plain_char;		// plaintext char
-	char key_char;			// key char
-	char enc_char;			// encrypted char
-	FILE *enc_file;			// encrypted file
-	char enc_str[1];		// Character string
-
-	// Open both files
-	plain_file = fopen(plain_name, "r");
-	key_file = fopen(key_name, "r");
-
-	// Open the encryption file to append
-	enc_file = fopen(enc_name, "a");
-
-	// Loop to gather each character
-	for (i = 0; i < plain_length - 1; i++)
-	{
-		// Get both the plaintext and key char
-		plain_char = (char)fgetc(plain_file);
-		key_char = (char)fgetc(key_file);
-		//enc_char = encrypt_msg[i];
-		// Cypher the letter
-		//enc_char = cypherLet(plain_char, key_char, enc_char);
-		encrypt_msg[i] = cypherLet(plain_char, key_char, enc_char);
-		//sprintf(enc_str, "%c", enc_char);
-
-		//printf("enc_str is %s\n", enc_str);
-		// Add char to the encrypted message
-		//*encrypt_msg++ = enc_char;
-		// Append char to enc_file
-		//fprintf(enc_file, enc_str);
-	}		
-	fprintf(enc_file, "%s\n", encrypt_msg);
-	//printf("My encrypted string %s\n", encrypt_msg);
-	// Free up the encrypt_msg
-	//free(encrypt_msg);
-	
-	// Close both files
-	fclose(plain_file);
-	fclose(key_file);
-	fclose(enc_file);
-	// Send encrypted file
-	//sendMsg(enc_fd, c_socket);
-	sendMsg(encrypt_msg, c_socket);
-	free(encrypt_msg);
-}
-
 
-/* Function: recvFile
- * Parameters: string of the file name, client socket
- * Overview: Writes content sent by client into temp file
- * Pre: Created a temp file and client has established handshake
- * Post: Temp file is written, total length of plain text is accounted for
+/* Function: frameCheck
+ * Parameters: text and key as received, key NULL when it was made from a
+ * 	seed, their length, client socket, upload phase, hello
+ * Overview: Receives the CRC32C that closes the frame and checks the frame
+ * 	against it.  A damaged frame gets a STATUS_BAD_CRC instead of a
+ * 	result, a client that didn't ask for a status is dropped.
+ * Pre: The frame was received and the hello has HELLO_CRC
+ * Post: Returns 1 when the frame is good, 0 when it was answered as damaged
  */
-int recvFile(char *file_name, int c_socket)
+int frameCheck(char *text, char *key, size_t length, int c_socket, struct io_phase *upload, struct otp_hello *hello)
 {
 	// Set variables
-	int msg_length = 512;		// Length of recieved msg
-	char recv_msg[msg_length];	// received string piece
-	int recv_size = 0;		// initialize to 0 of recieved msg
-	FILE *the_file;			// File for writing stuff to
-	int total_length = 0;		// Retains the total length of the file
-
-	// Open the file to write stuff to
-	the_file = fopen(file_name, "w+");
-	// In case the file doesn't open
-	if (the_file == NULL)
+	struct otp_status status;	// Status of a damaged frame
+	uint32_t *wire;			// CRC32C the client sent, big endian
+	uint32_t crc;			// CRC32C of what arrived
+
+	wire = (uint32_t *)recvFile(sizeof(*wire), c_socket, upload);
+	crc = crc32c(0, text, length);
+	if (key != NULL)
+		crc = crc32c(crc, key, length);
+	if (crc == ntohl(*wire))
+		return 1;
+
+	metricsEmit("bad_crc offset=%llu length=%llu", (unsigned long long)be64toh(hello->offset), (unsigned long long)length);
+	if (!(ntohl(hello->flags) & HELLO_STATUS))
 	{
-		fprintf(stderr, "otp_enc_d ERROR: %s could not be opened\n", file_name);
+		fprintf(stderr, "otp_enc_d ERROR: Request failed its CRC32C\n");
+		ioAbort(c_socket);
 		exit(1);
 	}
-
-	// Loop to recieve the message
-	while ((recv_size = recv(c_socket, recv_msg, msg_length, 0)) > 0)
-	{
-		//write recieved to file
-		fprintf(the_file, recv_msg);
-		// Add to the total length
-		total_length += recv_size;
-		// Fill the recv_msg with null characters
-		bzero(recv_msg, msg_length);
-		// Break out of loop if at the end of the message or nothing more to recv
-		if (recv_size != 512 || recv_size == 0)
-			break;
-	}
-
-	// Close the file
-	fclose(the_file);
-
-	return total_length;
+	memset(&status, 0, sizeof(status));
+	status.code = STATUS_BAD_CRC;
+	sendMsg(&status, NULL, 0, c_socket);
+	return 0;
 }
 
 
-
 /* Function: sendConf
  * Parameters: response string, client socket
  * Overview: Send confirmation message to client
@@ -264,108 +224,112 @@ void sendConf(char *reply, int sock)
 
 
 /* Function: childProc
- * Parameters: child process socket
+ * Parameters: client socket, the client's hello
  * Overview: Handle client-server interaction with the child process
- * Pre: Already created child process
+ * Pre: Already created child process, the daemon admitted the request
  * Post: Transmit encrypted file back to the client
  */
-void childProc(int client_sock, int num_children)
+void childProc(int client_sock, struct otp_hello *hello)
 {
 	// Set variables
 	char serv_reply[2];		// A reply back to the client on status
-	char client_sent[4] = {0};	// Client's initial confirmation
-	int msg_length = 512;		// Message length
-	int proc_ID;			// Process ID of the child
-	char plain_file[32];		// String for file name of plaintext
-	char key_file[32];		// String for file name of key
-	struct stat st = {0};		// For checking existence of a file
-	int plain_fd;			// plaintext filedescriptor
-	int key_fd;			// key filedescriptor
-	int plain_length;		// Total length of plain file
-	int key_length;			// Total length of key file
-	char enc_file[32];		// The encrypted file
-	int enc_fd;			// Encryption file descriptor
-
-	// Recieve initial confirmation from client
-	recv(client_sock, client_sent, msg_length, 0);
-	// Check that the message is enc
-	if (strcmp(client_sent, "enc") == 0)
+	char *plain_msg;		// Received plaintext
+	char *key_msg;			// Received key
+	struct otp_seed *seed;		// Seed of a seeded request
+	size_t crc_bytes;		// CRC32C closing the frame, if any
+	size_t plain_length;		// Total length of plaintext and of key
+	struct io_phase upload;		// Deadline of receiving text and key
+	char request_name[48];		// Name the request is traced under
+	int served = 0;			// Requests served on this connection
+
+	// The counts of the last request are logged when the worker exits,
+	// however it exits
+	atexit(memtraceEnd);
+
+	// Requests on a kept connection follow each other in this worker
+	do
 	{
-		// Make sure we only have 5 or less current children going on
-		if (num_children > 5)
-		{
-			strncpy(serv_reply, "M", 1);
-			sendConf(serv_reply, client_sock);
-			exit(0);  // Exit child
-		}
-		// This is a success and should send the conf to send over files	
+		// Start tracing the allocations of this request.  A stripe of a
+		// bigger file is traced under its offset as well
+		if (served++ > 0)
+			memtraceEnd();
+		if (hello->offset != 0)
+			sprintf(request_name, "%d@%llu", (int)getpid(), (unsigned long long)be64toh(hello->offset));
+		else
+			sprintf(request_name, "%d", (int)getpid());
+		memtraceBegin(request_name);
+
+		// The daemon already checked the tag and made room, tell the client to go
+		strncpy(serv_reply, "S", 1);
+		sendConf(serv_reply, client_sock);
+
+		// A streamed request goes a chunk at a time through the stages
+		// of otp_pipe.c, any other is received whole into the request arena
+		if (ntohl(hello->flags) & HELLO_STREAM)
+			pipeStream(client_sock, hello, &req_arena,
+				(ntohl(hello->flags) & HELLO_BINARY) ? CODEC_XOR : CODEC_ENC, "otp_enc_d");
 		else
 		{
-			strncpy(serv_reply, "S", 1);
-			sendConf(serv_reply, client_sock);
+			plain_length = helloLength(hello);
+			crc_bytes = (ntohl(hello->flags) & HELLO_CRC) ? sizeof(uint32_t) : 0;
+			if (ntohl(hello->flags) & HELLO_SEED)
+			{
+				// A seeded request sends its seed, then the plaintext
+				ioPhase(&upload, "upload", sizeof(*seed) + plain_length + crc_bytes);
+				seed = (struct otp_seed *)recvFile(sizeof(*seed), client_sock, &upload);
+				plain_msg = recvFile(plain_length, client_sock, &upload);
+
+				// Make the key for where the text sits in the client's file
+				key_msg = reqAlloc(&req_arena, plain_length);
+				if (key_msg == NULL)
+				{
+					fprintf(stderr, "otp_enc_d ERROR: Out of memory for the key\n");
+					exit(1);
+				}
+				seedKeystream(seed, be64toh(hello->offset), key_msg, plain_length);
+			}
+			else
+			{
+				// Receive the plaintext into the request arena
+				ioPhase(&upload, "upload", 2ULL * plain_length + crc_bytes);
+				plain_msg = recvFile(plain_length, client_sock, &upload);
+
+				// Receive the key into the request arena, as long as the plaintext
+				key_msg = recvFile(plain_length, client_sock, &upload);
+			}
+
+			// A frame that fails its CRC32C was damaged on the way, it gets no result
+			if (crc_bytes == 0 || frameCheck(plain_msg, (ntohl(hello->flags) & HELLO_SEED) ? NULL : key_msg,
+				plain_length, client_sock, &upload, hello))
+			{
+				// Function to encrypt using both plaintext and key and send it
+				encryptFile(plain_msg, key_msg, plain_length, client_sock, hello);
+			}
 		}
-	}
-	// Otherwise recieved from some different client
-	else
-	{
-		// Send a rejection response of "U"
-		strncpy(serv_reply, "U", 1);
-		sendConf(serv_reply, client_sock);
-	}
-	
-	// Start to generate the files for plaintext and key
-	
-	// Get the process id of the child
-	proc_ID = getpid();
-	// Append the process ID with the plaintext and key files
-	sprintf(plain_file, "plain_%d", proc_ID);
-	sprintf(key_file, "key_%d", proc_ID);
-	sprintf(enc_file, "enc_%d", proc_ID);
-
-	// Open each of the files
-	plain_fd = open(plain_file, O_WRONLY | O_CREAT, 0644);
-	if (plain_fd == -1)
-	{
-		fprintf(stderr, "otp_enc_d ERROR: could not create plaintext temp\n");
-		exit(1);
-	}
-	key_fd = open(key_file, O_WRONLY | O_CREAT, 0644);
-	if (key_fd == -1)
-	{
-		fprintf(stderr, "otp_enc_d ERROR: could not create key temp\n");
-		exit(1);
-	}
-	enc_fd = open(enc_file, O_WRONLY | O_CREAT, 0644);
-	if (enc_fd == -1)
-	{
-		fprintf(stderr, "otp_enc_d ERROR: could not create enc temp\n");
-		exit(1);
-	}
-	// Cose the files for now
-	//close(plain_fd);
-	//close(key_fd);
-	//close(enc_fd);
-	// Function to write recv stuff into the pliantext file
-	// Also get the length of the plaintext to be used for encryption string later
-	plain_length = recvFile(plain_file, client_sock);
-
-	// Function to write recv stuff into the key file,
-	// not really going to do anything with length
-	key_length = recvFile(key_file, client_sock);
-
-	// Function to encrypt using both plaintext and key files and send it
-	encryptFile(plain_file, key_file, plain_length, client_sock, enc_fd, enc_file);
-
-	// Close the encryption file_descriptor
-	close(plain_fd);
-	close(key_fd);
-	close(enc_fd);
-	//close(enc_fd);
-	// Remove the temp files as we are done with them
-	remove(plain_file);
-	remove(key_file);
-	remove(enc_file);	
 
+		// Release every buffer of this request at once
+		reqReset(&req_arena);
+	} while (serverNextHello(client_sock, hello) == 0);
+}
+
+
+/* Function: batchProc
+ * Parameters: client sockets, their hellos, number of requests
+ * Overview: Handles a batch of small requests the daemon gathered for this
+ * 	worker, all of them traced as one request
+ * Pre: Already created child process, the daemon admitted every request
+ * Post: Every client got its result or was dropped
+ */
+void batchProc(int *client_socks, struct otp_hello *hellos, int count)
+{
+	// Set variables
+	char request_name[48];		// Name the batch is traced under
+
+	atexit(memtraceEnd);
+	sprintf(request_name, "%d+%d", (int)getpid(), count);
+	memtraceBegin(request_name);
+	batchRun(client_socks, hellos, count, &req_arena, CODEC_ENC, "otp_enc_d");
+	reqReset(&req_arena);
 }
 
 
@@ -376,124 +340,26 @@ void childProc(int client_sock, int num_children)
 int main(int argc, char *argv[])
 {
 	// Set variables
-	int socket_serv_fd;		// server socket file descriptor
-	struct sockaddr_in server_addr;	// Server's address structure
-	int server_port;		// Server's port number
-	int socket_client_fd;		// client socket file descriptor
-	int sock_size;			// Size of sockaddr_in
-	int pid;			// process IDs
-	struct sockaddr_in client_addr;	// Client's address structure
-	int sock_opt = 1;		// Sets the option in socket for reuse
-	struct sigaction signal;	// Signal structure
-	int num_children = 0;		// Count for number of children
-	int f_pid;			// Process ID when fork() is run
-	int status = 0;			// Status of fork
-
-	// Check to make sure there is one argument of the port number
-	if (argc < 2)	
-	{
-		fprintf(stderr, "otp_enc_d Usage: otp_enc_d <port_number>\n");
-		exit(1);
-	}
+	struct server_conf conf;	// Listening and admission settings
 
-	// Set up the server socket
-	if ((socket_serv_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
-	{
-		fprintf(stderr, "otp_enc_d ERROR: Failed to setup socket file descriptor\n");
-		exit(1);
-	}
-	bzero((char *) &server_addr, sizeof(server_addr));
-	// Get the port number as an integer from the argument
-	server_port = atoi(argv[1]);
-
-	// Stuff the server socket with address information
-	server_addr.sin_family = AF_INET;
-	server_addr.sin_port = htons(server_port);
-	server_addr.sin_addr.s_addr = INADDR_ANY;
-
-	
-	setsockopt(socket_serv_fd, SOL_SOCKET, SO_REUSEADDR, &sock_opt, sizeof(sock_opt));
-	
-	// Bind the server address to the socket using conditional
-	if (bind(socket_serv_fd, (struct sockaddr*)&server_addr, sizeof(struct sockaddr)) == -1)
-	{
-		fprintf(stderr, "otp_enc_d ERROR: Failed to bind address to socket\n");
-		exit(1);
-	}
+	// Check the options and that there is one argument of the port number
+	serverDefaults(&conf, "otp_enc_d", "enc", childProc);
+	conf.batch = batchProc;
+	serverParseArgs(&conf, argc, argv);
 
-	// Create a socket option where we can reuse the address on the server address
-	//setsockopt(socket_serv_fd, SOL_SOCKET, SO_REUSEADDR, &sock_opt, sizeof(sock_opt));
+	// Open the metrics log and turn on allocation tracing if asked for
+	metricsInit("otp_enc_d");
+	memtraceInit();
 
-	// Start to listen on the port
-	// 5 is the number availble spots for clients to contact
-	if (listen(socket_serv_fd, 5) == -1)
+	// Map the request arena once, workers carve their buffers out of it
+	if (arenaInit(&req_arena, ARENA_CHUNK) == -1)
 	{
-		fprintf(stderr, "otp_enc_c ERROR: Failed at listening on port");
+		fprintf(stderr, "otp_enc_d ERROR: Failed to set up the request arena\n");
 		exit(1);
 	}
 
-	// Set the signal handler to ignore interrupts
-	signal.sa_handler = SIG_IGN;
-	sigaction(SIGINT, &signal, NULL);
-
-	// Loop to accept clients
-	while (1)
-	{
-		// Get the size of the sockaddr_in
-		sock_size = sizeof(struct sockaddr_in);
-
-		// Accept client connections with conditional in case something happens
-		if ((socket_client_fd = accept(socket_serv_fd, (struct sockaddr *)&client_addr, &sock_size)) == -1)
-		{
-			fprintf(stderr, "otp_enc_d ERROR: Failed to accept client socket\n");
-			exit(1);
-		}
-		
-		// Add one to number of children
-		num_children++;
-
-		// Get the process ID for the fork
-		f_pid = fork();
-		// If teh pid from the process is 0, handle as a child
-		if (f_pid == 0)
-		{
-			// Set signal as default when executing
-			signal.sa_handler = SIG_DFL;
-			signal.sa_flags = 0;
-			sigaction(SIGINT, &signal, NULL);
-			//close the server socket
-			close(socket_serv_fd);
-			// Function to handle the child process
-			childProc(socket_client_fd, num_children);
-			exit(0);
-		}
-		// Print an error if there was an issue with the fork
-		else if (f_pid < 0) 
-		{
-			fprintf(stderr, "otp_enc_d ERROR: Failed in fork\n");
-			status = 1;
-			exit(1);
-		}
-		// Otherwise this is a parent process
-		else
-		{
-			// Wait for a process to complete
-			do {
-				waitpid(f_pid, &status, 0);
-			} while (!WIFEXITED(status) && !WIFSIGNALED(status));
-
-			// In case the parent process gets Ctrl-C, print out a statement
-			if (!(WIFEXITED(status))) 
-			{
-				printf("terminated by singal %d\n", status);
-				fflush(stdout);
-			}	
-			// Close the client socket
-			close(socket_client_fd);
-			num_children--;
-		}
-
-	}
+	// Accept clients, admit them and hand each one to a worker
+	serverRun(&conf);
 
 	// Exit the program
 	return 0;
@@ -0,0 +1,301 @@
+/*
+ * File otp_fair.c
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Per client token buckets for the daemons.  The hash only holds
+ * 	entry numbers, so an entry keeps its number for as long as it is in
+ * 	use and the daemon can point at it from its connections.  The hash is
+ * 	linear probing with backward shift deletion, it never fills up with
+ * 	tombstones however many clients come and go.  A client is only
+ * 	forgotten when no connection refers to it.
+ * 	The limits file has one "name value" pair per line, # starts a
+ * 	comment.  Names are req_rate, req_burst, byte_rate, byte_burst,
+ * 	quantum and idle_ms.
+ * Last Update: 06/03/2016
+ * Sources: Token bucket - https://en.wikipedia.org/wiki/Token_bucket
+ *   Linear probing deletion - https://en.wikipedia.org/wiki/Linear_probing#Deletion
+ */
+
+// Include Libraries
+#include <stdio.h>	// Reading the limits file
+#include <stdlib.h>	// calloc and strtod
+#include <string.h>	// strcmp of limit names
+#include "otp_fair.h"
+
+/* Function: fairHash
+ * Parameters: table, address
+ * Overview: Home position of an address in the hash
+ * Pre: none
+ * Post: Returns the position
+ */
+static int fairHash(struct fair_table *t, uint32_t addr)
+{
+	// Set variables
+	uint32_t h = addr * 2654435761u;	// Knuth's multiplicative hash
+
+	return (int)((h ^ (h >> 16)) & t->mask);
+}
+
+/* Function: fairDefaults
+ * Parameters: limits
+ * Overview: Fills in the limits used without a limits file
+ * Pre: none
+ * Post: No rate limits, round robin quantum of 64 KiB, idle after a minute
+ */
+void fairDefaults(struct fair_limits *limits)
+{
+	memset(limits, 0, sizeof(*limits));
+	limits->quantum = 64 << 10;
+	limits->idle_ms = 60000;
+}
+
+/* Function: fairLoadLimits
+ * Parameters: limits, path of the limits file
+ * Overview: Reads the limits file.  Names not in the file go back to their
+ * 	defaults, a burst left out is one second of its rate.
+ * Pre: none
+ * Post: Returns 0 with the limits filled in, -1 leaving them alone when the
+ * 	file can't be read or has a bad line
+ */
+int fairLoadLimits(struct fair_limits *limits, const char *path)
+{
+	// Set variables
+	FILE *file;			// The limits file
+	char line[256];			// One line of it
+	char name[64];			// Name on the line
+	double value;			// Value on the line
+	struct fair_limits read;	// Limits being read
+	int line_num = 0;		// For error messages
+
+	file = fopen(path, "r");
+	if (file == NULL)
+	{
+		fprintf(stderr, "Error: limits file %s could not be opened\n", path);
+		return -1;
+	}
+	fairDefaults(&read);
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		line_num++;
+		line[strcspn(line, "#\n")] = 0;
+		if (sscanf(line, " %63s", name) != 1)
+			continue;
+		if (sscanf(line, " %63s %lf", name, &value) != 2 || value < 0)
+		{
+			fprintf(stderr, "Error: limits file %s line %d is not \"name value\"\n", path, line_num);
+			fclose(file);
+			return -1;
+		}
+		if (strcmp(name, "req_rate") == 0)
+			read.req_rate = value;
+		else if (strcmp(name, "req_burst") == 0)
+			read.req_burst = value;
+		else if (strcmp(name, "byte_rate") == 0)
+			read.byte_rate = value;
+		else if (strcmp(name, "byte_burst") == 0)
+			read.byte_burst = value;
+		else if (strcmp(name, "quantum") == 0 && value >= 1)
+			read.quantum = (unsigned long long)value;
+		else if (strcmp(name, "idle_ms") == 0 && value >= 1)
+			read.idle_ms = (int)value;
+		else
+		{
+			fprintf(stderr, "Error: limits file %s line %d has a bad limit %s\n", path, line_num, name);
+			fclose(file);
+			return -1;
+		}
+	}
+	fclose(file);
+
+	if (read.req_burst < 1)
+		read.req_burst = read.req_rate < 1 ? 1 : read.req_rate;
+	if (read.byte_burst <= 0)
+		read.byte_burst = read.byte_rate;
+	*limits = read;
+	return 0;
+}
+
+/* Function: fairInit
+ * Parameters: table, most clients to track
+ * Overview: Sets up an empty table, the hash is kept at most half full
+ * Pre: Limits are filled in afterwards
+ * Post: Returns 0, -1 when out of memory
+ */
+int fairInit(struct fair_table *t, int capacity)
+{
+	// Set variables
+	int size = 2;		// Hash size, a power of two
+	int i;			// For the loops
+
+	while (size < capacity * 2)
+		size *= 2;
+	memset(t, 0, sizeof(*t));
+	t->clients = calloc(capacity, sizeof(struct fair_client));
+	t->index = malloc(size * sizeof(int));
+	if (t->clients == NULL || t->index == NULL)
+		return -1;
+	t->capacity = capacity;
+	t->mask = size - 1;
+	for (i = 0; i < size; i++)
+		t->index[i] = -1;
+	for (i = 0; i < capacity; i++)
+		t->clients[i].next_free = i + 1 < capacity ? i + 1 : -1;
+	t->free_head = 0;
+	fairDefaults(&t->limits);
+	return 0;
+}
+
+/* Function: fairLookup
+ * Parameters: table, address, current time
+ * Overview: Finds the entry of a client, adding it with full buckets if new,
+ * 	and takes a reference on it
+ * Pre: none
+ * Post: Returns the entry number, -1 when the table is full
+ */
+int fairLookup(struct fair_table *t, uint32_t addr, unsigned long long now)
+{
+	// Set variables
+	int pos = fairHash(t, addr);	// Position being probed
+	int client;			// The entry
+
+	while (t->index[pos] != -1)
+	{
+		client = t->index[pos];
+		if (t->clients[client].addr == addr)
+		{
+			t->clients[client].refs++;
+			t->clients[client].last_seen = now;
+			return client;
+		}
+		pos = (pos + 1) & t->mask;
+	}
+
+	// New client, make room by dropping the idle ones if it is full
+	if (t->free_head == -1)
+	{
+		fairExpire(t, now);
+		if (t->free_head == -1)
+			return -1;
+		return fairLookup(t, addr, now);
+	}
+	client = t->free_head;
+	t->free_head = t->clients[client].next_free;
+	t->index[pos] = client;
+	t->count++;
+	memset(&t->clients[client], 0, sizeof(struct fair_client));
+	t->clients[client].used = 1;
+	t->clients[client].addr = addr;
+	t->clients[client].refs = 1;
+	t->clients[client].last_seen = now;
+	t->clients[client].last_fill = now;
+	t->clients[client].req_tokens = t->limits.req_burst;
+	t->clients[client].byte_tokens = t->limits.byte_burst;
+	return client;
+}
+
+/* Function: fairHold
+ * Parameters: table, entry
+ * Overview: Takes another reference on an entry already referred to
+ * Pre: Entry is in use
+ * Post: Entry is kept until fairRelease drops this reference too
+ */
+void fairHold(struct fair_table *t, int client)
+{
+	t->clients[client].refs++;
+}
+
+/* Function: fairRelease
+ * Parameters: table, entry
+ * Overview: Drops a reference taken by fairLookup
+ * Pre: Entry is in use
+ * Post: Entry may be forgotten once it has been idle long enough
+ */
+void fairRelease(struct fair_table *t, int client)
+{
+	t->clients[client].refs--;
+}
+
+/* Function: fairCharge
+ * Parameters: table, entry, declared length, current time
+ * Overview: Fills the buckets for the time passed and takes one request and
+ * 	its bytes out of them.  A request longer than the byte burst is let
+ * 	through when the byte bucket is full and leaves it in debt, so the
+ * 	client still gets its byte rate on average.
+ * Pre: Entry is in use
+ * Post: Returns 1 and charges the buckets if the request fits, 0 if not
+ */
+int fairCharge(struct fair_table *t, int client, unsigned long long bytes, unsigned long long now)
+{
+	// Set variables
+	struct fair_client *c = &t->clients[client];	// The client
+	struct fair_limits *l = &t->limits;		// Its limits
+	double secs = (now - c->last_fill) / 1000.0;	// Time since the last fill
+	double need;					// Bytes that must be there
+
+	c->last_fill = now;
+	c->req_tokens += secs * l->req_rate;
+	if (c->req_tokens > l->req_burst)
+		c->req_tokens = l->req_burst;
+	c->byte_tokens += secs * l->byte_rate;
+	if (c->byte_tokens > l->byte_burst)
+		c->byte_tokens = l->byte_burst;
+
+	need = bytes < l->byte_burst ? bytes : l->byte_burst;
+	if (l->req_rate > 0 && c->req_tokens < 1)
+		return 0;
+	if (l->byte_rate > 0 && c->byte_tokens < need)
+		return 0;
+	if (l->req_rate > 0)
+		c->req_tokens -= 1;
+	if (l->byte_rate > 0)
+		c->byte_tokens -= bytes;
+	return 1;
+}
+
+/* Function: fairExpire
+ * Parameters: table, current time
+ * Overview: Forgets the clients no connection refers to that have been idle
+ * 	longer than idle_ms
+ * Pre: none
+ * Post: Their entries are free and their hash positions emptied
+ */
+void fairExpire(struct fair_table *t, unsigned long long now)
+{
+	// Set variables
+	int client;		// Entry being checked
+	int pos;		// Its hash position
+	int next;		// Position after the hole
+	int home;		// Home position of the entry at next
+
+	for (client = 0; client < t->capacity; client++)
+	{
+		if (!t->clients[client].used || t->clients[client].refs > 0 ||
+			now - t->clients[client].last_seen < (unsigned long long)t->limits.idle_ms)
+			continue;
+
+		// Find it in the hash, then shift the run after it back over the hole
+		pos = fairHash(t, t->clients[client].addr);
+		while (t->index[pos] != client)
+			pos = (pos + 1) & t->mask;
+		next = pos;
+		while (1)
+		{
+			next = (next + 1) & t->mask;
+			if (t->index[next] == -1)
+				break;
+			home = fairHash(t, t->clients[t->index[next]].addr);
+			// Leave it alone if its home lies cyclically in (pos, next]
+			if (pos <= next ? (pos < home && home <= next) : (pos < home || home <= next))
+				continue;
+			t->index[pos] = t->index[next];
+			pos = next;
+		}
+		t->index[pos] = -1;
+
+		t->clients[client].used = 0;
+		t->clients[client].next_free = t->free_head;
+		t->free_head = client;
+		t->count--;
+	}
+}
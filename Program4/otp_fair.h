@@ -0,0 +1,65 @@
+/*
+ * File otp_fair.h
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Per client state of a daemon.  Every source address gets an
+ * 	entry with two token buckets, one for requests per second and one for
+ * 	bytes per second, so one busy client can't take the whole daemon.
+ * 	Entries live in a fixed table found through an open addressing hash
+ * 	and are dropped once a client has been idle long enough.  The limits
+ * 	come from a file that can be read again while the daemon runs.
+ * Last Update: 06/03/2016
+ */
+
+#ifndef OTP_FAIR_H
+#define OTP_FAIR_H
+
+#include <stdint.h>	// Fixed width address
+
+/* Limits applied to each client, a rate of 0 means no limit */
+struct fair_limits
+{
+	double req_rate;		// Requests per second
+	double req_burst;		// Requests allowed at once
+	double byte_rate;		// Declared bytes per second
+	double byte_burst;		// Declared bytes allowed at once
+	unsigned long long quantum;	// Bytes a client may start per round
+	int idle_ms;			// Idle time before a client is forgotten
+};
+
+/* One client */
+struct fair_client
+{
+	int used;			// Entry holds a client
+	uint32_t addr;			// Source address, network order
+	int refs;			// Connections held for it
+	unsigned long long last_seen;	// Time of its last connection in ms
+	unsigned long long last_fill;	// Time the buckets were last filled
+	double req_tokens;		// Requests it may still start
+	double byte_tokens;		// Bytes it may still start
+	int next_free;			// Next unused entry, -1 at the end
+};
+
+/* Every client of a daemon */
+struct fair_table
+{
+	struct fair_client *clients;	// Entries, an index never moves
+	int capacity;			// Number of entries
+	int *index;			// Hash of address to entry, -1 when empty
+	int mask;			// Hash size minus one
+	int free_head;			// First unused entry, -1 when full
+	int count;			// Entries in use
+	struct fair_limits limits;	// Limits of every client
+};
+
+void fairDefaults(struct fair_limits *limits);
+int fairLoadLimits(struct fair_limits *limits, const char *path);
+int fairInit(struct fair_table *t, int capacity);
+int fairLookup(struct fair_table *t, uint32_t addr, unsigned long long now);
+void fairHold(struct fair_table *t, int client);
+void fairRelease(struct fair_table *t, int client);
+int fairCharge(struct fair_table *t, int client, unsigned long long bytes, unsigned long long now);
+void fairExpire(struct fair_table *t, unsigned long long now);
+
+#endif
@@ -0,0 +1,528 @@
+/*
+ * File otp_fanout.c
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Directory mode of otp_enc and otp_dec.  The input tree is
+ * 	walked once, then a thread per connection sends files until none are
+ * 	left.  Every thread has its own queue of files, dealt out biggest
+ * 	first, and takes the biggest left in it, so the big files are started
+ * 	early and one huge file doesn't leave the others idle at the end.  A
+ * 	thread whose queue runs dry steals the smallest file left in another's,
+ * 	the piece of work that least delays the end.  The main thread reports
+ * 	progress while they run.  A file that can't be sent, a daemon being
+ * 	too busy for it included, is reported and counted, the rest go on.
+ * Last Update: 06/03/2016
+ * Sources: Blumofe and Leiserson, Scheduling Multithreaded Computations by Work Stealing, 1999
+ */
+
+// Include Libraries
+#define _GNU_SOURCE	// nftw and usleep
+#include <stdio.h>	// General IO, including printf to redirect files
+#include <stdlib.h>	// General purpose functions
+#include <string.h>	// Manipulation of C strings and arrays
+#include <errno.h>	// mkdir of a directory that is there
+#include <time.h>	// Clock for the throughput
+#include <fcntl.h>	// Opening files
+#include <ftw.h>	// Walking the input tree
+#include <limits.h>	// PATH_MAX
+#include <pthread.h>	// One thread per connection
+#include <unistd.h>	// Provides access to the POSIX API
+#include <sys/stat.h>	// Sizes of files and making directories
+#include "otp_codec.h"
+#include "otp_proto.h"
+#include "otp_fanout.h"
+
+#define FAN_TICK_MS	500	// Time between progress reports
+#define FAN_POLL_MS	20	// Time between looks at whether it is done
+
+/* A file to send */
+struct fan_file
+{
+	char *path;			// Path under the input directory
+	unsigned long long size;	// Bytes in the file
+	unsigned long long key_off;	// Start of its slice of the pad
+};
+
+/* Files waiting for one thread, others may steal from the tail */
+struct fan_deque
+{
+	pthread_mutex_t lock;		// Taken by the owner and thieves
+	int *items;			// File numbers, biggest first
+	int head;			// Next one the owner takes
+	int tail;			// One past the next one a thief takes
+};
+
+/* A directory run */
+struct fanout
+{
+	struct client_conf *conf;	// Where files may go
+	struct fanout_conf *fc;		// What was asked for
+	struct fan_file *files;		// Every file found
+	int nfiles;			// Number of them
+	int jobs;			// Threads running
+	struct fan_deque deques[FANOUT_MAX_JOBS];	// One per thread
+	int key_fd;			// Shared pad, -1 with a key directory
+	int done;			// Files finished
+	int failed;			// Files that couldn't be sent
+	unsigned long long bytes;	// Text bytes of finished files
+};
+
+/* One thread */
+struct fan_worker
+{
+	struct fanout *fo;		// The run
+	int id;				// Its queue
+	pthread_t thread;		// The thread
+};
+
+// The walk has no way to pass its own state to the callback
+static struct fan_file *walk_files = NULL;	// Files found so far
+static int walk_count = 0;			// Number of them
+static int walk_cap = 0;			// Room in walk_files
+static size_t walk_root = 0;			// Length of the input directory
+static const char *walk_out = NULL;		// Output directory
+
+/* Function: nowMsec
+ * Parameters: none
+ * Overview: Reads the monotonic clock
+ * Pre: none
+ * Post: Returns the time in milliseconds
+ */
+static unsigned long long nowMsec(void)
+{
+	// Set variables
+	struct timespec ts;		// Current time
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Function: walkEntry
+ * Parameters: path, its stat, kind, position in the walk
+ * Overview: Adds a regular file to the list, and makes the matching
+ * 	directory under the output for a directory
+ * Pre: walk_root and walk_out are set
+ * Post: Returns 0 to go on, -1 when out of memory
+ */
+static int walkEntry(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+	// Set variables
+	const char *rel = path + walk_root;	// Path under the input directory
+	char out[PATH_MAX];		// Same path under the output
+	struct fan_file *grown;		// Bigger list
+
+	(void)ftw;
+	while (*rel == '/')
+		rel++;
+	if (type == FTW_D)
+	{
+		if (rel[0] != 0 && snprintf(out, sizeof(out), "%s/%s", walk_out, rel) < (int)sizeof(out))
+			mkdir(out, 0755);
+		return 0;
+	}
+	if (type != FTW_F || !S_ISREG(st->st_mode))
+		return 0;
+
+	if (walk_count == walk_cap)
+	{
+		walk_cap = walk_cap == 0 ? 256 : walk_cap * 2;
+		grown = realloc(walk_files, walk_cap * sizeof(struct fan_file));
+		if (grown == NULL)
+			return -1;
+		walk_files = grown;
+	}
+	walk_files[walk_count].path = strdup(rel);
+	if (walk_files[walk_count].path == NULL)
+		return -1;
+	walk_files[walk_count].size = st->st_size;
+	walk_files[walk_count].key_off = 0;
+	walk_count++;
+	return 0;
+}
+
+/* Function: bySize
+ * Parameters: two file numbers
+ * Overview: qsort order of files, biggest first
+ * Pre: walk_files holds the files
+ * Post: Returns the order
+ */
+static int bySize(const void *a, const void *b)
+{
+	// Set variables
+	unsigned long long sa = walk_files[*(const int *)a].size;	// First size
+	unsigned long long sb = walk_files[*(const int *)b].size;	// Second size
+
+	return sa < sb ? 1 : sa > sb ? -1 : 0;
+}
+
+/* Function: takeFile
+ * Parameters: the run, thread asking
+ * Overview: The thread's own biggest file, otherwise the smallest one left
+ * 	in another thread's queue
+ * Pre: Queues are dealt
+ * Post: Returns a file number, -1 once every queue is empty
+ */
+static int takeFile(struct fanout *fo, int id)
+{
+	// Set variables
+	struct fan_deque *d;		// Queue being looked at
+	int file = -1;			// File taken
+	int i;				// For the loop
+
+	d = &fo->deques[id];
+	pthread_mutex_lock(&d->lock);
+	if (d->head < d->tail)
+		file = d->items[d->head++];
+	pthread_mutex_unlock(&d->lock);
+
+	for (i = 1; file == -1 && i < fo->jobs; i++)
+	{
+		d = &fo->deques[(id + i) % fo->jobs];
+		pthread_mutex_lock(&d->lock);
+		if (d->head < d->tail)
+			file = d->items[--d->tail];
+		pthread_mutex_unlock(&d->lock);
+	}
+	return file;
+}
+
+/* Function: validRange
+ * Parameters: file, where to start, bytes, buffer of STRIPE_BUF
+ * Overview: Checks a range holds only spaces and A-Z, the same test the
+ * 	single file mode makes
+ * Pre: none
+ * Post: Returns the offset in the range of the first bad character, length
+ * 	if there is none, -1 if it can't be read
+ */
+static long long validRange(int file, unsigned long long start, unsigned long long length, char *buf)
+{
+	// Set variables
+	unsigned long long done;	// Bytes checked so far
+	ssize_t n;			// Bytes read
+	size_t bad;			// First bad character of a piece
+
+	for (done = 0; done < length; done += n)
+	{
+		n = pread(file, buf, length - done < STRIPE_BUF ? length - done : STRIPE_BUF, start + done);
+		if (n <= 0)
+			return -1;
+		bad = codecCheck(buf, n);
+		if (bad < (size_t)n)
+			return done + bad;
+	}
+	return length;
+}
+
+/* Function: sendOne
+ * Parameters: the run, file, buffer of STRIPE_BUF
+ * Overview: Sends one file and its key to a daemon and writes the result
+ * 	to the same path under the output directory
+ * Pre: Output directories exist
+ * Post: Returns 0 when the result is written, -1 with a message if not
+ */
+static int sendOne(struct fanout *fo, struct fan_file *f, char *buf)
+{
+	// Set variables
+	const char *prog = fo->conf->prog;	// For messages
+	char path[PATH_MAX];		// Path of the text, key or result
+	int text_fd = -1;		// The text
+	int key_fd = -1;		// Its key file
+	int out_fd = -1;		// The result
+	unsigned long long key_off = f->key_off;	// Start of its key
+	unsigned long long length = f->size;	// Text without its newline
+	struct stat st;			// Size of the key
+	char last_char = 0;		// Last char of the text
+	int socket_fd;			// socket file descriptor
+	int chosen = -1;		// Daemon that took it
+	int result = -1;		// What to return
+	const char *why = NULL;		// What went wrong
+	long long bad = -1;		// Offset of a bad character
+	unsigned long long at;		// Where the daemon found one
+	int code;			// Status of a streamed file
+	int fail;			// How the last daemon tried failed
+
+	snprintf(path, sizeof(path), "%s/%s", fo->fc->in_dir, f->path);
+	text_fd = open(path, O_RDONLY);
+	if (text_fd == -1)
+	{
+		why = "could not open it";
+		goto out;
+	}
+	if (length > 0 && pread(text_fd, &last_char, 1, length - 1) == 1 && last_char == '\n')
+		length--;
+
+	// Its own key file, or its slice of the pad
+	if (fo->key_fd == -1)
+	{
+		snprintf(path, sizeof(path), "%s/%s", fo->fc->key_dir, f->path);
+		key_fd = open(path, O_RDONLY);
+		if (key_fd == -1 || fstat(key_fd, &st) == -1)
+		{
+			why = "has no key";
+			goto out;
+		}
+		if ((unsigned long long)st.st_size < f->size)
+		{
+			why = "key file is too short";
+			goto out;
+		}
+	}
+	// A file longer than a chunk is streamed and the daemon checks it as
+	// it goes, a shorter one is checked here before it is sent whole
+	if (length <= STREAM_CHUNK && (bad = validRange(text_fd, 0, length, buf)) != (long long)length)
+	{
+		why = bad == -1 ? "could not be read" : "has invalid char";
+		goto out;
+	}
+	if (length <= STREAM_CHUNK && (bad = validRange(key_fd != -1 ? key_fd : fo->key_fd, key_off, length, buf)) != (long long)length)
+	{
+		why = bad == -1 ? "key could not be read" : "key has invalid char";
+		goto out;
+	}
+	bad = -1;
+
+	snprintf(path, sizeof(path), "%s/%s", fo->fc->out_dir, f->path);
+	out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out_fd == -1)
+	{
+		why = "could not open its output";
+		goto out;
+	}
+
+	if (length > STREAM_CHUNK)
+	{
+		code = clientStreamTry(fo->conf, text_fd, key_fd != -1 ? key_fd : fo->key_fd, key_off, length, out_fd, &at, &fail);
+		if (code == -1 && fail != 0)
+		{
+			why = fail == CLIENT_FAIL_BUSY ? "was refused, every daemon is busy" : "could not reach a daemon";
+			goto out;
+		}
+		if (code == STATUS_BAD_TEXT || code == STATUS_BAD_KEY)
+		{
+			why = code == STATUS_BAD_TEXT ? "has invalid char" : "key has invalid char";
+			bad = at;
+			goto out;
+		}
+		if (code != STATUS_OK || pwrite(out_fd, "\n", 1, length) != 1)
+			why = "transfer failed";
+		else
+			result = 0;
+		goto out;
+	}
+	socket_fd = clientOpen(fo->conf, length, 0, &chosen, &fail);
+	if (socket_fd == -1)
+	{
+		why = fail == CLIENT_FAIL_BUSY ? "was refused, every daemon is busy" : "could not reach a daemon";
+		goto out;
+	}
+	if (clientSendRange(socket_fd, text_fd, 0, length, buf, NULL) == -1 ||
+		clientSendRange(socket_fd, key_fd != -1 ? key_fd : fo->key_fd, key_off, length, buf, NULL) == -1 ||
+		clientRecvRange(socket_fd, out_fd, 0, length, buf, NULL) == -1 ||
+		pwrite(out_fd, "\n", 1, length) != 1)
+		why = "transfer failed";
+	else
+		result = 0;
+	close(socket_fd);
+	clientDone(fo->conf, chosen);
+
+out:
+	if (why != NULL && bad >= 0)
+		fprintf(stderr, "%s%s Error: %s/%s %s at offset %lld\n", isatty(STDERR_FILENO) ? "\n" : "",
+			prog, fo->fc->in_dir, f->path, why, bad);
+	else if (why != NULL)
+		fprintf(stderr, "%s%s Error: %s/%s %s\n", isatty(STDERR_FILENO) ? "\n" : "",
+			prog, fo->fc->in_dir, f->path, why);
+	if (text_fd != -1)
+		close(text_fd);
+	if (key_fd != -1)
+		close(key_fd);
+	if (out_fd != -1)
+		close(out_fd);
+	return result;
+}
+
+/* Function: fanWorker
+ * Parameters: the thread
+ * Overview: Sends files until every queue is empty
+ * Pre: Queues are dealt
+ * Post: Counters include every file it took
+ */
+static void *fanWorker(void *arg)
+{
+	// Set variables
+	struct fan_worker *w = arg;	// This thread
+	struct fanout *fo = w->fo;	// The run
+	char *buf;			// Piece being sent or received
+	int file;			// File taken
+
+	buf = malloc(STRIPE_BUF);
+	if (buf == NULL)
+	{
+		fprintf(stderr, "%s ERROR: out of memory\n", fo->conf->prog);
+		exit(1);
+	}
+	while ((file = takeFile(fo, w->id)) != -1)
+	{
+		if (sendOne(fo, &fo->files[file], buf) == 0)
+		{
+			__atomic_add_fetch(&fo->bytes, fo->files[file].size, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&fo->done, 1, __ATOMIC_RELAXED);
+		}
+		else
+			__atomic_add_fetch(&fo->failed, 1, __ATOMIC_RELAXED);
+	}
+	free(buf);
+	return NULL;
+}
+
+/* Function: report
+ * Parameters: the run, time it started, 1 for the last report
+ * Overview: Prints files done, bytes sent and throughput to stderr, over the
+ * 	previous report on a terminal and as a line of its own otherwise
+ * Pre: none
+ * Post: Report is printed
+ */
+static void report(struct fanout *fo, unsigned long long start, int last)
+{
+	// Set variables
+	unsigned long long ms = nowMsec() - start;	// Time running
+	double mb = __atomic_load_n(&fo->bytes, __ATOMIC_RELAXED) / 1e6;	// MB done
+	int tty = isatty(STDERR_FILENO);	// Whether to overwrite
+
+	fprintf(stderr, "%s%s: %d/%d files, %.1f MB, %.1f MB/s, %d failed%s",
+		tty ? "\r" : "", fo->conf->prog,
+		__atomic_load_n(&fo->done, __ATOMIC_RELAXED), fo->nfiles, mb,
+		ms > 0 ? mb * 1000 / ms : 0.0,
+		__atomic_load_n(&fo->failed, __ATOMIC_RELAXED),
+		!tty || last ? "\n" : "");
+}
+
+/* Function: fanoutRun
+ * Parameters: where files may go, what was asked for
+ * Overview: Walks the input directory, deals its files out to the threads,
+ * 	and reports progress until every file is done
+ * Pre: Endpoints are parsed
+ * Post: Returns 0 if every file was written, 1 if any failed
+ */
+int fanoutRun(struct client_conf *conf, struct fanout_conf *fc)
+{
+	// Set variables
+	struct fanout fo;		// The run
+	struct fan_worker workers[FANOUT_MAX_JOBS];	// The threads
+	struct stat st;			// Size of the pad
+	unsigned long long next_key = 0;	// Start of the next slice of the pad
+	unsigned long long start;	// Time it started
+	unsigned long long last;	// Time of the last report
+	int *order;			// Files, biggest first
+	struct fan_deque *d;		// Queue a file is dealt to
+	int i;				// For the loops
+
+	memset(&fo, 0, sizeof(fo));
+	fo.conf = conf;
+	fo.fc = fc;
+	fo.key_fd = -1;
+	fo.jobs = fc->jobs < 1 ? 1 : fc->jobs > FANOUT_MAX_JOBS ? FANOUT_MAX_JOBS : fc->jobs;
+
+	// Find every file, making the output tree as it goes
+	if (mkdir(fc->out_dir, 0755) == -1 && errno != EEXIST)
+	{
+		fprintf(stderr, "%s Error: could not make %s\n", conf->prog, fc->out_dir);
+		return 1;
+	}
+	walk_root = strlen(fc->in_dir);
+	walk_out = fc->out_dir;
+	if (nftw(fc->in_dir, walkEntry, 32, FTW_PHYS) == -1)
+	{
+		fprintf(stderr, "%s Error: could not read %s\n", conf->prog, fc->in_dir);
+		return 1;
+	}
+	fo.files = walk_files;
+	fo.nfiles = walk_count;
+
+	// Slices of the pad follow each other in the order of the walk
+	if (fc->key_pad != NULL)
+	{
+		for (i = 0; i < fo.nfiles; i++)
+		{
+			fo.files[i].key_off = next_key;
+			next_key += fo.files[i].size;
+		}
+		fo.key_fd = open(fc->key_pad, O_RDONLY);
+		if (fo.key_fd == -1 || fstat(fo.key_fd, &st) == -1)
+		{
+			fprintf(stderr, "Error: key file does not exist\n");
+			return 1;
+		}
+		if ((unsigned long long)st.st_size < next_key)
+		{
+			fprintf(stderr, "Error: key file is too short\n");
+			return 1;
+		}
+	}
+
+	// Deal the files out biggest first, round robin
+	order = malloc((fo.nfiles + 1) * sizeof(int));
+	if (order == NULL)
+	{
+		fprintf(stderr, "%s ERROR: out of memory\n", conf->prog);
+		return 1;
+	}
+	for (i = 0; i < fo.nfiles; i++)
+		order[i] = i;
+	qsort(order, fo.nfiles, sizeof(int), bySize);
+	for (i = 0; i < fo.jobs; i++)
+	{
+		pthread_mutex_init(&fo.deques[i].lock, NULL);
+		fo.deques[i].items = malloc((fo.nfiles / fo.jobs + 1) * sizeof(int));
+		if (fo.deques[i].items == NULL)
+		{
+			fprintf(stderr, "%s ERROR: out of memory\n", conf->prog);
+			return 1;
+		}
+	}
+	for (i = 0; i < fo.nfiles; i++)
+	{
+		d = &fo.deques[i % fo.jobs];
+		d->items[d->tail++] = order[i];
+	}
+	free(order);
+
+	// Run the threads, reporting until they are done
+	start = nowMsec();
+	for (i = 0; i < fo.jobs; i++)
+	{
+		workers[i].fo = &fo;
+		workers[i].id = i;
+		if (pthread_create(&workers[i].thread, NULL, fanWorker, &workers[i]) != 0)
+		{
+			fprintf(stderr, "%s ERROR: could not start a thread\n", conf->prog);
+			exit(1);
+		}
+	}
+	last = start;
+	while (__atomic_load_n(&fo.done, __ATOMIC_RELAXED) + __atomic_load_n(&fo.failed, __ATOMIC_RELAXED) < fo.nfiles)
+	{
+		usleep(FAN_POLL_MS * 1000);
+		if (nowMsec() - last >= FAN_TICK_MS)
+		{
+			last = nowMsec();
+			report(&fo, start, 0);
+		}
+	}
+	for (i = 0; i < fo.jobs; i++)
+		pthread_join(workers[i].thread, NULL);
+	report(&fo, start, 1);
+
+	for (i = 0; i < fo.jobs; i++)
+	{
+		free(fo.deques[i].items);
+		pthread_mutex_destroy(&fo.deques[i].lock);
+	}
+	for (i = 0; i < fo.nfiles; i++)
+		free(fo.files[i].path);
+	free(fo.files);
+	if (fo.key_fd != -1)
+		close(fo.key_fd);
+	return fo.failed > 0 ? 1 : 0;
+}
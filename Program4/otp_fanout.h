@@ -0,0 +1,34 @@
+/*
+ * File otp_fanout.h
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Directory mode of otp_enc and otp_dec.  Every file under the
+ * 	input directory is sent to a daemon and its result written to the
+ * 	same path under the output directory, with several connections going
+ * 	at once from one process.  A file's key is either the file of the same
+ * 	path under a key directory or its own slice of one shared pad, slices
+ * 	never overlapping.
+ * Last Update: 06/03/2016
+ */
+
+#ifndef OTP_FANOUT_H
+#define OTP_FANOUT_H
+
+#include "otp_client.h"
+
+#define FANOUT_MAX_JOBS	64	// Connections going at once
+
+/* What directory mode was asked to do */
+struct fanout_conf
+{
+	const char *in_dir;		// Files to send (--dir)
+	const char *key_dir;		// Key of each file by path (--key-dir), or NULL
+	const char *key_pad;		// One pad sliced between the files (--key), or NULL
+	const char *out_dir;		// Where results go (--out)
+	int jobs;			// Connections going at once (-j)
+};
+
+int fanoutRun(struct client_conf *conf, struct fanout_conf *fc);
+
+#endif
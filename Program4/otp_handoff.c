@@ -0,0 +1,262 @@
+/*
+ * File otp_handoff.c
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Passing the listening socket from a running daemon to the one
+ * 	replacing it.  The new daemon connects to the restart socket and
+ * 	sends its tag and port.  The old daemon answers REPLY_GO with the
+ * 	listening socket attached as SCM_RIGHTS when they are its own, and
+ * 	REPLY_WRONG otherwise, so an otp_dec_d can't take the port of an
+ * 	otp_enc_d by mistake.  The new daemon confirms with REPLY_GO once it
+ * 	holds the socket, and only then does the old one stop accepting.
+ * 	Until then both hold the same socket, and clients waiting in its
+ * 	accept queue go to whichever accepts first.  Only a process of the
+ * 	same user, or root, is answered at all.
+ * 	The old daemon waits at most HANDOFF_WAIT_MS for the request, a
+ * 	stall it only risks from a local process of its own user.
+ * Last Update: 06/03/2016
+ * Sources: unix(7) and cmsg(3), passing file descriptors with SCM_RIGHTS
+ */
+
+// Include Libraries
+#define _GNU_SOURCE	// struct ucred and accept4
+#include <stdio.h>	// General IO, including printf to redirect files
+#include <stdlib.h>	// General purpose functions
+#include <string.h>	// Manipulation of C strings and arrays
+#include <errno.h>	// Telling a missing daemon from a failure
+#include <stdint.h>	// Port in the request
+#include <unistd.h>	// Provides access to the POSIX API
+#include <sys/stat.h>	// Restricting the restart socket to its user
+#include <sys/time.h>	// Receive timeout
+#include <sys/socket.h>	// Makes available for the use of sockets
+#include <sys/un.h>	// Unix socket addresses
+#include <arpa/inet.h>	// Byte order of the port
+#include "otp_handoff.h"
+#include "otp_proto.h"
+
+#define HANDOFF_WAIT_MS	1000	// Longest wait for the other side
+
+/* What the new daemon asks for */
+struct handoff_req
+{
+	char tag[4];		// "enc" or "dec", null padded
+	uint32_t port;		// Port it was started on, network order
+};
+
+/* Function: handoffAddr
+ * Parameters: path of the restart socket, address to fill in, program name
+ * Overview: Fills in the Unix address of the restart socket
+ * Pre: none
+ * Post: addr is filled in, exits with 1 when the path is too long
+ */
+static void handoffAddr(const char *path, struct sockaddr_un *addr, const char *prog)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path))
+	{
+		fprintf(stderr, "%s ERROR: Restart socket path is too long\n", prog);
+		exit(1);
+	}
+	strcpy(addr->sun_path, path);
+}
+
+/* Function: handoffTimeout
+ * Parameters: socket
+ * Overview: Bounds every blocking send and receive on a handoff connection
+ * Pre: none
+ * Post: Socket times out after HANDOFF_WAIT_MS
+ */
+static void handoffTimeout(int fd)
+{
+	// Set variables
+	struct timeval tv;	// The timeout
+
+	tv.tv_sec = HANDOFF_WAIT_MS / 1000;
+	tv.tv_usec = HANDOFF_WAIT_MS % 1000 * 1000;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/* Function: handoffFetch
+ * Parameters: path of the restart socket, tag, port, program name
+ * Overview: Asks the daemon on the restart socket for its listening socket
+ * Pre: none
+ * Post: Returns the listening socket, now shared with the old daemon, or
+ * 	-1 when no daemon is on the restart socket.  Exits with 1 when one is
+ * 	there but won't hand it over.
+ */
+int handoffFetch(const char *path, const char *tag, int port, const char *prog)
+{
+	// Set variables
+	struct sockaddr_un addr;	// Restart socket address
+	struct handoff_req req;		// Tag and port
+	struct msghdr msg;		// Reply with the socket attached
+	struct iovec iov;		// The reply byte
+	struct cmsghdr *cmsg;		// The attached socket
+	char ctrl[CMSG_SPACE(sizeof(int))];	// Room for it
+	char reply = 0;			// REPLY_GO or REPLY_WRONG
+	int listen_fd = -1;		// The listening socket
+	int accepting = 0;		// SO_ACCEPTCONN of it
+	socklen_t len = sizeof(accepting);	// Size of that option
+	int fd;				// Connection to the old daemon
+
+	handoffAddr(path, &addr, prog);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+	{
+		fprintf(stderr, "%s ERROR: Failed to setup restart socket\n", prog);
+		exit(1);
+	}
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+	{
+		close(fd);
+		// No socket, or one left behind by a daemon that is gone
+		if (errno == ENOENT || errno == ECONNREFUSED)
+			return -1;
+		fprintf(stderr, "%s ERROR: Failed to connect to restart socket\n", prog);
+		exit(1);
+	}
+	handoffTimeout(fd);
+
+	memset(&req, 0, sizeof(req));
+	strncpy(req.tag, tag, sizeof(req.tag) - 1);
+	req.port = htonl(port);
+	if (send(fd, &req, sizeof(req), MSG_NOSIGNAL) != sizeof(req))
+	{
+		fprintf(stderr, "%s ERROR: Failed to ask for the listening socket\n", prog);
+		exit(1);
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &reply;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl;
+	msg.msg_controllen = sizeof(ctrl);
+	if (recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) == 1)
+	{
+		cmsg = CMSG_FIRSTHDR(&msg);
+		if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(&listen_fd, CMSG_DATA(cmsg), sizeof(int));
+	}
+	if (reply != REPLY_GO || listen_fd == -1 ||
+		getsockopt(listen_fd, SOL_SOCKET, SO_ACCEPTCONN, &accepting, &len) == -1 || !accepting)
+	{
+		fprintf(stderr, "%s ERROR: Daemon on the restart socket did not hand over port %d\n", prog, port);
+		exit(1);
+	}
+	// Tell the old daemon it may stop accepting
+	if (send(fd, &reply, 1, MSG_NOSIGNAL) != 1)
+	{
+		fprintf(stderr, "%s ERROR: Failed to confirm the listening socket\n", prog);
+		exit(1);
+	}
+	close(fd);
+	return listen_fd;
+}
+
+/* Function: handoffListen
+ * Parameters: path of the restart socket, program name
+ * Overview: Takes over the restart socket path, replacing what is there,
+ * 	so the next daemon can find this one
+ * Pre: handoffFetch was tried first
+ * Post: Returns the non-blocking listening Unix socket, exits on failure
+ */
+int handoffListen(const char *path, const char *prog)
+{
+	// Set variables
+	struct sockaddr_un addr;	// Restart socket address
+	int fd;				// The socket
+
+	handoffAddr(path, &addr, prog);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1)
+	{
+		fprintf(stderr, "%s ERROR: Failed to setup restart socket\n", prog);
+		exit(1);
+	}
+	// The old daemon keeps its socket open but can't be reached by path
+	// any more, which is what it is leaving anyway
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || chmod(path, S_IRUSR | S_IWUSR) == -1)
+	{
+		fprintf(stderr, "%s ERROR: Failed to bind restart socket\n", prog);
+		exit(1);
+	}
+	if (listen(fd, 4) == -1)
+	{
+		fprintf(stderr, "%s ERROR: Failed at listening on restart socket\n", prog);
+		exit(1);
+	}
+	return fd;
+}
+
+/* Function: handoffServe
+ * Parameters: restart socket, listening socket, tag, port, program name
+ * Overview: Answers a daemon asking for the listening socket
+ * Pre: Restart socket is readable
+ * Post: Returns 0 when the listening socket was handed over, the caller
+ * 	must stop accepting.  Returns -1 when it wasn't, nothing changes.
+ */
+int handoffServe(int handoff_fd, int listen_fd, const char *tag, int port, const char *prog)
+{
+	// Set variables
+	struct handoff_req req;		// Tag and port asked for
+	struct ucred cred;		// Who is asking
+	socklen_t len = sizeof(cred);	// Size of that
+	struct msghdr msg;		// Reply with the socket attached
+	struct iovec iov;		// The reply byte
+	struct cmsghdr *cmsg;		// The attached socket
+	char ctrl[CMSG_SPACE(sizeof(int))];	// Room for it
+	char reply = REPLY_GO;		// Answer
+	int fd;				// Connection of the new daemon
+
+	fd = accept4(handoff_fd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1 || (cred.uid != getuid() && cred.uid != 0))
+	{
+		fprintf(stderr, "%s ERROR: Restart socket refused a process of another user\n", prog);
+		close(fd);
+		return -1;
+	}
+	handoffTimeout(fd);
+	if (recv(fd, &req, sizeof(req), MSG_WAITALL) != sizeof(req))
+	{
+		close(fd);
+		return -1;
+	}
+	if (req.tag[3] != 0 || strcmp(req.tag, tag) != 0 || ntohl(req.port) != (uint32_t)port)
+	{
+		reply = REPLY_WRONG;
+		if (send(fd, &reply, 1, MSG_NOSIGNAL) < 0)
+		{
+			// The other daemon is gone, it will say so itself
+		}
+		close(fd);
+		return -1;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	memset(ctrl, 0, sizeof(ctrl));
+	iov.iov_base = &reply;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl;
+	msg.msg_controllen = sizeof(ctrl);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &listen_fd, sizeof(int));
+	// Keep accepting until the new daemon confirms it has the socket
+	if (sendmsg(fd, &msg, MSG_NOSIGNAL) != 1 || recv(fd, &reply, 1, 0) != 1 || reply != REPLY_GO)
+	{
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	return 0;
+}
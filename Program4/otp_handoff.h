@@ -0,0 +1,22 @@
+/*
+ * File otp_handoff.h
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Hot restart of a daemon.  A daemon started with a restart
+ * 	socket listens on that Unix socket as well as on its port.  A new
+ * 	daemon started with the same restart socket connects to it first and
+ * 	is passed the listening socket of the old one, so the port is never
+ * 	closed and no client waiting in the accept queue is lost.  The old
+ * 	daemon then stops accepting and exits once its requests are done.
+ * Last Update: 06/03/2016
+ */
+
+#ifndef OTP_HANDOFF_H
+#define OTP_HANDOFF_H
+
+int handoffFetch(const char *path, const char *tag, int port, const char *prog);
+int handoffListen(const char *path, const char *prog);
+int handoffServe(int handoff_fd, int listen_fd, const char *tag, int port, const char *prog);
+
+#endif
@@ -0,0 +1,370 @@
+/*
+ * File otp_io.c
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Deadline bound socket I/O for the daemon workers.  The socket
+ * 	is non-blocking and every wait is a poll that ends at the sooner of
+ * 	the phase deadline and the stall limit, so no client can hold a
+ * 	worker longer than its phase allows.
+ * 	Results go out with sendmsg, a status and its result in one call and
+ * 	a long result in segments of IO_SEGMENT.  A send of IO_ZEROCOPY_MIN
+ * 	bytes or more asks for MSG_ZEROCOPY, so the kernel sends straight
+ * 	from the result pages instead of copying them.  The kernel tells
+ * 	when it is done with the pages on the socket's error queue, and
+ * 	ioSendv doesn't return before every such send is reported done, so
+ * 	the caller may reuse or reset the buffer right away.  A kernel that
+ * 	has to copy anyway, as it does over loopback, says so in the report
+ * 	and the worker stops asking.
+ * Last Update: 06/03/2016
+ * Sources: msg_zerocopy - https://www.kernel.org/doc/html/latest/networking/msg_zerocopy.html
+ */
+
+// Include Libraries
+#include <errno.h>	// Checking results of non-blocking calls
+#include <time.h>	// Monotonic clock for deadlines
+#include <poll.h>	// Waiting on the socket
+#include <fcntl.h>	// Non-blocking socket
+#include <unistd.h>	// close
+#include <string.h>	// memset of the message header
+#include <sys/socket.h>	// send, recv and SO_LINGER
+#include <netinet/in.h>	// IP_RECVERR messages of the error queue
+#include <linux/errqueue.h>	// Zero copy reports
+#include "otp_metrics.h"
+#include "otp_io.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY	60	// Older headers lack it
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY	0x4000000	// Older headers lack it
+#endif
+
+static int io_grace_ms = 5000;			// Stall limit and slack of every phase
+static unsigned long long io_min_rate = 1024;	// Bytes per second a client must keep up
+static int io_zerocopy = 1;			// Zero copy is worth asking for
+
+/* Function: ioNow
+ * Parameters: none
+ * Overview: Reads the monotonic clock
+ * Pre: none
+ * Post: Returns the time in milliseconds
+ */
+static unsigned long long ioNow(void)
+{
+	// Set variables
+	struct timespec ts;		// Current time
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Function: ioLimits
+ * Parameters: grace period in ms, minimum rate in bytes per second
+ * Overview: Sets the limits every phase is held to
+ * Pre: none
+ * Post: Phases started after this use the new limits
+ */
+void ioLimits(int grace_ms, unsigned long long min_rate)
+{
+	io_grace_ms = grace_ms;
+	io_min_rate = min_rate;
+}
+
+/* Function: ioPhase
+ * Parameters: phase, name, bytes the phase moves
+ * Overview: Starts a phase and works out its deadline
+ * Pre: none
+ * Post: Phase is ready for ioRecv or ioSend
+ */
+void ioPhase(struct io_phase *p, const char *name, unsigned long long total)
+{
+	p->name = name;
+	p->start = ioNow();
+	p->deadline = p->start + io_grace_ms;
+	if (io_min_rate > 0)
+		p->deadline += total * 1000 / io_min_rate;
+	p->done = 0;
+	p->total = total;
+}
+
+/* Function: ioWait
+ * Parameters: socket, poll events, phase
+ * Overview: Waits until the socket is ready, the stall limit passes or the
+ * 	phase deadline passes
+ * Pre: Socket is non-blocking
+ * Post: Returns 0 when ready, -1 with errno ETIMEDOUT when out of time
+ */
+static int ioWait(int fd, short events, struct io_phase *p)
+{
+	// Set variables
+	struct pollfd pfd;		// The socket
+	unsigned long long now;		// Current time
+	unsigned long long wait;	// Longest poll
+	int n;				// Result of poll
+
+	pfd.fd = fd;
+	pfd.events = events;
+	while ((now = ioNow()) < p->deadline)
+	{
+		wait = p->deadline - now < (unsigned long long)io_grace_ms ? p->deadline - now : (unsigned long long)io_grace_ms;
+		n = poll(&pfd, 1, (int)wait);
+		if (n == 1)
+			return 0;
+		// No progress for a whole grace period
+		if (n == 0 && wait == (unsigned long long)io_grace_ms)
+			break;
+		if (n == -1 && errno != EINTR)
+			return -1;
+	}
+	metricsEmit("io_timeout phase=%s bytes=%llu of=%llu elapsed_ms=%llu",
+		p->name, p->done, p->total, ioNow() - p->start);
+	errno = ETIMEDOUT;
+	return -1;
+}
+
+/* Function: ioRecv
+ * Parameters: socket, buffer, bytes wanted, phase
+ * Overview: Receives exactly length bytes within the phase's deadline
+ * Pre: Phase was started with ioPhase
+ * Post: Returns 0 when everything arrived, -1 on time out, error or hang up
+ */
+int ioRecv(int fd, char *buf, size_t length, struct io_phase *p)
+{
+	// Set variables
+	size_t got = 0;		// Bytes received so far
+	ssize_t n;		// Result of recv
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	while (got < length)
+	{
+		n = recv(fd, buf + got, length - got, 0);
+		if (n > 0)
+		{
+			got += n;
+			p->done += n;
+			continue;
+		}
+		if (n == 0)
+			return -1;
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			return -1;
+		if (ioWait(fd, POLLIN, p) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+/* Function: ioZeroCopyReap
+ * Parameters: socket, zero copy sends reported done so far
+ * Overview: Reads the reports of finished zero copy sends off the error
+ * 	queue.  Each report covers a range of sends, numbered from 0 in the
+ * 	order they were made on the socket.
+ * Pre: Socket has SO_ZEROCOPY on
+ * Post: done counts every report read.  Returns 0, or -1 when the error
+ * 	queue held something else.
+ */
+static int ioZeroCopyReap(int fd, unsigned int *done)
+{
+	// Set variables
+	char control[128];		// Room for a report
+	struct msghdr msg;		// Header to read a report into
+	struct cmsghdr *cm;		// The report
+	struct sock_extended_err *err;	// What it says
+
+	while (1)
+	{
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+		for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm))
+		{
+			if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+				!(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+				continue;
+			err = (struct sock_extended_err *)CMSG_DATA(cm);
+			if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				return -1;
+			*done += err->ee_data - err->ee_info + 1;
+			// The kernel copied after all, asking again only costs the reports
+			if ((err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) && io_zerocopy)
+			{
+				io_zerocopy = 0;
+				metricsEmit("zerocopy off reason=copied");
+			}
+		}
+	}
+}
+
+/* Function: ioZeroCopyWait
+ * Parameters: socket, zero copy sends made, phase
+ * Overview: Waits until the kernel reports every zero copy send done
+ * Pre: sent zero copy sends were made on the socket by this call of ioSendv
+ * Post: Returns 0 when the buffers are free, -1 on time out or error
+ */
+static int ioZeroCopyWait(int fd, unsigned int sent, struct io_phase *p)
+{
+	// Set variables
+	unsigned int done = 0;		// Sends reported done
+	struct pollfd pfd;		// The socket, the error queue shows as POLLERR
+	unsigned long long now;		// Current time
+	int soerr = 0;			// Error of the connection
+	socklen_t len = sizeof(soerr);	// Size of it
+	int n;				// Result of poll
+
+	pfd.fd = fd;
+	pfd.events = 0;
+	pfd.revents = 0;
+	while (1)
+	{
+		if (ioZeroCopyReap(fd, &done) == -1)
+			return -1;
+		if (done >= sent)
+			return 0;
+		// Reports left behind by a hang up were just read, no more come
+		if (pfd.revents & (POLLHUP | POLLNVAL))
+			return -1;
+		// POLLERR with nothing to read is an error on the connection
+		if ((pfd.revents & POLLERR) && getsockopt(fd, SOL_SOCKET, SO_ERROR, &soerr, &len) == 0 && soerr != 0)
+			return -1;
+		if ((now = ioNow()) >= p->deadline)
+			break;
+		n = poll(&pfd, 1, (int)(p->deadline - now));
+		if (n == -1 && errno != EINTR)
+			return -1;
+	}
+	metricsEmit("io_timeout phase=%s bytes=%llu of=%llu elapsed_ms=%llu",
+		p->name, p->done, p->total, ioNow() - p->start);
+	errno = ETIMEDOUT;
+	return -1;
+}
+
+/* Function: ioSendv
+ * Parameters: socket, pieces to send, number of pieces, phase
+ * Overview: Sends every piece, in order, within the phase's deadline.
+ * 	Each sendmsg takes up to IO_SEGMENT bytes of the pieces, with
+ * 	MSG_ZEROCOPY once that is IO_ZEROCOPY_MIN or more.
+ * Pre: Phase was started with ioPhase.  iov may be changed.
+ * Post: Returns 0 when everything is out and the kernel is done with the
+ * 	buffers, -1 on time out or error
+ */
+int ioSendv(int fd, struct iovec *iov, int iovcnt, struct io_phase *p)
+{
+	// Set variables
+	struct msghdr msg;		// The pieces left
+	struct iovec *end = iov + iovcnt;	// Past the last piece
+	struct iovec *last;		// Last piece of the segment
+	size_t seg;			// Bytes of the segment
+	size_t keep;			// Bytes of the last piece left out of it
+	unsigned int zc_sent = 0;	// Zero copy sends made
+	int on = 1;			// Turns SO_ZEROCOPY on
+	int flags;			// Flags of the send
+	ssize_t n;			// Result of sendmsg
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	while (iov < end)
+	{
+		if (iov->iov_len == 0)
+		{
+			iov++;
+			continue;
+		}
+		// Take whole pieces up to IO_SEGMENT, cutting the last one short
+		seg = 0;
+		for (last = iov; last < end && seg + last->iov_len < IO_SEGMENT; last++)
+			seg += last->iov_len;
+		keep = 0;
+		if (last < end)
+		{
+			keep = last->iov_len - (IO_SEGMENT - seg);
+			last->iov_len -= keep;
+			seg = IO_SEGMENT;
+			last++;
+		}
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = last - iov;
+
+		flags = MSG_NOSIGNAL;
+		if (seg >= IO_ZEROCOPY_MIN && io_zerocopy)
+		{
+			if (zc_sent == 0 && setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == -1)
+				io_zerocopy = 0;
+			else
+				flags |= MSG_ZEROCOPY;
+		}
+		n = sendmsg(fd, &msg, flags);
+		// Out of room to pin pages, this one goes the usual way
+		if (n == -1 && errno == ENOBUFS && (flags & MSG_ZEROCOPY))
+		{
+			flags &= ~MSG_ZEROCOPY;
+			n = sendmsg(fd, &msg, flags);
+		}
+		if (keep > 0)
+			last[-1].iov_len += keep;
+		if (n > 0)
+		{
+			if (flags & MSG_ZEROCOPY)
+				zc_sent++;
+			p->done += n;
+			// Step over what went out
+			while (n > 0 && (size_t)n >= iov->iov_len)
+			{
+				n -= iov->iov_len;
+				iov++;
+			}
+			if (n > 0)
+			{
+				iov->iov_base = (char *)iov->iov_base + n;
+				iov->iov_len -= n;
+			}
+			continue;
+		}
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+			return -1;
+		if (ioWait(fd, POLLOUT, p) == -1)
+			return -1;
+	}
+	if (zc_sent > 0)
+		return ioZeroCopyWait(fd, zc_sent, p);
+	return 0;
+}
+
+/* Function: ioSend
+ * Parameters: socket, buffer, bytes to send, phase
+ * Overview: Sends exactly length bytes within the phase's deadline
+ * Pre: Phase was started with ioPhase
+ * Post: Returns 0 when everything is out and the buffer is free again, -1
+ * 	on time out or error
+ */
+int ioSend(int fd, const char *buf, size_t length, struct io_phase *p)
+{
+	// Set variables
+	struct iovec iov;		// The one piece
+
+	iov.iov_base = (char *)buf;
+	iov.iov_len = length;
+	return ioSendv(fd, &iov, 1, p);
+}
+
+/* Function: ioAbort
+ * Parameters: socket
+ * Overview: Drops a client with a reset, so nothing it left unread is kept
+ * 	around and the connection doesn't linger
+ * Pre: none
+ * Post: Socket is closed
+ */
+void ioAbort(int fd)
+{
+	// Set variables
+	struct linger off = {1, 0};	// Close right away with a reset
+
+	setsockopt(fd, SOL_SOCKET, SO_LINGER, &off, sizeof(off));
+	close(fd);
+}
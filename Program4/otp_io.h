@@ -0,0 +1,41 @@
+/*
+ * File otp_io.h
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Deadline bound socket I/O for the daemon workers.  A request
+ * 	moves through phases (upload of text and key, download of the
+ * 	result) and each phase has a deadline of a grace period plus the time
+ * 	its bytes take at the minimum transfer rate.  A phase that stalls for
+ * 	the grace period or misses its deadline fails, and the worker drops
+ * 	the client with a reset instead of waiting on it.
+ * Last Update: 06/03/2016
+ */
+
+#ifndef OTP_IO_H
+#define OTP_IO_H
+
+#include <stddef.h>	// size_t
+#include <sys/uio.h>	// struct iovec
+
+#define IO_SEGMENT	(4 << 20)	// Most bytes one sendmsg is given
+#define IO_ZEROCOPY_MIN	(64 << 10)	// Smallest send worth MSG_ZEROCOPY
+
+/* One phase of a request */
+struct io_phase
+{
+	const char *name;		// "upload" or "download" for the metrics log
+	unsigned long long start;	// Time the phase started in ms
+	unsigned long long deadline;	// Time the phase must be done by in ms
+	unsigned long long done;	// Bytes moved so far
+	unsigned long long total;	// Bytes the phase moves
+};
+
+void ioLimits(int grace_ms, unsigned long long min_rate);
+void ioPhase(struct io_phase *p, const char *name, unsigned long long total);
+int ioRecv(int fd, char *buf, size_t length, struct io_phase *p);
+int ioSend(int fd, const char *buf, size_t length, struct io_phase *p);
+int ioSendv(int fd, struct iovec *iov, int iovcnt, struct io_phase *p);
+void ioAbort(int fd);
+
+#endif
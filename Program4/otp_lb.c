@@ -0,0 +1,805 @@
+/*
+ * File otp_lb.c
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Proxy in front of a pool of otp_enc_d or otp_dec_d daemons for
+ * 	clients that only know one port.  It speaks the daemon's side of the
+ * 	hello, hands each connection to the backend with the fewest
+ * 	connections, and if that backend answers 'M' offers the same hello to
+ * 	the next one.  Once a backend says 'S' the proxy only relays bytes,
+ * 	moving them socket to pipe to socket with splice so they are never
+ * 	copied into the proxy.  Backends are probed with a connect every
+ * 	health interval and skipped while they are down.  Everything runs in
+ * 	one process around epoll.
+ * Last Update: 06/03/2016
+ * Sources: Operating Systems Lectures 15, 16, and 17.
+ *   Beej's Guide to Network Programming - http://beej.us/guide/bgnet/output/html/singlepage/bgnet.html
+ *   splice(2) - http://man7.org/linux/man-pages/man2/splice.2.html
+ */
+
+// Include Libraries
+#define _GNU_SOURCE	// splice, accept4 and pipe2
+#include <stdio.h>	// General IO, including printf to redirect files
+#include <stdlib.h>	// General purpose functions
+#include <string.h>	// Manipulation of C strings and arrays
+#include <errno.h>	// Checking results of non-blocking calls
+#include <signal.h>	// Ignore SIGPIPE from peers that hang up
+#include <time.h>	// Monotonic clock for health checks
+#include <fcntl.h>	// Non-blocking sockets and pipe sizes
+#include <unistd.h>	// Provides access to the POSIX API
+#include <sys/socket.h>	// Makes available for the use of sockets
+#include <sys/epoll.h>	// Waiting on every connection at once
+#include <netinet/in.h>	// Makes available access to network addresses
+#include <netinet/tcp.h>	// TCP_NODELAY
+#include <arpa/inet.h>	// Makes available ports
+#include "otp_client.h"
+#include "otp_metrics.h"
+#include "otp_proto.h"
+
+// States of a proxied connection
+#define LB_HELLO	0	// Reading the hello from the client
+#define LB_CONNECT	1	// Connecting to a backend
+#define LB_REPLY	2	// Sent the hello, waiting for the backend's reply
+#define LB_RELAY	3	// Relaying bytes both ways
+#define LB_DEAD		4	// Closed, freed once the current events are handled
+
+// What an epoll handle belongs to
+#define SIDE_CLIENT	0	// Client socket of a connection
+#define SIDE_BACKEND	1	// Backend socket of a connection
+#define SIDE_PROBE	2	// Health check of a backend
+#define SIDE_LISTEN	3	// Listening socket
+
+#define PIPE_CAP	65536	// Bytes a relay pipe holds
+#define HELLO_MS	5000	// Longest wait for a client's hello
+#define CONNECT_MS	1000	// Longest wait for a backend's connect
+#define REPLY_MS	10000	// Longest wait for a backend's reply, past its queue wait
+
+struct lb_conn;
+
+/* What an epoll event points at */
+struct lb_handle
+{
+	int side;			// One of the SIDE_ values
+	struct lb_conn *conn;		// Connection, NULL for a probe or listener
+	int backend;			// Backend of a probe
+};
+
+/* One direction of a relay */
+struct relay
+{
+	int pipe[2];			// Bytes on their way, read end first
+	size_t queued;			// Bytes sitting in the pipe
+	int eof;			// The sending side hung up
+	int shut;			// The receiving side was told
+};
+
+/* A client connection and the backend it went to */
+struct lb_conn
+{
+	int state;			// One of the LB_ states
+	int client_fd;			// Client socket
+	int backend_fd;			// Backend socket, -1 if none
+	int backend;			// Backend in use, -1 if none
+	char tried[CLIENT_MAX_ENDPOINTS];	// Backends offered the hello
+	char last_reply;		// Reply to pass on if every backend fails
+	struct otp_hello hello;		// The client's hello
+	int got;			// Bytes of hello read so far
+	unsigned long long accepted;	// Time of accept in ms
+	unsigned long long since;	// Time the backend connect or reply wait began in ms
+	struct relay up;		// Client to backend
+	struct relay down;		// Backend to client
+	struct lb_handle hc;		// Handle of the client socket
+	struct lb_handle hb;		// Handle of the backend socket
+	unsigned int ev_client;		// Events asked for on the client socket
+	unsigned int ev_backend;	// Events asked for on the backend socket
+	struct lb_conn *next;		// Next connection in the list
+	struct lb_conn *prev;		// Connection before it
+};
+
+/* A backend daemon */
+struct backend
+{
+	struct client_endpoint *ep;	// Its address
+	int active;			// Connections going to it
+	int healthy;			// Last health check passed
+	int probe_fd;			// Health check in progress, -1 if none
+	struct lb_handle hp;		// Handle of the health check
+	unsigned long long served;	// Connections relayed
+};
+
+/* Everything the proxy keeps track of */
+struct lb
+{
+	int ep;				// epoll descriptor
+	struct client_conf conf;	// Backend list
+	struct backend backends[CLIENT_MAX_ENDPOINTS];	// Backends
+	int count;			// Number of backends
+	int rotate;			// Where ties between backends start
+	struct lb_conn *conns;		// Every connection
+	struct lb_conn *dead;		// Connections closed during this round of events
+	int health_ms;			// Time between health checks
+	unsigned long long next_health;	// Time of the next health check
+};
+
+/* Function: nowMsec
+ * Parameters: none
+ * Overview: Reads the monotonic clock
+ * Pre: none
+ * Post: Returns the time in milliseconds
+ */
+static unsigned long long nowMsec(void)
+{
+	// Set variables
+	struct timespec ts;		// Current time
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Function: watch
+ * Parameters: proxy, socket, handle, events wanted, events asked for so far
+ * Overview: Keeps the epoll registration of a socket up to date
+ * Pre: Socket is open
+ * Post: epoll reports the wanted events for the socket
+ */
+static void watch(struct lb *lb, int fd, struct lb_handle *h, unsigned int want, unsigned int *have)
+{
+	// Set variables
+	struct epoll_event ev;		// Registration
+
+	if (want == *have)
+		return;
+	ev.events = want;
+	ev.data.ptr = h;
+	epoll_ctl(lb->ep, EPOLL_CTL_MOD, fd, &ev);
+	*have = want;
+}
+
+/* Function: setHealth
+ * Parameters: proxy, backend, 1 if it is up
+ * Overview: Records the health of a backend, logging any change
+ * Pre: none
+ * Post: Backend is marked
+ */
+static void setHealth(struct lb *lb, int b, int healthy)
+{
+	if (lb->backends[b].healthy != healthy)
+		metricsEmit("lb_backend name=%s healthy=%d active=%d served=%llu", lb->backends[b].ep->name,
+			healthy, lb->backends[b].active, lb->backends[b].served);
+	lb->backends[b].healthy = healthy;
+}
+
+/* Function: closeConn
+ * Parameters: proxy, connection
+ * Overview: Closes both sockets and the pipes of a connection.  The memory
+ * 	is kept until the round of events is over, since a later event of the
+ * 	same round may still point at it.
+ * Pre: Connection is in the list
+ * Post: Connection is dead and on the dead list
+ */
+static void closeConn(struct lb *lb, struct lb_conn *c)
+{
+	close(c->client_fd);
+	if (c->backend_fd != -1)
+		close(c->backend_fd);
+	if (c->backend != -1)
+		lb->backends[c->backend].active--;
+	if (c->up.pipe[0] != -1)
+	{
+		close(c->up.pipe[0]);
+		close(c->up.pipe[1]);
+		close(c->down.pipe[0]);
+		close(c->down.pipe[1]);
+	}
+	if (c->prev == NULL)
+		lb->conns = c->next;
+	else
+		c->prev->next = c->next;
+	if (c->next != NULL)
+		c->next->prev = c->prev;
+	c->state = LB_DEAD;
+	c->next = lb->dead;
+	lb->dead = c;
+}
+
+/* Function: pickBackend
+ * Parameters: proxy, connection
+ * Overview: Least connections among the healthy backends this connection
+ * 	hasn't tried, ties going round robin.  If every untried backend is
+ * 	down they are all candidates.
+ * Pre: none
+ * Post: Returns the backend, -1 when all have been tried
+ */
+static int pickBackend(struct lb *lb, struct lb_conn *c)
+{
+	// Set variables
+	int best = -1;		// Backend with the fewest connections
+	int pass;		// 0 for healthy only, 1 for any
+	int i;			// For the loop
+	int b;			// Backend being checked
+
+	for (pass = 0; pass < 2 && best == -1; pass++)
+	{
+		for (i = 0; i < lb->count; i++)
+		{
+			b = (lb->rotate + i) % lb->count;
+			if (c->tried[b] || (pass == 0 && !lb->backends[b].healthy))
+				continue;
+			if (best == -1 || lb->backends[b].active < lb->backends[best].active)
+				best = b;
+		}
+	}
+	lb->rotate = (lb->rotate + 1) % lb->count;
+	return best;
+}
+
+/* Function: startBackend
+ * Parameters: proxy, connection
+ * Overview: Starts a connect to the next backend.  When none is left the
+ * 	client gets the last reply seen, 'M' if there was none.
+ * Pre: Hello is complete and no backend socket is open
+ * Post: Connect is under way, or the connection is closed
+ */
+static void startBackend(struct lb *lb, struct lb_conn *c)
+{
+	// Set variables
+	struct epoll_event ev;		// Registration
+	int b;				// Backend picked
+	int fd;				// Its socket
+	int one = 1;			// For TCP_NODELAY
+
+	while ((b = pickBackend(lb, c)) != -1)
+	{
+		c->tried[b] = 1;
+		fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		if (fd == -1)
+			break;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if (connect(fd, (struct sockaddr *)&lb->backends[b].ep->addr, sizeof(struct sockaddr_in)) == -1 &&
+			errno != EINPROGRESS)
+		{
+			close(fd);
+			setHealth(lb, b, 0);
+			continue;
+		}
+		c->backend_fd = fd;
+		c->backend = b;
+		lb->backends[b].active++;
+		c->state = LB_CONNECT;
+		c->since = nowMsec();
+		c->ev_backend = EPOLLOUT;
+		ev.events = EPOLLOUT;
+		ev.data.ptr = &c->hb;
+		epoll_ctl(lb->ep, EPOLL_CTL_ADD, fd, &ev);
+		return;
+	}
+
+	// Nobody took it
+	if (send(c->client_fd, &c->last_reply, 1, MSG_NOSIGNAL | MSG_DONTWAIT) < 0)
+	{
+		// The client is gone, nothing more to tell it
+	}
+	closeConn(lb, c);
+}
+
+/* Function: dropBackend
+ * Parameters: proxy, connection, 1 if the backend failed rather than
+ * 	being busy
+ * Overview: Lets go of a backend that didn't take the hello and tries the
+ * 	next one
+ * Pre: A backend socket is open
+ * Post: Next backend is being tried, or the connection is closed
+ */
+static void dropBackend(struct lb *lb, struct lb_conn *c, int failed)
+{
+	if (failed)
+		setHealth(lb, c->backend, 0);
+	close(c->backend_fd);
+	lb->backends[c->backend].active--;
+	c->backend_fd = -1;
+	c->backend = -1;
+	startBackend(lb, c);
+}
+
+/* Function: pumpOne
+ * Parameters: direction, socket it comes from, socket it goes to
+ * Overview: Moves what it can from one socket through the pipe to the
+ * 	other, and passes a hang up along once the pipe is empty
+ * Pre: Pipes are set up
+ * Post: Returns 1 if anything moved, 0 if not, -1 on a socket error
+ */
+static int pumpOne(struct relay *r, int from, int to)
+{
+	// Set variables
+	ssize_t n;		// Result of splice
+	int moved = 0;		// Anything happened
+
+	if (!r->eof && r->queued < PIPE_CAP)
+	{
+		n = splice(from, NULL, r->pipe[1], NULL, PIPE_CAP - r->queued, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n > 0)
+		{
+			r->queued += n;
+			moved = 1;
+		}
+		else if (n == 0)
+		{
+			r->eof = 1;
+			moved = 1;
+		}
+		else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			return -1;
+	}
+	if (r->queued > 0)
+	{
+		n = splice(r->pipe[0], NULL, to, NULL, r->queued, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n > 0)
+		{
+			r->queued -= n;
+			moved = 1;
+		}
+		else if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			return -1;
+	}
+	if (r->eof && r->queued == 0 && !r->shut)
+	{
+		shutdown(to, SHUT_WR);
+		r->shut = 1;
+		moved = 1;
+	}
+	return moved;
+}
+
+/* Function: pump
+ * Parameters: proxy, connection
+ * Overview: Relays both ways until nothing more can move, then asks epoll
+ * 	for exactly the events that would let more move
+ * Pre: Connection is relaying
+ * Post: Connection is waiting on its sockets, or closed when both sides
+ * 	are done
+ */
+static void pump(struct lb *lb, struct lb_conn *c)
+{
+	// Set variables
+	int up;			// Result of the upload direction
+	int down;		// Result of the download direction
+	unsigned int want;	// Events wanted
+
+	do
+	{
+		up = pumpOne(&c->up, c->client_fd, c->backend_fd);
+		down = pumpOne(&c->down, c->backend_fd, c->client_fd);
+		if (down == -1)
+		{
+			closeConn(lb, c);
+			return;
+		}
+		// The backend hangs up once its reply is out, whatever the
+		// client still sends it is not needed
+		if (up == -1)
+		{
+			c->up.eof = 1;
+			c->up.queued = 0;
+			c->up.shut = 1;
+			up = 0;
+		}
+	} while (up > 0 || down > 0);
+
+	if (c->up.shut && c->down.shut)
+	{
+		closeConn(lb, c);
+		return;
+	}
+	want = 0;
+	if (!c->up.eof && c->up.queued < PIPE_CAP)
+		want |= EPOLLIN;
+	if (c->down.queued > 0)
+		want |= EPOLLOUT;
+	watch(lb, c->client_fd, &c->hc, want, &c->ev_client);
+	want = 0;
+	if (!c->down.eof && c->down.queued < PIPE_CAP)
+		want |= EPOLLIN;
+	if (c->up.queued > 0)
+		want |= EPOLLOUT;
+	watch(lb, c->backend_fd, &c->hb, want, &c->ev_backend);
+}
+
+/* Function: startRelay
+ * Parameters: proxy, connection
+ * Overview: Sets up the pipes once a backend took the hello
+ * Pre: Backend answered 'S' and the client was told
+ * Post: Connection is relaying
+ */
+static void startRelay(struct lb *lb, struct lb_conn *c)
+{
+	if (pipe2(c->up.pipe, O_NONBLOCK | O_CLOEXEC) == -1)
+	{
+		c->up.pipe[0] = -1;
+		closeConn(lb, c);
+		return;
+	}
+	if (pipe2(c->down.pipe, O_NONBLOCK | O_CLOEXEC) == -1)
+	{
+		close(c->up.pipe[0]);
+		close(c->up.pipe[1]);
+		c->up.pipe[0] = -1;
+		closeConn(lb, c);
+		return;
+	}
+	fcntl(c->up.pipe[1], F_SETPIPE_SZ, PIPE_CAP);
+	fcntl(c->down.pipe[1], F_SETPIPE_SZ, PIPE_CAP);
+	lb->backends[c->backend].served++;
+	c->state = LB_RELAY;
+	pump(lb, c);
+}
+
+/* Function: clientEvent
+ * Parameters: proxy, connection
+ * Overview: Handles the client socket: the hello, then relaying
+ * Pre: none
+ * Post: Connection moved along
+ */
+static void clientEvent(struct lb *lb, struct lb_conn *c)
+{
+	// Set variables
+	ssize_t n;		// Result of recv
+
+	if (c->state == LB_RELAY)
+	{
+		pump(lb, c);
+		return;
+	}
+	if (c->state != LB_HELLO)
+	{
+		// Only a hang up gets here while a backend is being found
+		closeConn(lb, c);
+		return;
+	}
+	n = recv(c->client_fd, (char *)&c->hello + c->got, sizeof(c->hello) - c->got, 0);
+	if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+	if (n <= 0)
+	{
+		closeConn(lb, c);
+		return;
+	}
+	c->got += n;
+	if (c->got < (int)sizeof(c->hello))
+		return;
+	// Leave the rest in the socket until a backend is ready for it
+	watch(lb, c->client_fd, &c->hc, 0, &c->ev_client);
+	startBackend(lb, c);
+}
+
+/* Function: backendEvent
+ * Parameters: proxy, connection
+ * Overview: Handles the backend socket: the connect, the reply to the
+ * 	hello, then relaying
+ * Pre: Backend socket is open
+ * Post: Connection moved along
+ */
+static void backendEvent(struct lb *lb, struct lb_conn *c)
+{
+	// Set variables
+	int err = 0;			// Result of the connect
+	socklen_t err_len = sizeof(err);
+	char reply;			// Backend's reply
+	ssize_t n;			// Result of recv
+
+	switch (c->state)
+	{
+	case LB_CONNECT:
+		getsockopt(c->backend_fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+		if (err != 0 || send(c->backend_fd, &c->hello, sizeof(c->hello), MSG_NOSIGNAL) != sizeof(c->hello))
+		{
+			dropBackend(lb, c, 1);
+			return;
+		}
+		setHealth(lb, c->backend, 1);
+		c->state = LB_REPLY;
+		c->since = nowMsec();
+		watch(lb, c->backend_fd, &c->hb, EPOLLIN, &c->ev_backend);
+		return;
+	case LB_REPLY:
+		n = recv(c->backend_fd, &reply, 1, 0);
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			return;
+		if (n != 1)
+		{
+			dropBackend(lb, c, 1);
+			return;
+		}
+		// Busy, offer the hello to the next backend
+		if (reply == REPLY_BUSY)
+		{
+			c->last_reply = reply;
+			dropBackend(lb, c, 0);
+			return;
+		}
+		if (send(c->client_fd, &reply, 1, MSG_NOSIGNAL) != 1 || reply != REPLY_GO)
+		{
+			closeConn(lb, c);
+			return;
+		}
+		startRelay(lb, c);
+		return;
+	case LB_RELAY:
+		pump(lb, c);
+		return;
+	}
+}
+
+/* Function: acceptClients
+ * Parameters: proxy, listening socket
+ * Overview: Accepts every waiting client
+ * Pre: Listening socket is readable
+ * Post: New connections are waiting on their hello
+ */
+static void acceptClients(struct lb *lb, int listen_fd)
+{
+	// Set variables
+	struct lb_conn *c;		// New connection
+	struct epoll_event ev;		// Registration
+	int fd;				// Client socket
+	int one = 1;			// For TCP_NODELAY
+
+	// Relayed pieces go out as they come, a kept connection's small
+	// requests would otherwise wait on delayed acks at every hop
+	while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK)) != -1)
+	{
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		c = calloc(1, sizeof(struct lb_conn));
+		if (c == NULL)
+		{
+			close(fd);
+			continue;
+		}
+		c->state = LB_HELLO;
+		c->client_fd = fd;
+		c->backend_fd = -1;
+		c->backend = -1;
+		c->last_reply = REPLY_BUSY;
+		c->accepted = nowMsec();
+		c->up.pipe[0] = -1;
+		c->hc.side = SIDE_CLIENT;
+		c->hc.conn = c;
+		c->hb.side = SIDE_BACKEND;
+		c->hb.conn = c;
+		c->ev_client = EPOLLIN;
+		c->next = lb->conns;
+		if (lb->conns != NULL)
+			lb->conns->prev = c;
+		lb->conns = c;
+		ev.events = EPOLLIN;
+		ev.data.ptr = &c->hc;
+		epoll_ctl(lb->ep, EPOLL_CTL_ADD, fd, &ev);
+	}
+}
+
+/* Function: probeDone
+ * Parameters: proxy, backend
+ * Overview: Finishes a health check, the backend is up if the connect went
+ * 	through
+ * Pre: A health check is in progress
+ * Post: Backend's health is set and the probe is closed
+ */
+static void probeDone(struct lb *lb, int b)
+{
+	// Set variables
+	int err = 0;			// Result of the connect
+	socklen_t err_len = sizeof(err);
+
+	getsockopt(lb->backends[b].probe_fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+	setHealth(lb, b, err == 0);
+	close(lb->backends[b].probe_fd);
+	lb->backends[b].probe_fd = -1;
+}
+
+/* Function: healthCheck
+ * Parameters: proxy, current time
+ * Overview: Fails the probes that didn't finish in an interval, starts new
+ * 	ones and drops clients that never sent their hello.  A backend that
+ * 	doesn't finish the connect or answer the hello in time is let go as
+ * 	failed and the hello goes to the next one.
+ * Pre: none
+ * Post: Every backend has a probe under way
+ */
+static void healthCheck(struct lb *lb, unsigned long long now)
+{
+	// Set variables
+	struct epoll_event ev;		// Registration
+	struct lb_conn *c;		// Connection being checked
+	struct lb_conn *next;		// Connection after it
+	int b;				// Backend being checked
+	int fd;				// Probe socket
+
+	for (b = 0; b < lb->count; b++)
+	{
+		if (lb->backends[b].probe_fd != -1)
+		{
+			close(lb->backends[b].probe_fd);
+			lb->backends[b].probe_fd = -1;
+			setHealth(lb, b, 0);
+		}
+		fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		if (fd == -1)
+			continue;
+		if (connect(fd, (struct sockaddr *)&lb->backends[b].ep->addr, sizeof(struct sockaddr_in)) == -1 &&
+			errno != EINPROGRESS)
+		{
+			close(fd);
+			setHealth(lb, b, 0);
+			continue;
+		}
+		lb->backends[b].probe_fd = fd;
+		ev.events = EPOLLOUT;
+		ev.data.ptr = &lb->backends[b].hp;
+		epoll_ctl(lb->ep, EPOLL_CTL_ADD, fd, &ev);
+	}
+
+	for (c = lb->conns; c != NULL; c = next)
+	{
+		next = c->next;
+		if (c->state == LB_HELLO && now - c->accepted > HELLO_MS)
+			closeConn(lb, c);
+		else if ((c->state == LB_CONNECT && now - c->since > CONNECT_MS) ||
+			(c->state == LB_REPLY && now - c->since > REPLY_MS))
+			dropBackend(lb, c, 1);
+	}
+	lb->next_health = now + lb->health_ms;
+}
+
+/* Function: openListener
+ * Parameters: port
+ * Overview: Sets up the non-blocking listening socket
+ * Pre: none
+ * Post: Returns the socket, exits on failure
+ */
+static int openListener(int port)
+{
+	// Set variables
+	int socket_serv_fd;		// server socket file descriptor
+	struct sockaddr_in server_addr;	// Server's address structure
+	int sock_opt = 1;		// Sets the option in socket for reuse
+
+	if ((socket_serv_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) == -1)
+	{
+		fprintf(stderr, "otp_lb ERROR: Failed to setup socket file descriptor\n");
+		exit(1);
+	}
+	memset(&server_addr, 0, sizeof(server_addr));
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_port = htons(port);
+	server_addr.sin_addr.s_addr = INADDR_ANY;
+	setsockopt(socket_serv_fd, SOL_SOCKET, SO_REUSEADDR, &sock_opt, sizeof(sock_opt));
+	if (bind(socket_serv_fd, (struct sockaddr *)&server_addr, sizeof(struct sockaddr)) == -1)
+	{
+		fprintf(stderr, "otp_lb ERROR: Failed to bind address to socket\n");
+		exit(1);
+	}
+	if (listen(socket_serv_fd, 128) == -1)
+	{
+		fprintf(stderr, "otp_lb ERROR: Failed at listening on port\n");
+		exit(1);
+	}
+	return socket_serv_fd;
+}
+
+/* Function: usage
+ * Parameters: none
+ * Overview: Prints how to run the proxy
+ * Pre: none
+ * Post: Exits with 1
+ */
+static void usage(void)
+{
+	fprintf(stderr, "otp_lb Usage: otp_lb [-i health_ms] <port_number> <backend[,backend...]>\n");
+	exit(1);
+}
+
+/* Function: main
+ * Parameters: number of arguments, the arguments
+ * Overview: Handles arguments and runs the proxy forever
+ */
+int main(int argc, char *argv[])
+{
+	// Set variables
+	struct lb lb;			// Proxy state
+	struct lb_handle hl;		// Handle of the listening socket
+	struct lb_handle *h;		// Handle of an event
+	struct lb_conn *dead;		// Closed connection being freed
+	struct epoll_event ev;		// Registration
+	struct epoll_event events[256];	// Ready sockets
+	unsigned long long now;		// Current time
+	int listen_fd;			// Listening socket
+	int n;				// Ready sockets
+	int opt;			// Current option
+	int i;				// For the loops
+
+	memset(&lb, 0, sizeof(lb));
+	lb.health_ms = 1000;
+	while ((opt = getopt(argc, argv, "i:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'i': lb.health_ms = atoi(optarg); break;
+		default: usage();
+		}
+	}
+	if (optind != argc - 2 || lb.health_ms < 1)
+		usage();
+
+	// The backends are parsed the same way the clients parse a port list
+	lb.conf.prog = "otp_lb";
+	lb.conf.tag = "";
+	lb.conf.daemon = "backend";
+	if (clientParseEndpoints(&lb.conf, argv[optind + 1]) == -1)
+		exit(1);
+	lb.count = lb.conf.count;
+	for (i = 0; i < lb.count; i++)
+	{
+		lb.backends[i].ep = &lb.conf.endpoints[i];
+		lb.backends[i].healthy = 1;
+		lb.backends[i].probe_fd = -1;
+		lb.backends[i].hp.side = SIDE_PROBE;
+		lb.backends[i].hp.backend = i;
+	}
+
+	metricsInit("otp_lb");
+	signal(SIGPIPE, SIG_IGN);
+	listen_fd = openListener(atoi(argv[optind]));
+	lb.ep = epoll_create1(EPOLL_CLOEXEC);
+	if (lb.ep == -1)
+	{
+		fprintf(stderr, "otp_lb ERROR: Failed to create epoll descriptor\n");
+		exit(1);
+	}
+	hl.side = SIDE_LISTEN;
+	hl.conn = NULL;
+	ev.events = EPOLLIN;
+	ev.data.ptr = &hl;
+	epoll_ctl(lb.ep, EPOLL_CTL_ADD, listen_fd, &ev);
+	healthCheck(&lb, nowMsec());
+
+	// Loop to relay clients
+	while (1)
+	{
+		now = nowMsec();
+		n = epoll_wait(lb.ep, events, 256, lb.next_health > now ? (int)(lb.next_health - now) : 0);
+		if (n == -1 && errno != EINTR)
+		{
+			fprintf(stderr, "otp_lb ERROR: Failed to wait on sockets\n");
+			exit(1);
+		}
+		for (i = 0; i < n; i++)
+		{
+			h = events[i].data.ptr;
+			if (h->conn != NULL && h->conn->state == LB_DEAD)
+				continue;
+			if (h->side == SIDE_LISTEN)
+				acceptClients(&lb, listen_fd);
+			else if (h->side == SIDE_PROBE)
+			{
+				if (lb.backends[h->backend].probe_fd != -1)
+					probeDone(&lb, h->backend);
+			}
+			else if (h->side == SIDE_CLIENT)
+				clientEvent(&lb, h->conn);
+			else
+				backendEvent(&lb, h->conn);
+		}
+		if (nowMsec() >= lb.next_health)
+			healthCheck(&lb, nowMsec());
+
+		// Free what was closed this round
+		while (lb.dead != NULL)
+		{
+			dead = lb.dead;
+			lb.dead = dead->next;
+			free(dead);
+		}
+	}
+
+	return 0;
+}
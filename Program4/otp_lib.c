@@ -0,0 +1,480 @@
+/*
+ * File otp_lib.c
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: libotp.  Daemons are picked and failed over by otp_client.c
+ * 	exactly as for the commands.  Every hello asks the daemon to keep the
+ * 	connection, and a connection whose request went through is put on
+ * 	the pool's idle list.  A request takes the newest idle connection and
+ * 	only connects when there is none.  A kept connection the daemon has
+ * 	since let go shows up as a hang up before the reply; the request
+ * 	then moves on to the next one.  Submitted requests wait on a queue
+ * 	served by pool threads, started as needed up to max_conns.
+ * Last Update: 06/03/2016
+ */
+
+// Include Libraries
+#include <stdio.h>	// General IO, including printf to redirect files
+#include <stdlib.h>	// General purpose functions
+#include <string.h>	// Manipulation of C strings and arrays
+#include <time.h>	// Age of idle connections
+#include <pthread.h>	// Pool threads
+#include <unistd.h>	// Provides access to the POSIX API
+#include <sys/socket.h>	// Makes available for the use of sockets
+#include <arpa/inet.h>	// Makes available ports
+#include "otp_client.h"
+#include "otp_proto.h"
+#include "otp_lib.h"
+
+#define OTP_IDLE_MS	1500	// Idle connections older than this are closed
+
+/* A connection kept for the next request */
+struct otp_conn
+{
+	int fd;				// The socket
+	int chosen;			// Daemon it goes to
+	unsigned long long since;	// Time it went idle
+};
+
+/* A submitted request */
+struct otp_job
+{
+	const char *text;		// Text to send
+	const char *key;		// Key to send
+	size_t length;			// Bytes of each
+	char *out;			// Where the result goes
+	size_t bad;			// First bad character of text or key
+	otp_callback done;		// Called when done, may be NULL
+	void *arg;			// Passed to done
+	struct otp_job *next;		// Next in the queue
+};
+
+/* A pool */
+struct otp_pool
+{
+	struct client_conf conf;	// Daemons requests may go to
+	int max_conns;			// Most threads and idle connections
+	pthread_mutex_t lock;		// Everything below
+	pthread_cond_t work;		// A job was queued or the pool closes
+	pthread_cond_t finished;	// A job is done
+	struct otp_conn idle[OTP_MAX_CONNS];	// Kept connections, newest last
+	int nidle;			// Number of them
+	struct otp_job *head;		// Queue of submitted jobs
+	struct otp_job *tail;		// Its end
+	int pending;			// Submitted and not done
+	pthread_t threads[OTP_MAX_CONNS];	// Pool threads
+	int nthreads;			// Number started
+	int waiting;			// Threads waiting for a job
+	int closing;			// otpClose was called
+};
+
+/* Function: nowMsec
+ * Parameters: none
+ * Overview: Reads the monotonic clock
+ * Pre: none
+ * Post: Returns the time in milliseconds
+ */
+static unsigned long long nowMsec(void)
+{
+	// Set variables
+	struct timespec ts;		// Current time
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Function: sendAll
+ * Parameters: socket, buffer, bytes
+ * Overview: Sends a whole buffer
+ * Pre: none
+ * Post: Returns 0 once sent, -1 if the connection failed
+ */
+static int sendAll(int fd, const char *buf, size_t length)
+{
+	// Set variables
+	size_t sent = 0;		// Bytes sent so far
+	ssize_t n;			// Result of send
+
+	while (sent < length)
+	{
+		n = send(fd, buf + sent, length - sent, MSG_NOSIGNAL);
+		if (n <= 0)
+			return -1;
+		sent += n;
+	}
+	return 0;
+}
+
+/* Function: recvAll
+ * Parameters: socket, buffer, bytes
+ * Overview: Receives exactly length bytes
+ * Pre: none
+ * Post: Returns 0 once received, -1 if the connection failed
+ */
+static int recvAll(int fd, char *buf, size_t length)
+{
+	// Set variables
+	size_t got = 0;			// Bytes received so far
+	ssize_t n;			// Result of recv
+
+	while (got < length)
+	{
+		n = recv(fd, buf + got, length - got, 0);
+		if (n <= 0)
+			return -1;
+		got += n;
+	}
+	return 0;
+}
+
+/* Function: takeIdle
+ * Parameters: pool, set to the daemon of the connection
+ * Overview: Takes the newest idle connection, closing any too old to be
+ * 	still open at the daemon
+ * Pre: none
+ * Post: Returns a socket, -1 if none is idle
+ */
+static int takeIdle(struct otp_pool *pool, int *chosen)
+{
+	// Set variables
+	unsigned long long now = nowMsec();	// For the age
+	int fd = -1;			// Connection taken
+	int i;				// For the loop
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->nidle > 0)
+	{
+		pool->nidle--;
+		fd = pool->idle[pool->nidle].fd;
+		*chosen = pool->idle[pool->nidle].chosen;
+	}
+	// The oldest are first, drop the ones past their time
+	for (i = 0; i < pool->nidle && now - pool->idle[i].since > OTP_IDLE_MS; i++)
+		close(pool->idle[i].fd);
+	if (i > 0)
+	{
+		memmove(pool->idle, pool->idle + i, (pool->nidle - i) * sizeof(struct otp_conn));
+		pool->nidle -= i;
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return fd;
+}
+
+/* Function: putIdle
+ * Parameters: pool, socket, daemon it goes to
+ * Overview: Keeps a connection for the next request, closing it when the
+ * 	pool already keeps enough
+ * Pre: The last request on it is complete
+ * Post: Connection is idle or closed
+ */
+static void putIdle(struct otp_pool *pool, int fd, int chosen)
+{
+	pthread_mutex_lock(&pool->lock);
+	if (pool->nidle < pool->max_conns && !pool->closing)
+	{
+		pool->idle[pool->nidle].fd = fd;
+		pool->idle[pool->nidle].chosen = chosen;
+		pool->idle[pool->nidle].since = nowMsec();
+		pool->nidle++;
+		fd = -1;
+	}
+	pthread_mutex_unlock(&pool->lock);
+	if (fd != -1)
+		close(fd);
+}
+
+/* Function: reuse
+ * Parameters: pool, kept socket, length of the text
+ * Overview: Sends the hello of the next request over a kept connection
+ * Pre: none
+ * Post: Returns the daemon's reply, 0 if the connection is gone
+ */
+static char reuse(struct otp_pool *pool, int fd, size_t length)
+{
+	// Set variables
+	struct otp_hello hello;		// Hello of the request
+	char reply = 0;			// The daemon's answer
+
+	memset(&hello, 0, sizeof(hello));
+	strncpy(hello.tag, pool->conf.tag, sizeof(hello.tag));
+	helloSetLength(&hello, length);
+	hello.flags = htonl(pool->conf.flags);
+	if (sendAll(fd, (const char *)&hello, sizeof(hello)) == -1 || recv(fd, &reply, 1, 0) != 1)
+		return 0;
+	return reply;
+}
+
+/* Function: runJob
+ * Parameters: pool, text, key, bytes of each, where the result goes,
+ * 	where the offset of a bad character goes
+ * Overview: Runs one request on a kept connection, or a new one when none
+ * 	is kept, gone, or the daemon behind it is too busy
+ * Pre: none
+ * Post: Returns an OTP_ status, out holds the result on OTP_OK and bad the
+ * 	offset of the daemon's status on OTP_EBADTEXT and OTP_EBADKEY
+ */
+static int runJob(struct otp_pool *pool, const char *text, const char *key, size_t length, char *out, size_t *bad)
+{
+	// Set variables
+	int fd;				// Connection of the request
+	int chosen = -1;		// Daemon of the connection
+	int why;			// How a new connection failed
+	char reply;			// Reply over a kept connection
+	int code;			// Status the daemon sent
+	unsigned long long at;		// Offset of its bad character
+
+	// A kept connection first, a new one if none of them takes it.  The
+	// request counts against its daemon either way, for the other clients
+	while ((fd = takeIdle(pool, &chosen)) != -1)
+	{
+		clientBegin(&pool->conf, chosen);
+		reply = reuse(pool, fd, length);
+		if (reply == REPLY_GO)
+			break;
+		close(fd);
+		clientDone(&pool->conf, chosen);
+		chosen = -1;
+		if (reply == REPLY_WRONG)
+			return OTP_EWRONG;
+		if (reply == REPLY_BUSY)
+		{
+			fd = -1;
+			break;
+		}
+	}
+	if (fd == -1)
+	{
+		fd = clientOpen(&pool->conf, length, 0, &chosen, &why);
+		if (fd == -1)
+			return why == CLIENT_FAIL_BUSY ? OTP_EBUSY : why == CLIENT_FAIL_WRONG ? OTP_EWRONG : OTP_ECONNECT;
+	}
+
+	// The daemon checks the characters as it ciphers them, bad ones get a
+	// status with no result behind it and the connection stays good
+	if (sendAll(fd, text, length) == -1 || sendAll(fd, key, length) == -1 ||
+		(code = clientRecvStatus(fd, &at, NULL)) == -1 ||
+		(code == STATUS_OK && recvAll(fd, out, length) == -1))
+	{
+		close(fd);
+		clientDone(&pool->conf, chosen);
+		return OTP_EIO;
+	}
+	clientDone(&pool->conf, chosen);
+	putIdle(pool, fd, chosen);
+	if (code == STATUS_OK)
+		return OTP_OK;
+	if (bad != NULL)
+		*bad = at;
+	return code == STATUS_BAD_KEY ? OTP_EBADKEY : OTP_EBADTEXT;
+}
+
+/* Function: poolThread
+ * Parameters: pool
+ * Overview: Runs submitted jobs until the pool closes and the queue is empty
+ * Pre: none
+ * Post: Every job it took had its callback called
+ */
+static void *poolThread(void *arg)
+{
+	// Set variables
+	struct otp_pool *pool = arg;	// The pool
+	struct otp_job *job;		// Job being run
+	int status;			// Its result
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;)
+	{
+		while (pool->head == NULL && !pool->closing)
+		{
+			pool->waiting++;
+			pthread_cond_wait(&pool->work, &pool->lock);
+			pool->waiting--;
+		}
+		if (pool->head == NULL)
+			break;
+		job = pool->head;
+		pool->head = job->next;
+		if (pool->head == NULL)
+			pool->tail = NULL;
+		pthread_mutex_unlock(&pool->lock);
+
+		job->bad = job->length;
+		status = runJob(pool, job->text, job->key, job->length, job->out, &job->bad);
+		if (job->done != NULL)
+			job->done(job->arg, status, job->out, job->length, job->bad);
+		free(job);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->pending == 0)
+			pthread_cond_broadcast(&pool->finished);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+/* Function: otpOpen
+ * Parameters: "enc" or "dec", port list as otp_enc takes it, most
+ * 	connections at once
+ * Overview: Sets up a pool, nothing is connected until the first request
+ * Pre: none
+ * Post: Returns the pool, NULL with a message on a bad mode or port list
+ */
+struct otp_pool *otpOpen(const char *mode, const char *ports, int max_conns)
+{
+	// Set variables
+	struct otp_pool *pool;		// The pool
+
+	pool = calloc(1, sizeof(*pool));
+	if (pool == NULL)
+		return NULL;
+	if (strcmp(mode, "enc") == 0)
+	{
+		pool->conf.prog = "otp_enc";
+		pool->conf.daemon = "otp_enc_d";
+	}
+	else if (strcmp(mode, "dec") == 0)
+	{
+		pool->conf.prog = "otp_dec";
+		pool->conf.daemon = "otp_dec_d";
+	}
+	else
+	{
+		fprintf(stderr, "libotp Error: mode must be enc or dec\n");
+		free(pool);
+		return NULL;
+	}
+	pool->conf.tag = mode;
+	if (clientParseEndpoints(&pool->conf, ports) == -1)
+	{
+		free(pool);
+		return NULL;
+	}
+	pool->conf.flags = HELLO_KEEP | HELLO_STATUS;
+	pool->max_conns = max_conns < 1 ? 1 : max_conns > OTP_MAX_CONNS ? OTP_MAX_CONNS : max_conns;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->finished, NULL);
+	return pool;
+}
+
+/* Function: otpRun
+ * Parameters: pool, text, key, bytes of each, where the result goes,
+ * 	where the offset of a bad character goes or NULL
+ * Overview: Runs a request on the calling thread
+ * Pre: out has room for length bytes
+ * Post: Returns an OTP_ status, out holds the result on OTP_OK and bad the
+ * 	offset of the first bad character on OTP_EBADTEXT and OTP_EBADKEY
+ */
+int otpRun(struct otp_pool *pool, const char *text, const char *key, size_t length, char *out, size_t *bad)
+{
+	return runJob(pool, text, key, length, out, bad);
+}
+
+/* Function: otpSubmit
+ * Parameters: pool, text, key, bytes of each, where the result goes,
+ * 	callback and its argument
+ * Overview: Queues a request for a pool thread, starting one if all are busy
+ * Pre: text, key and out stay valid until the callback
+ * Post: Returns OTP_OK once queued, OTP_EINVAL if the pool is closing or
+ * 	out of memory
+ */
+int otpSubmit(struct otp_pool *pool, const char *text, const char *key, size_t length, char *out,
+	otp_callback done, void *arg)
+{
+	// Set variables
+	struct otp_job *job;		// The request
+
+	job = malloc(sizeof(*job));
+	if (job == NULL)
+		return OTP_EINVAL;
+	job->text = text;
+	job->key = key;
+	job->length = length;
+	job->out = out;
+	job->done = done;
+	job->arg = arg;
+	job->next = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->closing)
+	{
+		pthread_mutex_unlock(&pool->lock);
+		free(job);
+		return OTP_EINVAL;
+	}
+	if (pool->tail != NULL)
+		pool->tail->next = job;
+	else
+		pool->head = job;
+	pool->tail = job;
+	pool->pending++;
+	if (pool->waiting == 0 && pool->nthreads < pool->max_conns &&
+		pthread_create(&pool->threads[pool->nthreads], NULL, poolThread, pool) == 0)
+		pool->nthreads++;
+	pthread_cond_signal(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+	return OTP_OK;
+}
+
+/* Function: otpWait
+ * Parameters: pool
+ * Overview: Waits until every submitted request has had its callback
+ * Pre: none
+ * Post: Nothing is pending
+ */
+void otpWait(struct otp_pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	while (pool->pending > 0)
+		pthread_cond_wait(&pool->finished, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* Function: otpClose
+ * Parameters: pool
+ * Overview: Finishes what was submitted, then stops the threads and closes
+ * 	the kept connections
+ * Pre: No otpRun is going on
+ * Post: Pool is freed
+ */
+void otpClose(struct otp_pool *pool)
+{
+	// Set variables
+	int i;				// For the loops
+
+	pthread_mutex_lock(&pool->lock);
+	pool->closing = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+	for (i = 0; i < pool->nthreads; i++)
+		pthread_join(pool->threads[i], NULL);
+	for (i = 0; i < pool->nidle; i++)
+		close(pool->idle[i].fd);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work);
+	pthread_cond_destroy(&pool->finished);
+	free(pool);
+}
+
+/* Function: otpStrerror
+ * Parameters: status
+ * Overview: Describes an OTP_ status
+ * Pre: none
+ * Post: Returns a message
+ */
+const char *otpStrerror(int status)
+{
+	switch (status)
+	{
+	case OTP_OK: return "ok";
+	case OTP_ECONNECT: return "could not contact the daemon";
+	case OTP_EBUSY: return "Server has max number of processes";
+	case OTP_EWRONG: return "daemon is for the other program";
+	case OTP_EIO: return "connection failed";
+	case OTP_EINVAL: return "request can't be sent";
+	case OTP_EBADTEXT: return "text has an invalid character";
+	case OTP_EBADKEY: return "key has an invalid character";
+	}
+	return "unknown error";
+}
@@ -0,0 +1,61 @@
+/*
+ * File otp_lib.h
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: libotp, the client side of otp_enc and otp_dec for programs
+ * 	that want to encrypt or decrypt buffers without running them.  A pool
+ * 	is opened once with the same port list the commands take and keeps
+ * 	the connections it used open, so the next request skips the connect.
+ * 	otpRun blocks until its result is in.  otpSubmit queues a request and
+ * 	returns at once; up to max_conns requests run at the same time, each
+ * 	on its own connection, and each calls its callback from a pool
+ * 	thread when done.
+ * 	A kept connection holds a daemon worker while it sits idle, so keep
+ * 	max_conns well under the daemon's -c.  The daemon lets an idle one
+ * 	go after its -H time and the pool reconnects on its own.
+ * 	The daemon checks every character of text and key as it ciphers
+ * 	them.  A request with one that isn't a space or A-Z gets no result,
+ * 	its status says which of the two has it and bad says where.
+ * Last Update: 06/03/2016
+ */
+
+#ifndef OTP_LIB_H
+#define OTP_LIB_H
+
+#include <stddef.h>	// size_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Status of a request
+#define OTP_OK		0	// Result is in out
+#define OTP_ECONNECT	-1	// No daemon could be reached
+#define OTP_EBUSY	-2	// Every daemon was at capacity
+#define OTP_EWRONG	-3	// Daemon is for the other mode
+#define OTP_EIO		-4	// Connection failed part way through
+#define OTP_EINVAL	-5	// Request can't be sent
+#define OTP_EBADTEXT	-6	// Text has a bad character, no result
+#define OTP_EBADKEY	-7	// Key has a bad character, no result
+
+#define OTP_MAX_CONNS	64	// Most connections of one pool
+
+struct otp_pool;
+
+/* Called from a pool thread when a submitted request is done */
+typedef void (*otp_callback)(void *arg, int status, char *out, size_t length, size_t bad);
+
+struct otp_pool *otpOpen(const char *mode, const char *ports, int max_conns);
+int otpRun(struct otp_pool *pool, const char *text, const char *key, size_t length, char *out, size_t *bad);
+int otpSubmit(struct otp_pool *pool, const char *text, const char *key, size_t length, char *out,
+	otp_callback done, void *arg);
+void otpWait(struct otp_pool *pool);
+void otpClose(struct otp_pool *pool);
+const char *otpStrerror(int status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
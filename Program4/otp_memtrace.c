@@ -0,0 +1,219 @@
+/*
+ * File otp_memtrace.c
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Allocation tracing for the daemons.  Arena allocations count as
+ * 	released when their arena is reset.  A request is whatever happens
+ * 	between memtraceBegin and memtraceEnd.  Tracing is not thread safe,
+ * 	allocations must come from the thread that handles the request.
+ * Last Update: 06/03/2016
+ */
+
+// Include Libraries
+#include <stdio.h>	// snprintf of the request name
+#include <stdlib.h>	// getenv
+#include <string.h>	// strcmp of site names
+#include <sys/resource.h>	// Peak RSS of the worker
+#include "otp_metrics.h"
+#include "otp_memtrace.h"
+
+#define MT_MAX_SITES	64	// Call sites tracked, the last one takes the rest
+
+/* Counters of one call site */
+struct mt_site
+{
+	const char *name;	// "file:line"
+	struct arena *arena;	// Arena the site allocates from
+	size_t count;		// Allocations this request
+	size_t bytes;		// Bytes allocated this request
+	size_t live;		// Bytes still held
+};
+
+static int mt_enabled = 0;			// OTP_MEMTRACE is set
+static char mt_request[64] = "none";		// Name of the current request
+static struct mt_site mt_sites[MT_MAX_SITES];	// Every site seen
+static int mt_nsites = 0;			// Sites in use
+static size_t mt_count = 0;			// Allocations this request
+static size_t mt_bytes = 0;			// Bytes allocated this request
+static size_t mt_live = 0;			// Bytes held right now
+static size_t mt_peak = 0;			// Most bytes held this request
+static struct arena *mt_arena = NULL;		// Last arena seen, for its size
+
+/* Function: siteIndex
+ * Parameters: site name, arena or NULL
+ * Overview: Finds the counters of a call site, adding it if new
+ * Pre: none
+ * Post: Returns the site index
+ */
+static int siteIndex(const char *name, struct arena *a)
+{
+	// Set variables
+	int i;			// For the loop
+
+	for (i = 0; i < mt_nsites; i++)
+	{
+		if (mt_sites[i].arena == a && (mt_sites[i].name == name || strcmp(mt_sites[i].name, name) == 0))
+			return i;
+	}
+	if (mt_nsites == MT_MAX_SITES)
+		return MT_MAX_SITES - 1;
+	mt_sites[mt_nsites].name = mt_nsites == MT_MAX_SITES - 1 ? "other" : name;
+	mt_sites[mt_nsites].arena = a;
+	return mt_nsites++;
+}
+
+/* Function: record
+ * Parameters: site index, bytes
+ * Overview: Counts an allocation
+ * Pre: Tracing is on
+ * Post: Request and site counters are updated
+ */
+static void record(int site, size_t size)
+{
+	mt_sites[site].count++;
+	mt_sites[site].bytes += size;
+	mt_sites[site].live += size;
+	mt_count++;
+	mt_bytes += size;
+	mt_live += size;
+	if (mt_live > mt_peak)
+		mt_peak = mt_live;
+}
+
+/* Function: memtraceInit
+ * Parameters: none
+ * Overview: Turns tracing on when OTP_MEMTRACE is set
+ * Pre: Called before anything is allocated with reqAlloc
+ * Post: Tracing is on or off for the life of the process
+ */
+void memtraceInit(void)
+{
+	// Set variables
+	char *env = getenv("OTP_MEMTRACE");	// Tracing switch
+
+	mt_enabled = env != NULL && env[0] != 0 && strcmp(env, "0") != 0;
+}
+
+/* Function: memtraceBegin
+ * Parameters: name of the request
+ * Overview: Starts counting for a new request
+ * Pre: none
+ * Post: Per request counters are zero, held bytes carry over
+ */
+void memtraceBegin(const char *request)
+{
+	// Set variables
+	int i;			// For the loop
+
+	if (!mt_enabled)
+		return;
+	snprintf(mt_request, sizeof(mt_request), "%s", request);
+	for (i = 0; i < mt_nsites; i++)
+	{
+		mt_sites[i].count = 0;
+		mt_sites[i].bytes = 0;
+	}
+	mt_count = 0;
+	mt_bytes = 0;
+	mt_peak = mt_live;
+}
+
+/* Function: memtraceEnd
+ * Parameters: none
+ * Overview: Logs the counters of the request and flags held memory
+ * Pre: memtraceBegin was called
+ * Post: memtrace, memtrace_site and memleak lines are logged
+ */
+void memtraceEnd(void)
+{
+	// Set variables
+	struct rusage usage;	// Peak RSS of the process
+	int i;			// For the loop
+
+	if (!mt_enabled)
+		return;
+	getrusage(RUSAGE_SELF, &usage);
+	metricsEmit("memtrace request=%s allocs=%zu bytes=%zu peak=%zu leaked=%zu arena_mapped=%zu maxrss_kb=%ld",
+		mt_request, mt_count, mt_bytes, mt_peak, mt_live,
+		mt_arena != NULL ? mt_arena->mapped : 0, usage.ru_maxrss);
+	for (i = 0; i < mt_nsites; i++)
+	{
+		if (mt_sites[i].count == 0 && mt_sites[i].live == 0)
+			continue;
+		metricsEmit("memtrace_site request=%s site=%s allocs=%zu bytes=%zu leaked=%zu",
+			mt_request, mt_sites[i].name, mt_sites[i].count, mt_sites[i].bytes, mt_sites[i].live);
+	}
+	if (mt_live > 0)
+	{
+		for (i = 0; i < mt_nsites; i++)
+		{
+			if (mt_sites[i].live > 0)
+				metricsEmit("memleak request=%s site=%s bytes=%zu", mt_request, mt_sites[i].name, mt_sites[i].live);
+		}
+	}
+}
+
+/* Function: memtraceArenaAlloc
+ * Parameters: arena, size, call site
+ * Overview: arenaAlloc that is counted against its call site
+ * Pre: Arena is set up
+ * Post: Returns the allocation or NULL
+ */
+void *memtraceArenaAlloc(struct arena *a, size_t size, const char *site)
+{
+	// Set variables
+	void *ptr = arenaAlloc(a, size);	// The allocation
+
+	if (mt_enabled && ptr != NULL)
+	{
+		mt_arena = a;
+		record(siteIndex(site, a), size);
+	}
+	return ptr;
+}
+
+/* Function: memtraceArenaGrow
+ * Parameters: arena, allocation, its size, new size, call site
+ * Overview: arenaGrow that is counted against its call site.  Growing in
+ * 	place counts the extra bytes, a move counts the whole new block since
+ * 	the old one stays in the arena until the reset.
+ * Pre: ptr came from this arena since the last reset
+ * Post: Returns the grown allocation or NULL
+ */
+void *memtraceArenaGrow(struct arena *a, void *ptr, size_t old_size, size_t new_size, const char *site)
+{
+	// Set variables
+	void *grown = arenaGrow(a, ptr, old_size, new_size);	// The allocation
+
+	if (mt_enabled && grown != NULL && new_size > old_size)
+	{
+		mt_arena = a;
+		record(siteIndex(site, a), grown == ptr ? new_size - old_size : new_size);
+	}
+	return grown;
+}
+
+/* Function: memtraceArenaReset
+ * Parameters: arena
+ * Overview: arenaReset that releases everything counted against the arena
+ * Pre: Arena is set up
+ * Post: Arena is empty and its sites hold nothing
+ */
+void memtraceArenaReset(struct arena *a)
+{
+	// Set variables
+	int i;			// For the loop
+
+	arenaReset(a);
+	if (!mt_enabled)
+		return;
+	for (i = 0; i < mt_nsites; i++)
+	{
+		if (mt_sites[i].arena == a)
+		{
+			mt_live -= mt_sites[i].live;
+			mt_sites[i].live = 0;
+		}
+	}
+}
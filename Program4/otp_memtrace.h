@@ -0,0 +1,39 @@
+/*
+ * File otp_memtrace.h
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Allocation tracing for the daemons.  Every allocation made for a
+ * 	request goes through the req* macros below, which pass the call site
+ * 	along.  With OTP_MEMTRACE set in the environment the daemon counts
+ * 	bytes allocated, peak bytes in use and bytes still held when the
+ * 	request ends, per request and per call site, and logs them through
+ * 	the metrics log.  Requests that end holding memory get a memleak
+ * 	line.  Without OTP_MEMTRACE the macros cost one branch.
+ * Last Update: 06/03/2016
+ */
+
+#ifndef OTP_MEMTRACE_H
+#define OTP_MEMTRACE_H
+
+#include <stddef.h>	// size_t
+#include "otp_arena.h"
+
+// Call site of an allocation as "file:line"
+#define MT_STR2(x)	#x
+#define MT_STR(x)	MT_STR2(x)
+#define MT_SITE		__FILE__ ":" MT_STR(__LINE__)
+
+// Allocations made on behalf of a request
+#define reqAlloc(a, size)		memtraceArenaAlloc((a), (size), MT_SITE)
+#define reqGrow(a, ptr, old, size)	memtraceArenaGrow((a), (ptr), (old), (size), MT_SITE)
+#define reqReset(a)			memtraceArenaReset(a)
+
+void memtraceInit(void);
+void memtraceBegin(const char *request);
+void memtraceEnd(void);
+void *memtraceArenaAlloc(struct arena *a, size_t size, const char *site);
+void *memtraceArenaGrow(struct arena *a, void *ptr, size_t old_size, size_t new_size, const char *site);
+void memtraceArenaReset(struct arena *a);
+
+#endif
@@ -0,0 +1,87 @@
+/*
+ * File otp_metrics.c
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Metrics log shared by the daemons.  Lines look like
+ * 	"<unix time> <program> pid=<pid> <metric> key=value ..." and are
+ * 	written with one write call each.
+ * Last Update: 06/03/2016
+ */
+
+// Include Libraries
+#include <stdio.h>	// snprintf into the line buffer
+#include <stdlib.h>	// getenv
+#include <string.h>	// strcmp
+#include <stdarg.h>	// Variable arguments for metricsEmit
+#include <time.h>	// Time stamp of every line
+#include <fcntl.h>	// Opening the log for append
+#include <unistd.h>	// write and getpid
+#include "otp_metrics.h"
+
+static int metrics_fd = -1;		// Log descriptor, -1 when disabled
+static const char *metrics_prog = "";	// Program name put on every line
+
+/* Function: metricsInit
+ * Parameters: program name
+ * Overview: Opens the log named by OTP_METRICS
+ * Pre: none
+ * Post: metricsEmit logs if OTP_METRICS is set and could be opened
+ */
+void metricsInit(const char *prog_name)
+{
+	// Set variables
+	char *path = getenv("OTP_METRICS");	// Where metrics go
+
+	metrics_prog = prog_name;
+	if (path == NULL || path[0] == 0)
+		return;
+	if (strcmp(path, "-") == 0)
+		metrics_fd = 2;
+	else
+		metrics_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (metrics_fd == -1)
+		fprintf(stderr, "%s ERROR: metrics log %s could not be opened\n", prog_name, path);
+}
+
+/* Function: metricsEnabled
+ * Parameters: none
+ * Overview: Tells callers whether building a metric is worth it
+ * Pre: none
+ * Post: Returns 1 if metrics are logged
+ */
+int metricsEnabled(void)
+{
+	return metrics_fd != -1;
+}
+
+/* Function: metricsEmit
+ * Parameters: printf style format and arguments
+ * Overview: Logs one metric line
+ * Pre: none
+ * Post: Line is appended, or nothing happens when metrics are off
+ */
+void metricsEmit(const char *fmt, ...)
+{
+	// Set variables
+	char line[1024];	// Whole line, written at once
+	int len;		// Bytes in the line
+	int more;		// Bytes added by the format
+	va_list args;		// Arguments of the format
+
+	if (metrics_fd == -1)
+		return;
+
+	len = snprintf(line, sizeof(line), "%ld %s pid=%d ", (long)time(NULL), metrics_prog, (int)getpid());
+	va_start(args, fmt);
+	more = vsnprintf(line + len, sizeof(line) - len - 1, fmt, args);
+	va_end(args);
+	if (more < 0)
+		return;
+	len += more;
+	if (len > (int)sizeof(line) - 2)
+		len = sizeof(line) - 2;
+	line[len++] = '\n';
+	if (write(metrics_fd, line, len) < 0)
+		return;
+}
@@ -0,0 +1,22 @@
+/*
+ * File otp_metrics.h
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Metrics log shared by the daemons.  Every metric is one line of
+ * 	key=value pairs appended to the file named by the OTP_METRICS
+ * 	environment variable ("-" for stderr).  Each line goes out in a single
+ * 	write to an O_APPEND descriptor, so the daemon and all of its children
+ * 	can log to the same file without mixing lines.  With OTP_METRICS unset
+ * 	nothing is logged.
+ * Last Update: 06/03/2016
+ */
+
+#ifndef OTP_METRICS_H
+#define OTP_METRICS_H
+
+void metricsInit(const char *prog_name);
+int metricsEnabled(void);
+void metricsEmit(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#endif
@@ -0,0 +1,370 @@
+/*
+ * File otp_pipe.c
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Staged pipeline for streamed requests.  Each turn of a stream
+ * 	has its own slot of buffers: the receive stage takes an empty slot and
+ * 	fills it, the compute stage cyphers it in place, the send stage sends
+ * 	it and hands it back empty.  Each ring has one thread at either end,
+ * 	so putting and taking is a store of the item and a release of the
+ * 	count, no lock.  A stage that finds its ring empty or full looks
+ * 	again a few times and then sleeps on the other end's count with a
+ * 	futex.  A turn is a chunk, so the wake that follows every put and
+ * 	take is one system call per megabyte.
+ * Last Update: 06/03/2016
+ * Sources: Lamport, Specifying Concurrent Program Modules, TOPLAS 1983
+ *   futex(2) - http://man7.org/linux/man-pages/man2/futex.2.html
+ */
+
+// Include Libraries
+#include <stdio.h>	// General IO, including printf to redirect files
+#include <stdlib.h>	// General purpose functions
+#include <string.h>	// Manipulation of C strings and arrays
+#include <pthread.h>	// A thread per stage
+#include <unistd.h>	// syscall
+#include <sys/syscall.h>	// futex has no libc wrapper
+#include <linux/futex.h>	// Futex operations
+#include "otp_codec.h"
+#include "otp_crc.h"
+#include "otp_io.h"
+#include "otp_memtrace.h"
+#include "otp_metrics.h"
+#include "otp_pipe.h"
+#include "otp_seed.h"
+
+/* Buffers of one turn */
+struct pipe_slot
+{
+	size_t n;			// Bytes of text in the turn
+	int drop;			// Nothing is sent for it
+	int damaged;			// Turn failed its CRC32C
+	char *text;			// Text of the turn
+	char *key;			// Key of the turn
+	char *out;			// Result of the turn
+	struct otp_status *status;	// Status, sent with the result in one sendmsg
+};
+
+/* A streamed request going through the stages */
+struct pipe
+{
+	int sock;			// Client socket
+	const char *prog;		// Daemon name for messages
+	int dir;			// CODEC_ENC or CODEC_DEC
+	unsigned long long length;	// Bytes of text
+	unsigned long long offset;	// Where the text starts in the client's file
+	struct otp_seed *seed;		// Seed the key is made from, NULL when it is sent
+	int with_crc;			// Every turn carries its CRC32C
+	unsigned long long turns;	// Turns of the request
+	int failed;			// The compute stage found a bad character
+	struct pipe_ring empty;		// Send stage to receive stage
+	struct pipe_ring filled;	// Receive stage to compute stage
+	struct pipe_ring done;		// Compute stage to send stage
+	struct pipe_slot slots[PIPE_SLOTS];	// Every slot
+};
+
+/* Function: futexWait
+ * Parameters: word, value it had
+ * Overview: Sleeps until the word is woken, unless it changed already
+ * Pre: none
+ * Post: Returns once woken, changed or interrupted, the caller looks again
+ */
+static void futexWait(unsigned int *word, unsigned int seen)
+{
+	syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+}
+
+/* Function: futexWake
+ * Parameters: word
+ * Overview: Wakes the thread sleeping on the word, if there is one
+ * Pre: none
+ * Post: none
+ */
+static void futexWake(unsigned int *word)
+{
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/* Function: ringInit
+ * Parameters: ring
+ * Overview: Empties a ring
+ * Pre: No thread is using it
+ * Post: Ring is empty
+ */
+void ringInit(struct pipe_ring *r)
+{
+	memset(r, 0, sizeof(*r));
+}
+
+/* Function: ringPut
+ * Parameters: ring, item
+ * Overview: Adds an item at the tail, waiting while the ring is full
+ * Pre: Called from the ring's one producer
+ * Post: Item is on the ring and the consumer woken
+ */
+void ringPut(struct pipe_ring *r, void *item)
+{
+	// Set variables
+	unsigned int tail = r->tail;	// Only this thread writes it
+	unsigned int head;		// Items the consumer has taken
+	int spins = 0;			// Looks so far
+
+	while (tail - (head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) == PIPE_SLOTS)
+	{
+		if (++spins >= PIPE_SPIN)
+			futexWait(&r->head, head);
+	}
+	r->items[tail % PIPE_SLOTS] = item;
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+	futexWake(&r->tail);
+}
+
+/* Function: ringGet
+ * Parameters: ring
+ * Overview: Takes the item at the head, waiting while the ring is empty
+ * Pre: Called from the ring's one consumer
+ * Post: Returns the item, the producer is woken
+ */
+void *ringGet(struct pipe_ring *r)
+{
+	// Set variables
+	unsigned int head = r->head;	// Only this thread writes it
+	unsigned int tail;		// Items the producer has put
+	void *item;			// Item taken
+	int spins = 0;			// Looks so far
+
+	while ((tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) == head)
+	{
+		if (++spins >= PIPE_SPIN)
+			futexWait(&r->tail, tail);
+	}
+	item = r->items[head % PIPE_SLOTS];
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+	futexWake(&r->head);
+	return item;
+}
+
+/* Function: turnLength
+ * Parameters: request, turn
+ * Overview: Bytes of text in a turn, the last one may be short
+ * Pre: turn is below the number of turns
+ * Post: Returns the bytes
+ */
+static size_t turnLength(struct pipe *p, unsigned long long turn)
+{
+	// Set variables
+	unsigned long long start = turn * STREAM_CHUNK;	// First byte of the turn
+
+	return p->length - start < STREAM_CHUNK ? p->length - start : STREAM_CHUNK;
+}
+
+/* Function: recvStage
+ * Parameters: the request
+ * Overview: Fills empty slots with the text and key of each turn, every
+ * 	turn with its own upload deadline.  A seeded request sends only text.
+ * 	With HELLO_CRC the turn is checked here, while it is still in cache.
+ * Pre: Empty slots are on their ring
+ * Post: Every turn went to the compute stage, exits on a client that stops
+ * 	short or misses a deadline
+ */
+static void *recvStage(void *arg)
+{
+	// Set variables
+	struct pipe *p = arg;		// The request
+	struct pipe_slot *s;		// Slot being filled
+	struct io_phase upload;		// Deadline of the turn
+	unsigned long long turn;	// Turn being received
+	int parts = p->seed != NULL ? 1 : 2;	// Text, and the key unless it is made here
+	uint32_t wire = 0;		// CRC32C the client sent, big endian
+	uint32_t crc;			// CRC32C of what arrived
+
+	for (turn = 0; turn < p->turns; turn++)
+	{
+		s = ringGet(&p->empty);
+		s->n = turnLength(p, turn);
+		ioPhase(&upload, "upload", (unsigned long long)parts * s->n + (p->with_crc ? sizeof(wire) : 0));
+		if (ioRecv(p->sock, s->text, s->n, &upload) == -1 ||
+			(p->seed == NULL && ioRecv(p->sock, s->key, s->n, &upload) == -1) ||
+			(p->with_crc && ioRecv(p->sock, (char *)&wire, sizeof(wire), &upload) == -1))
+		{
+			// A client told about bad input may hang up without sending the rest
+			if (!__atomic_load_n(&p->failed, __ATOMIC_ACQUIRE))
+				fprintf(stderr, "%s ERROR: Client sent %llu of %llu bytes\n", p->prog,
+					parts * turn * STREAM_CHUNK + upload.done, parts * p->length);
+			ioAbort(p->sock);
+			exit(1);
+		}
+		s->damaged = 0;
+		if (p->with_crc)
+		{
+			crc = crc32c(0, s->text, s->n);
+			if (p->seed == NULL)
+				crc = crc32c(crc, s->key, s->n);
+			s->damaged = crc != ntohl(wire);
+		}
+		ringPut(&p->filled, s);
+	}
+	return NULL;
+}
+
+/* Function: computeStage
+ * Parameters: the request
+ * Overview: Checks and cyphers each turn in place, making its key first
+ * 	when the request is seeded.  After a bad character or a turn that
+ * 	failed its CRC32C the turns are still passed on, marked so nothing
+ * 	is sent for them.
+ * Pre: none
+ * Post: Every turn went to the send stage
+ */
+static void *computeStage(void *arg)
+{
+	// Set variables
+	struct pipe *p = arg;		// The request
+	struct pipe_slot *s;		// Slot being cyphered
+	unsigned long long turn;	// Turn being cyphered
+	size_t bad;			// First bad character of the turn
+
+	for (turn = 0; turn < p->turns; turn++)
+	{
+		s = ringGet(&p->filled);
+		memset(s->status, 0, sizeof(*s->status));
+		s->drop = p->failed;
+		if (!s->drop && s->damaged)
+		{
+			s->status->code = STATUS_BAD_CRC;
+			s->status->offset = htobe64(turn * STREAM_CHUNK);
+			metricsEmit("bad_crc offset=%llu length=%llu", p->offset + turn * STREAM_CHUNK, p->length);
+			__atomic_store_n(&p->failed, 1, __ATOMIC_RELEASE);
+		}
+		else if (!s->drop)
+		{
+			if (p->seed != NULL)
+				seedKeystream(p->seed, p->offset + turn * STREAM_CHUNK, s->key, s->n);
+			bad = codecFused(s->text, s->key, s->out, s->n, p->dir);
+			if (bad < s->n)
+			{
+				s->status->code = codecCheck(s->text + bad, 1) == 0 ? STATUS_BAD_TEXT : STATUS_BAD_KEY;
+				s->status->offset = htobe64(turn * STREAM_CHUNK + bad);
+				metricsEmit("bad_input which=%s offset=%llu length=%llu",
+					s->status->code == STATUS_BAD_TEXT ? "text" : "key", turn * STREAM_CHUNK + bad, p->length);
+				__atomic_store_n(&p->failed, 1, __ATOMIC_RELEASE);
+			}
+			else
+			{
+				s->status->code = STATUS_OK;
+				if (p->with_crc)
+					s->status->crc = htonl(crc32c(0, s->out, s->n));
+			}
+		}
+		ringPut(&p->done, s);
+	}
+	return NULL;
+}
+
+/* Function: pipeStream
+ * Parameters: client socket, the client's hello, request arena, CODEC_ENC
+ * 	or CODEC_DEC, daemon name for messages
+ * Overview: Runs a streamed request through the stages: receiving and
+ * 	cyphering each on a thread of its own, sending on the calling thread.
+ * 	After a bad character its status is the last thing sent and the rest
+ * 	of the request is read and dropped, so a kept connection can go on.
+ * Pre: Client was told to go
+ * Post: Sent the result of every turn, or the status of the bad one.
+ * 	Exits when the client fails a deadline or a stage can't start.
+ * 	A seeded request's seed is received before the stages start.
+ */
+void pipeStream(int c_socket, struct otp_hello *hello, struct arena *arena, int dir, const char *prog)
+{
+	// Set variables
+	struct pipe p;			// The request
+	struct pipe_slot *s;		// Slot being sent
+	struct io_phase download;	// Deadline of sending a turn
+	struct iovec iov[2];		// Status and result of a turn
+	pthread_t recv_thread;		// Receive stage
+	pthread_t compute_thread;	// Compute stage
+	unsigned long long turn;	// Turn being sent
+	size_t chunk;			// Bytes of a full turn
+	int slots;			// Slots the request needs
+	struct io_phase upload;		// Deadline of receiving the seed
+	int i;				// For the loop
+
+	memset(&p, 0, sizeof(p));
+	p.sock = c_socket;
+	p.prog = prog;
+	p.dir = dir;
+	p.length = helloLength(hello);
+	p.offset = be64toh(hello->offset);
+	p.with_crc = (ntohl(hello->flags) & HELLO_CRC) != 0;
+	p.turns = (p.length + STREAM_CHUNK - 1) / STREAM_CHUNK;
+	ringInit(&p.empty);
+	ringInit(&p.filled);
+	ringInit(&p.done);
+
+	// Every slot comes out of the arena before a stage starts
+	chunk = p.length < STREAM_CHUNK ? p.length : STREAM_CHUNK;
+	slots = p.turns < PIPE_SLOTS ? (int)p.turns : PIPE_SLOTS;
+	for (i = 0; i < slots; i++)
+	{
+		s = &p.slots[i];
+		s->status = reqAlloc(arena, sizeof(*s->status));
+		s->out = reqAlloc(arena, chunk);
+		s->text = reqAlloc(arena, chunk);
+		s->key = reqAlloc(arena, chunk);
+		if (s->status == NULL || s->out == NULL || s->text == NULL || s->key == NULL)
+		{
+			fprintf(stderr, "%s ERROR: Out of memory for the stream\n", prog);
+			exit(1);
+		}
+		ringPut(&p.empty, s);
+	}
+
+	// A seeded request sends its seed ahead of the first turn
+	if (ntohl(hello->flags) & HELLO_SEED)
+	{
+		p.seed = reqAlloc(arena, sizeof(*p.seed));
+		if (p.seed == NULL)
+		{
+			fprintf(stderr, "%s ERROR: Out of memory for the stream\n", prog);
+			exit(1);
+		}
+		ioPhase(&upload, "upload", sizeof(*p.seed));
+		if (ioRecv(c_socket, (char *)p.seed, sizeof(*p.seed), &upload) == -1)
+		{
+			fprintf(stderr, "%s ERROR: Client sent %llu of %llu bytes\n", prog, upload.done, upload.total);
+			ioAbort(c_socket);
+			exit(1);
+		}
+	}
+
+	if (pthread_create(&recv_thread, NULL, recvStage, &p) != 0 ||
+		pthread_create(&compute_thread, NULL, computeStage, &p) != 0)
+	{
+		fprintf(stderr, "%s ERROR: Failed to start the stream stages\n", prog);
+		ioAbort(c_socket);
+		exit(1);
+	}
+
+	// The send stage, each turn behind its status.  A slot goes back to the
+	// receive stage only once the kernel is done with its result pages
+	for (turn = 0; turn < p.turns; turn++)
+	{
+		s = ringGet(&p.done);
+		if (!s->drop)
+		{
+			iov[0].iov_base = s->status;
+			iov[0].iov_len = sizeof(*s->status);
+			iov[1].iov_base = s->out;
+			iov[1].iov_len = s->status->code == STATUS_OK ? s->n : 0;
+			ioPhase(&download, "download", iov[0].iov_len + iov[1].iov_len);
+			if (ioSendv(c_socket, iov, 2, &download) == -1)
+			{
+				fprintf(stderr, "%s ERROR: Issue with sending data to client\n", prog);
+				ioAbort(c_socket);
+				exit(1);
+			}
+		}
+		ringPut(&p.empty, s);
+	}
+	pthread_join(recv_thread, NULL);
+	pthread_join(compute_thread, NULL);
+}
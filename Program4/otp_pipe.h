@@ -0,0 +1,37 @@
+/*
+ * File otp_pipe.h
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Staged pipeline for streamed requests in a daemon worker.  A
+ * 	receive stage reads turns of text and key off the socket, a compute
+ * 	stage checks and cyphers them, and a send stage writes each result
+ * 	back behind its status, every stage on its own thread.  The stages
+ * 	hand buffers on through single producer, single consumer rings, so
+ * 	while one turn is on the wire the one before it is being cyphered.
+ * Last Update: 06/03/2016
+ */
+
+#ifndef OTP_PIPE_H
+#define OTP_PIPE_H
+
+#include "otp_arena.h"
+#include "otp_proto.h"
+
+#define PIPE_SLOTS	STREAM_HELD	// Turns in flight between the stages, a power of two
+#define PIPE_SPIN	100	// Looks at a ring before a stage sleeps on it
+
+/* Ring of buffers from one stage to the next */
+struct pipe_ring
+{
+	unsigned int head;		// Items taken, only the consumer writes it
+	unsigned int tail;		// Items put, only the producer writes it
+	void *items[PIPE_SLOTS];	// The items, at their count modulo PIPE_SLOTS
+};
+
+void ringInit(struct pipe_ring *r);
+void ringPut(struct pipe_ring *r, void *item);
+void *ringGet(struct pipe_ring *r);
+void pipeStream(int c_socket, struct otp_hello *hello, struct arena *arena, int dir, const char *prog);
+
+#endif
@@ -0,0 +1,195 @@
+/*
+ * File otp_place.c
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: CPU and NUMA placement of daemon workers.  The list is read
+ * 	once in the daemon, with the node of every CPU taken from sysfs.  A
+ * 	worker sets its affinity and then prefers its home node for every
+ * 	page it faults in from then on, which covers the request arena, the
+ * 	key made from a seed and the slots of the stream pipeline, all of
+ * 	which the worker touches first.  Pages it only shares with the
+ * 	daemon are copied on its first write, on its own node as well.
+ * 	Preferred rather than bound, so a full node spills over instead of
+ * 	failing the request.  Nothing here needs libnuma.
+ * Last Update: 06/03/2016
+ * Sources: sched_setaffinity(2), set_mempolicy(2), socket(7) SO_INCOMING_CPU
+ */
+
+// Include Libraries
+#define _GNU_SOURCE	// cpu_set_t and sched_setaffinity
+#include <stdio.h>	// Building sysfs paths
+#include <stdlib.h>	// strtol and atoi
+#include <string.h>	// Matching sysfs entries
+#include <ctype.h>	// Digits of the list
+#include <sched.h>	// CPU affinity
+#include <dirent.h>	// Looking for the node of a CPU
+#include <unistd.h>	// syscall
+#include <sys/syscall.h>	// set_mempolicy has no libc wrapper
+#include <sys/socket.h>	// SO_INCOMING_CPU
+#include <linux/mempolicy.h>	// MPOL_PREFERRED
+#include "otp_place.h"
+
+#define PLACE_NODES	1024	// Bits of the node mask
+
+/* Function: cpuNode
+ * Parameters: CPU number
+ * Overview: Finds the NUMA node of a CPU, sysfs lists it as a nodeN entry
+ * 	of the CPU's directory
+ * Pre: none
+ * Post: Returns the node, -1 when the kernel has no NUMA support
+ */
+static int cpuNode(int cpu)
+{
+	// Set variables
+	char path[64];			// The CPU's sysfs directory
+	DIR *dir;			// Reading it
+	struct dirent *entry;		// One entry of it
+	int node = -1;			// Node found
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	dir = opendir(path);
+	if (dir == NULL)
+		return -1;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		if (strncmp(entry->d_name, "node", 4) == 0 && isdigit((unsigned char)entry->d_name[4]))
+		{
+			node = atoi(entry->d_name + 4);
+			break;
+		}
+	}
+	closedir(dir);
+	return node;
+}
+
+/* Function: placeParse
+ * Parameters: placement to fill in, list of CPUs like "0-3,8,10-11"
+ * Overview: Reads a CPU list and the node of every CPU in it
+ * Pre: none
+ * Post: Returns 0 with pl filled in, -1 when the list is malformed or names
+ * 	a CPU the daemon may not run on
+ */
+int placeParse(struct place *pl, const char *list)
+{
+	// Set variables
+	cpu_set_t allowed;		// CPUs the daemon may run on
+	const char *p = list;		// Where the list is read
+	char *end;			// End of a number
+	long first;			// First CPU of a range
+	long last;			// Last CPU of it
+	long cpu;			// For the loop
+
+	pl->count = 0;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1)
+		return -1;
+	while (1)
+	{
+		if (!isdigit((unsigned char)*p))
+			return -1;
+		first = strtol(p, &end, 10);
+		last = first;
+		p = end;
+		if (*p == '-')
+		{
+			if (!isdigit((unsigned char)p[1]))
+				return -1;
+			last = strtol(p + 1, &end, 10);
+			p = end;
+		}
+		if (last < first || last >= CPU_SETSIZE)
+			return -1;
+		for (cpu = first; cpu <= last; cpu++)
+		{
+			if (!CPU_ISSET(cpu, &allowed))
+				return -1;
+			if (placeIndex(pl, cpu) != -1)
+				continue;
+			pl->cpus[pl->count] = cpu;
+			pl->nodes[pl->count] = cpuNode(cpu);
+			pl->count++;
+		}
+		if (*p == '\0')
+			return 0;
+		if (*p++ != ',')
+			return -1;
+	}
+}
+
+/* Function: placeIndex
+ * Parameters: placement, CPU number
+ * Overview: Finds a CPU in the list
+ * Pre: none
+ * Post: Returns its index, -1 if it isn't in the list
+ */
+int placeIndex(const struct place *pl, int cpu)
+{
+	// Set variables
+	int i;			// For the loop
+
+	for (i = 0; i < pl->count; i++)
+	{
+		if (pl->cpus[i] == cpu)
+			return i;
+	}
+	return -1;
+}
+
+/* Function: placeWorker
+ * Parameters: placement, index of the home CPU, 1 to spread over its node
+ * Overview: Pins the calling worker and points its memory at the home node.
+ * 	A worker that can't be placed still runs, only wherever the
+ * 	scheduler puts it.
+ * Pre: Runs in the worker before it starts any thread or allocates
+ * Post: Worker and the threads it starts run on the home CPU, or on the
+ * 	listed CPUs of its node, and new pages come from that node
+ */
+void placeWorker(const struct place *pl, int home, int spread)
+{
+	// Set variables
+	cpu_set_t set;			// CPUs to run on
+	unsigned long mask[PLACE_NODES / (8 * sizeof(unsigned long))];	// Home node
+	int node = pl->nodes[home];	// The home node
+	int i;				// For the loop
+
+	CPU_ZERO(&set);
+	CPU_SET(pl->cpus[home], &set);
+	for (i = 0; spread && i < pl->count; i++)
+	{
+		if (pl->nodes[i] == node)
+			CPU_SET(pl->cpus[i], &set);
+	}
+	if (sched_setaffinity(0, sizeof(set), &set) == -1)
+		return;
+
+	if (node < 0 || node >= PLACE_NODES - 1)
+		return;
+	memset(mask, 0, sizeof(mask));
+	mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+	if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, (unsigned long)PLACE_NODES) == -1)
+	{
+		// Kernel without NUMA, every page is local anyway
+	}
+}
+
+/* Function: placeIncomingCpu
+ * Parameters: accepted socket
+ * Overview: Asks which CPU the connection's packets were handled on
+ * Pre: none
+ * Post: Returns the CPU, -1 where the kernel doesn't say
+ */
+int placeIncomingCpu(int sock)
+{
+	// Set variables
+	int cpu = -1;			// The CPU
+	socklen_t len = sizeof(cpu);	// Size of the option
+
+#ifdef SO_INCOMING_CPU
+	if (getsockopt(sock, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == -1)
+		return -1;
+#else
+	(void)sock;
+	(void)len;
+#endif
+	return cpu;
+}
@@ -0,0 +1,32 @@
+/*
+ * File otp_place.h
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Where daemon workers run.  Given a list of CPUs, each worker
+ * 	is pinned to a home CPU of the list, or to the CPUs of the list on
+ * 	the home CPU's NUMA node when it runs the threads of a large request,
+ * 	and its memory comes from that node.  A connection's home is the CPU
+ * 	its packets were handled on when that one isn't busier than the rest.
+ * Last Update: 06/03/2016
+ */
+
+#ifndef OTP_PLACE_H
+#define OTP_PLACE_H
+
+#define PLACE_MAX	1024	// Most CPUs in a list, CPU_SETSIZE
+
+/* CPUs the workers may be pinned to */
+struct place
+{
+	int count;			// CPUs in the list, 0 when workers aren't pinned
+	int cpus[PLACE_MAX];		// CPU numbers
+	int nodes[PLACE_MAX];		// NUMA node of each, -1 if unknown
+};
+
+int placeParse(struct place *pl, const char *list);
+int placeIndex(const struct place *pl, int cpu);
+void placeWorker(const struct place *pl, int home, int spread);
+int placeIncomingCpu(int sock);
+
+#endif
@@ -0,0 +1,146 @@
+/*
+ * File otp_proto.h
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Wire format shared by otp_enc/otp_dec and their daemons.
+ * 	1. The client sends a hello: the program tag ("enc" or "dec"), the
+ * 	   length of the text it is about to send and where that text starts
+ * 	   in the client's file.  A whole file starts at offset 0, a striped
+ * 	   upload sends each range as its own request with its own offset.
+ * 	2. The daemon answers one character: 'S' to go ahead, 'M' when it is
+ * 	   too busy, 'U' when the tag is for the other daemon.
+ * 	3. The client sends length bytes of text, then length bytes of key.
+ * 	   A streamed request (HELLO_STREAM) sends them in turns instead:
+ * 	   STREAM_CHUNK bytes of text, the same bytes of key, and so on, the
+ * 	   last turn short.  Neither side holds more than a few chunks of it.
+ * 	   A seeded request (HELLO_SEED) sends a struct otp_seed first and
+ * 	   then only the text, the daemon makes the key from the seed.
+ * 	   A binary request (HELLO_BINARY) may hold any byte in its text and
+ * 	   key, the result is the text XORed with the key and nothing is
+ * 	   checked.  It is never seeded, the keys of a seed are characters.
+ * 	   With HELLO_CRC every frame, the whole request or a turn of a
+ * 	   stream, is followed by the CRC32C of the bytes of the frame, big
+ * 	   endian.  The daemon answers a frame that doesn't match it with a
+ * 	   STATUS_BAD_CRC at the frame's offset.
+ * 	4. The daemon sends back length bytes of result and hangs up, unless
+ * 	   the hello asked to keep the connection.  Then it waits a while for
+ * 	   another hello on the same connection and starts again at 2.
+ * 	   A hello asking for a status gets a struct otp_status first, and
+ * 	   no result when the status says the text or key had a character
+ * 	   other than a space or A-Z.  Without one the daemon hangs up on
+ * 	   bad input rather than send a result made from it.  A streamed
+ * 	   request gets a status and the result of each chunk as soon as
+ * 	   that chunk is in.  After a bad status the daemon reads the rest
+ * 	   of the request and sends nothing more for it.  With HELLO_CRC
+ * 	   each status holds the CRC32C of the result behind it.
+ * 	Lengths and offsets are 64 bits.  The length is split in two words
+ * 	so a client that only knows 32 bit lengths, and zeroes the high word,
+ * 	still speaks the same protocol.
+ * 	The trailing newline of a file is not part of the text, except in a
+ * 	binary file where every byte is.
+ * Last Update: 06/03/2016
+ */
+
+#ifndef OTP_PROTO_H
+#define OTP_PROTO_H
+
+#include <stdint.h>	// Fixed width fields
+#include <endian.h>	// htobe64 and be64toh of the offset
+#include <arpa/inet.h>	// htonl and ntohl of the other fields
+
+// Replies to the hello
+#define REPLY_GO	'S'	// Send the text and key
+#define REPLY_BUSY	'M'	// Daemon is at capacity, try later
+#define REPLY_WRONG	'U'	// Wrong daemon for this program
+
+/* First thing a client sends */
+struct otp_hello
+{
+	char tag[4];		// "enc" or "dec", null padded
+	uint32_t length;	// Bytes of text, low 32 bits, network byte order
+	uint64_t offset;	// Where the text starts in the file, big endian
+	uint32_t flags;		// HELLO_ flags, network byte order
+	uint32_t length_hi;	// Bytes of text, high 32 bits, network byte order
+};
+
+// Flags of the hello
+#define HELLO_KEEP	1	// Keep the connection open for another request
+#define HELLO_STATUS	2	// Send a status in front of the result
+#define HELLO_STREAM	4	// Text and key come in turns of STREAM_CHUNK
+#define HELLO_SEED	8	// A seed comes instead of the key
+#define HELLO_BINARY	16	// Text and key are bytes, XORed unchecked
+#define HELLO_CRC	32	// Every frame carries its CRC32C
+
+#define STREAM_CHUNK	(1024 * 1024)	// Bytes of text in one turn of a stream
+#define STREAM_HELD	4		// Turns a daemon holds of a stream at once
+
+#define SEED_KEY_BYTES		32	// ChaCha20 key of a seed
+#define SEED_NONCE_BYTES	8	// ChaCha20 nonce of a seed
+
+/* Sent ahead of the text when the hello has HELLO_SEED */
+struct otp_seed
+{
+	unsigned char key[SEED_KEY_BYTES];	// ChaCha20 key
+	unsigned char nonce[SEED_NONCE_BYTES];	// ChaCha20 nonce
+};
+
+/* Sent in front of the result when the hello asked for it */
+struct otp_status
+{
+	char code;		// STATUS_ code
+	char spare[3];		// Zero
+	uint32_t crc;		// CRC32C of the result with HELLO_CRC, network byte order
+	uint64_t offset;	// First bad character of the request, big endian
+};
+
+// Codes of the status
+#define STATUS_OK	'S'	// The result follows
+#define STATUS_BAD_TEXT	'T'	// Text has a bad character at offset, no result
+#define STATUS_BAD_KEY	'K'	// Key has a bad character at offset, no result
+#define STATUS_BAD_CRC	'C'	// Frame at offset failed its CRC32C, no result
+
+#define OFFSET_MAX	(1ULL << 62)	// Largest offset plus length a daemon takes
+
+/* Function: helloLength
+ * Parameters: hello
+ * Overview: Puts the two words of the length back together
+ * Pre: none
+ * Post: Returns the bytes of text
+ */
+static inline unsigned long long helloLength(const struct otp_hello *hello)
+{
+	return ((unsigned long long)ntohl(hello->length_hi) << 32) | ntohl(hello->length);
+}
+
+/* Function: helloSetLength
+ * Parameters: hello, bytes of text
+ * Overview: Splits the length into its two words
+ * Pre: none
+ * Post: Length of the hello is set
+ */
+static inline void helloSetLength(struct otp_hello *hello, unsigned long long length)
+{
+	hello->length = htonl((uint32_t)length);
+	hello->length_hi = htonl((uint32_t)(length >> 32));
+}
+
+/* Function: helloCharge
+ * Parameters: hello
+ * Overview: Bytes of the daemon's budget a request takes up.  A request
+ * 	is held in memory whole, except a streamed one which only ever holds
+ * 	STREAM_HELD chunks.
+ * Pre: none
+ * Post: Returns the bytes
+ */
+static inline unsigned long long helloCharge(const struct otp_hello *hello)
+{
+	// Set variables
+	unsigned long long length = helloLength(hello);	// Bytes of text
+
+	if ((ntohl(hello->flags) & HELLO_STREAM) && length > STREAM_HELD * STREAM_CHUNK)
+		return STREAM_HELD * STREAM_CHUNK;
+	return length;
+}
+
+#endif
@@ -0,0 +1,185 @@
+/*
+ * File otp_seed.c
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Expands a seed into a key of the 27 characters.  The key is
+ * 	cut into segments of SEED_SEGMENT characters and segment j is made
+ * 	from the ChaCha20 block with counter j * SEED_TRIES.  A byte of the
+ * 	block is a character only when it is below 243, the largest multiple
+ * 	of 27 a byte holds, so every character is equally likely.  About 61
+ * 	of the 64 bytes pass, and a block that falls short of a segment goes
+ * 	on to the next counters of the segment's SEED_TRIES.  That is so rare
+ * 	that running out of all of them only leaves the bias of a plain
+ * 	modulo in the one segment it happens to.
+ * Last Update: 06/03/2016
+ * Sources: Bernstein, ChaCha, a variant of Salsa20 - https://cr.yp.to/chacha/chacha-20080128.pdf
+ */
+
+// Include Libraries
+#include <stdio.h>	// Reading the seed file
+#include <ctype.h>	// Hex digits of the seed file
+#include <stdint.h>	// Words of the ChaCha20 state
+#include <string.h>	// Copying the state and the segments
+#include "otp_seed.h"
+
+#define SEED_ACCEPT	243	// Bytes below this make a character, 9 * 27
+
+#define ROTL(v, n)	(((v) << (n)) | ((v) >> (32 - (n))))
+#define QUARTER(a, b, c, d) \
+	a += b; d ^= a; d = ROTL(d, 16); \
+	c += d; b ^= c; b = ROTL(b, 12); \
+	a += b; d ^= a; d = ROTL(d, 8); \
+	c += d; b ^= c; b = ROTL(b, 7)
+
+static const char poss_chars[] = " ABCDEFGHIJKLMNOPQRSTUVWXYZ";	// Space and A-Z
+
+/* Function: loadLe32
+ * Parameters: four bytes
+ * Overview: Reads a little endian word
+ * Pre: none
+ * Post: Returns the word
+ */
+static uint32_t loadLe32(const unsigned char *b)
+{
+	return (uint32_t)b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+/* Function: chachaBlock
+ * Parameters: state, where the 64 bytes of the block go
+ * Overview: Runs the 20 rounds of ChaCha over the state
+ * Pre: State holds the constants, key, counter and nonce
+ * Post: out holds the block
+ */
+static void chachaBlock(const uint32_t in[16], unsigned char out[64])
+{
+	// Set variables
+	uint32_t x[16];		// Working state
+	int i;			// For the loops
+
+	memcpy(x, in, sizeof(x));
+	for (i = 0; i < 10; i++)
+	{
+		// Columns, then diagonals
+		QUARTER(x[0], x[4], x[8], x[12]);
+		QUARTER(x[1], x[5], x[9], x[13]);
+		QUARTER(x[2], x[6], x[10], x[14]);
+		QUARTER(x[3], x[7], x[11], x[15]);
+		QUARTER(x[0], x[5], x[10], x[15]);
+		QUARTER(x[1], x[6], x[11], x[12]);
+		QUARTER(x[2], x[7], x[8], x[13]);
+		QUARTER(x[3], x[4], x[9], x[14]);
+	}
+	for (i = 0; i < 16; i++)
+	{
+		x[i] += in[i];
+		out[4 * i] = (unsigned char)x[i];
+		out[4 * i + 1] = (unsigned char)(x[i] >> 8);
+		out[4 * i + 2] = (unsigned char)(x[i] >> 16);
+		out[4 * i + 3] = (unsigned char)(x[i] >> 24);
+	}
+}
+
+/* Function: seedSegment
+ * Parameters: state, segment number, where its characters go
+ * Overview: Makes the SEED_SEGMENT key characters of one segment
+ * Pre: State holds the constants, key and nonce
+ * Post: out holds the segment, the state's counter is changed
+ */
+static void seedSegment(uint32_t state[16], unsigned long long seg, char out[SEED_SEGMENT])
+{
+	// Set variables
+	unsigned char block[64];	// Block being used
+	unsigned long long counter;	// Its counter
+	int got = 0;			// Characters made so far
+	int t;				// Block of the segment
+	int i;				// Byte of the block
+
+	for (t = 0; t < SEED_TRIES && got < SEED_SEGMENT; t++)
+	{
+		counter = seg * SEED_TRIES + t;
+		state[12] = (uint32_t)counter;
+		state[13] = (uint32_t)(counter >> 32);
+		chachaBlock(state, block);
+		for (i = 0; i < 64 && got < SEED_SEGMENT; i++)
+		{
+			if (block[i] < SEED_ACCEPT)
+				out[got++] = poss_chars[block[i] % 27];
+		}
+	}
+	// Every try fell short, the last block fills in the rest
+	for (i = 0; got < SEED_SEGMENT; i++)
+		out[got++] = poss_chars[block[i] % 27];
+}
+
+/* Function: seedKeystream
+ * Parameters: seed, position of the first key character in the file, where
+ * 	the key goes, characters wanted
+ * Overview: Makes the key for a range of a file from its seed
+ * Pre: none
+ * Post: key holds length characters of space and A-Z
+ */
+void seedKeystream(const struct otp_seed *seed, unsigned long long pos, char *key, size_t length)
+{
+	// Set variables
+	uint32_t state[16];		// ChaCha20 state
+	char segment[SEED_SEGMENT];	// Characters of the current segment
+	unsigned long long seg = pos / SEED_SEGMENT;	// Segment of the first character
+	size_t skip = pos % SEED_SEGMENT;	// Characters of it before pos
+	size_t n;			// Characters taken from a segment
+	int i;				// For the loop
+
+	// "expand 32-byte k", then the key, the counter and the nonce
+	state[0] = 0x61707865;
+	state[1] = 0x3320646e;
+	state[2] = 0x79622d32;
+	state[3] = 0x6b206574;
+	for (i = 0; i < 8; i++)
+		state[4 + i] = loadLe32(seed->key + 4 * i);
+	state[14] = loadLe32(seed->nonce);
+	state[15] = loadLe32(seed->nonce + 4);
+
+	while (length > 0)
+	{
+		seedSegment(state, seg++, segment);
+		n = SEED_SEGMENT - skip < length ? SEED_SEGMENT - skip : length;
+		memcpy(key, segment + skip, n);
+		key += n;
+		length -= n;
+		skip = 0;
+	}
+}
+
+/* Function: seedRead
+ * Parameters: name of the seed file, where the seed goes
+ * Overview: Reads a seed file as keygen -s writes it: SEED_HEX hex digits,
+ * 	the key and then the nonce, and a newline
+ * Pre: none
+ * Post: Returns 0 with the seed filled in, -1 if the file can't be read or
+ * 	isn't a seed
+ */
+int seedRead(const char *name, struct otp_seed *seed)
+{
+	// Set variables
+	FILE *file;			// The seed file
+	char hex[SEED_HEX + 2];		// Its digits and the newline
+	unsigned char *bytes = (unsigned char *)seed;	// Key, then nonce
+	unsigned int byte;		// One byte read
+	size_t got;			// Characters in the file
+	int i;				// For the loop
+
+	file = fopen(name, "r");
+	if (file == NULL)
+		return -1;
+	got = fread(hex, 1, sizeof(hex), file);
+	fclose(file);
+	if (got < SEED_HEX || (got > SEED_HEX && hex[SEED_HEX] != '\n') || got == sizeof(hex))
+		return -1;
+	for (i = 0; i < SEED_HEX / 2; i++)
+	{
+		if (sscanf(hex + 2 * i, "%2x", &byte) != 1 || !isxdigit((unsigned char)hex[2 * i]) || !isxdigit((unsigned char)hex[2 * i + 1]))
+			return -1;
+		bytes[i] = (unsigned char)byte;
+	}
+	return 0;
+}
@@ -0,0 +1,29 @@
+/*
+ * File otp_seed.h
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Keys made from a seed, for traffic that doesn't need a true
+ * 	one-time pad.  Instead of a key as long as the text the client sends
+ * 	a ChaCha20 key and nonce, and the daemon expands them into a key of
+ * 	the same 27 characters.  The key character at any position of a file
+ * 	can be made without the ones before it, so striped and streamed
+ * 	requests each make just their own part.  A seed must never be used
+ * 	for two different texts, the same as a pad.
+ * Last Update: 06/03/2016
+ */
+
+#ifndef OTP_SEED_H
+#define OTP_SEED_H
+
+#include <stddef.h>	// size_t
+#include "otp_proto.h"
+
+#define SEED_SEGMENT	48	// Key characters made from one ChaCha20 block
+#define SEED_TRIES	4	// Blocks a segment may draw on
+#define SEED_HEX	(2 * (SEED_KEY_BYTES + SEED_NONCE_BYTES))	// Hex digits of a seed file
+
+void seedKeystream(const struct otp_seed *seed, unsigned long long pos, char *key, size_t length);
+int seedRead(const char *name, struct otp_seed *seed);
+
+#endif
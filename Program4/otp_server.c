@@ -0,0 +1,1711 @@
+/*
+ * File otp_server.c
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Listening side shared by otp_enc_d and otp_dec_d.  The daemon
+ * 	process never blocks on a client: it polls the listening socket, the
+ * 	clients whose hello hasn't arrived yet, and a pipe the SIGCHLD handler
+ * 	writes to.  Load is tracked as running workers, queue depth and the
+ * 	bytes running requests hold, a streamed one holding only a chunk
+ * 	however long it is.  A request is refused with 'M'
+ * 	before anything is forked when the connection table is full, when it
+ * 	could never fit the byte budget, when the queue is full, or when it has
+ * 	waited past its deadline.  All connection and worker slots are set up
+ * 	once at start, admission itself allocates nothing.
+ * 	Requests run in one of two lanes picked by their declared length, each
+ * 	with its own workers and queue, so a short request never waits behind
+ * 	long ones.  The small lane is first come first served.  The bulk lane
+ * 	runs the shortest job first, except that a job that has waited longer
+ * 	than the aging limit goes ahead of everything not yet aged.  A small
+ * 	request may borrow an idle bulk worker, but only while no bulk job is
+ * 	waiting for it, so bulk jobs can't be starved by small ones.
+ * 	Clients are told apart by source address.  Each one is held to the
+ * 	token bucket limits of otp_fair.c when its hello arrives, and inside
+ * 	a lane every client has its own queue.  The queues take turns by
+ * 	deficit round robin: a client's turn lets it start up to a quantum of
+ * 	bytes, so one client with many requests waiting gets the same share
+ * 	of the workers as one with a single request.  SIGHUP reads the
+ * 	limits file again.
+ * 	Deadlines of held clients sit in a timer wheel, so the loop only looks
+ * 	at the clients whose time is up and a client that never sends its
+ * 	hello costs nothing until it is dropped.  Once a worker has a client
+ * 	the deadlines of otp_io.c take over.
+ * 	A client may ask to keep its connection.  Its worker then serves the
+ * 	next requests on it itself, and lets the connection go after hello_ms
+ * 	without a hello or KEEP_MAX requests.  Each of those requests is
+ * 	first passed to the daemon over the worker's control socket and
+ * 	admitted there as a new one would be: charged to the client's
+ * 	buckets, held to the byte budget with the worker's bytes changed to
+ * 	its own, and refused with 'M' when requests are waiting in its lane
+ * 	or the worker's, or when it is a bulk request on a small worker.  A
+ * 	refused client starts over on a new connection, through the queue.
+ * 	Small requests that don't keep their connection are not forked one
+ * 	by one.  The small lane hands them to an open batch instead, which
+ * 	holds a worker slot from the moment it opens.  The batch is forked
+ * 	as one worker once it has batch_max requests, once batch_us have
+ * 	passed since it opened, or as soon as the lane has requests it can't
+ * 	take, so a batch only waits while the lane is keeping up anyway.
+ * 	With a restart socket a new daemon takes over the listening socket
+ * 	of this one (otp_handoff.c).  This one then accepts nothing more but
+ * 	still serves every client it accepted, tells its workers to let kept
+ * 	connections go after the request they are on, and exits once the
+ * 	last of them is done.
+ * 	Given a CPU list every worker gets a home CPU of it (otp_place.c).
+ * 	A connection's home is the CPU SO_INCOMING_CPU says its packets
+ * 	came in on, as long as that one runs no more workers than the least
+ * 	busy CPU of the list, otherwise the least busy one, on the same node
+ * 	when there is a choice.  Small requests and batches run on their
+ * 	home CPU alone, bulk ones on the listed CPUs of its node so the
+ * 	stages of a stream don't take turns on one CPU.
+ * Last Update: 06/03/2016
+ * Sources: Operating Systems Lectures 15, 16, and 17.
+ *   Beej's Guide to Network Programming - http://beej.us/guide/bgnet/output/html/singlepage/bgnet.html
+ *   The self-pipe trick - http://cr.yp.to/docs/selfpipe.html
+ *   Shreedhar and Varghese, Efficient Fair Queuing using Deficit Round Robin, SIGCOMM 1995
+ *   Varghese and Lauck, Hashed and Hierarchical Timing Wheels, SOSP 1987
+ */
+
+// Include Libraries
+#define _GNU_SOURCE	// accept4 and pipe2
+#include <stdio.h>	// General IO, including printf to redirect files
+#include <stdlib.h>	// General purpose functions
+#include <string.h>	// Manipulation of C strings and arrays
+#include <errno.h>	// Checking results of non-blocking calls
+#include <signal.h>	// SIGCHLD, SIGINT and SIGUSR2 handling
+#include <time.h>	// Monotonic clock for deadlines
+#include <poll.h>	// Waiting on the listener, clients and children
+#include <fcntl.h>	// Switching sockets between blocking modes
+#include <unistd.h>	// Provides access to the POSIX API
+#include <sys/types.h>	// For networking with sockets
+#include <sys/wait.h>	// Reaping workers
+#include <sys/socket.h>	// Makes available for the use of sockets
+#include <netinet/in.h>	// Makes available access to network addresses
+#include <arpa/inet.h>	// Makes available ports
+#include "otp_fair.h"
+#include "otp_handoff.h"
+#include "otp_io.h"
+#include "otp_metrics.h"
+#include "otp_place.h"
+#include "otp_server.h"
+
+// States of a connection slot
+#define CONN_FREE	0	// Slot is unused
+#define CONN_HELLO	1	// Accepted, hello not complete yet
+#define CONN_QUEUED	2	// Hello read, waiting for a worker
+#define CONN_BATCH	3	// In the open batch, waiting for it to start
+
+// Lanes requests are scheduled in
+#define LANE_SMALL	0	// Declared length up to small_bytes
+#define LANE_BULK	1	// Everything longer
+#define LANES		2
+
+#define KEEP_MAX	1000	// Requests one kept connection may make
+#define BATCH_LIMIT	256	// Largest batch_max
+
+#define REQ_COST	512	// Bytes a request costs in round robin besides its length
+#define FAIR_CLIENTS	1024	// Clients remembered besides those connected
+
+// Timer wheel of the held clients' deadlines
+#define WHEEL_TICK_MS	10	// Time one wheel slot covers
+#define WHEEL_SLOTS	512	// Slots, a turn of the wheel is 5.12 seconds
+
+/* A client the daemon process is holding on to */
+struct conn
+{
+	int state;			// One of the CONN_ states
+	int fd;				// Client socket
+	unsigned long long accepted;	// Time of accept in ms
+	unsigned long long deadline;	// Time to give up on it in ms
+	int timer_next;			// Next client in its wheel slot, -1 at the end
+	int timer_prev;			// Client before it, -1 at the front
+	int timer_slot;			// Wheel slot it is in, -1 if none
+	int got;			// Bytes of hello read so far
+	struct otp_hello hello;		// The hello
+	int client;			// Entry of its source in the client table
+	int cpu;			// CPU its packets came in on, -1 if unknown
+	int lane;			// Lane the request is scheduled in
+	int next;			// Next slot in the queue, -1 at the end
+};
+
+/* Queue of one client in one lane */
+struct flow
+{
+	int head;			// First queued slot, -1 if empty
+	int tail;			// Last queued slot, -1 if empty
+	long long deficit;		// Bytes it may still start this round
+	int topped;			// Quantum already added this turn
+	int active;			// On the lane's round robin list
+	int next;			// Next client on that list, -1 at the end
+};
+
+/* A running worker */
+struct worker
+{
+	pid_t pid;			// Worker process, 0 when the slot is free
+	unsigned long long bytes;	// Bytes its request holds
+	int lane;			// Lane whose worker it is
+	int home;			// Index of its home CPU in the list, -1 if not pinned
+	int ctl;			// Daemon's end of its control socket, -1 if none
+	int client;			// Entry of its client while it has a control socket
+};
+
+/* Workers and queue of one lane */
+struct lane
+{
+	const char *name;		// "small" or "bulk" for the metrics log
+	int workers;			// Workers the lane may run at once
+	int running;			// Workers running
+	int head;			// First client with requests queued, -1 if none
+	int tail;			// Last client with requests queued, -1 if none
+	int queued;			// Requests in all of its queues
+};
+
+/* Everything the daemon process keeps track of */
+struct server
+{
+	struct server_conf *conf;	// Settings
+	int listen_fd;			// Listening socket, -1 once handed over
+	int handoff_fd;			// Restart socket, -1 if none
+	int draining;			// Handed over, exits when idle
+	int sig_pipe[2];		// SIGCHLD handler writes to [1]
+	struct conn *conns;		// Connection slots
+	int max_conns;			// Number of connection slots
+	struct worker *workers;		// Worker slots
+	int max_running;		// Worker slots of both lanes
+	int running;			// Workers running
+	unsigned long long inflight;	// Bytes running requests hold
+	struct lane lanes[LANES];	// Small and bulk lanes
+	int queued;			// Requests in both queues
+	struct fair_table fair;		// Every client and its buckets
+	struct flow *flows;		// Queue of every client in every lane
+	unsigned long long last_expire;	// Time idle clients were last dropped
+	int wheel[WHEEL_SLOTS];		// First client of every wheel slot
+	unsigned long long wheel_tick;	// Tick the wheel has been turned to
+	int pending;			// Connections waiting on their hello
+	struct pollfd *fds;		// poll set, listener, pipe, restart socket, then clients
+	int *fd_conn;			// Slot of each client, worker of each control socket, in the poll set
+	int *batch;			// Slots of the open batch
+	int batched;			// Requests in the open batch, 0 when none is open
+	int batch_lane;			// Lane whose worker slot the batch holds
+	unsigned long long batch_bytes;	// Bytes the batch holds
+	unsigned long long batch_opened;	// Time the batch opened in us
+	int *batch_fds;			// Sockets of a batch, for its worker
+	struct otp_hello *batch_hellos;	// Hellos of a batch, for its worker
+	struct place place;		// CPUs workers are pinned to
+	int *cpu_load;			// Workers running on each of them
+};
+
+static int sig_fd = -1;			// Write end of the self pipe
+static struct server_conf *worker_conf = NULL;	// Settings, for kept connections
+static int kept = 0;			// Requests the worker served after the first
+static int worker_ctl = -1;		// Worker's end of its control socket, -1 if none
+static volatile sig_atomic_t worker_drain = 0;	// Let kept connections go, the daemon was replaced
+
+/* Function: nowMsec
+ * Parameters: none
+ * Overview: Reads the monotonic clock
+ * Pre: none
+ * Post: Returns the time in milliseconds
+ */
+static unsigned long long nowMsec(void)
+{
+	// Set variables
+	struct timespec ts;		// Current time
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Function: nowUsec
+ * Parameters: none
+ * Overview: Reads the monotonic clock finely enough for the batch window
+ * Pre: none
+ * Post: Returns the time in microseconds
+ */
+static unsigned long long nowUsec(void)
+{
+	// Set variables
+	struct timespec ts;		// Current time
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Function: catchSignal
+ * Parameters: signal number
+ * Overview: SIGCHLD and SIGHUP handler, wakes up the poll loop
+ * Pre: Self pipe is set up
+ * Post: 'C' for a child or 'H' for a hang up is in the pipe
+ */
+static void catchSignal(int sig)
+{
+	// Set variables
+	int saved = errno;		// The handler must not change errno
+	char wake = sig == SIGHUP ? 'H' : 'C';	// Which signal it was
+
+	if (write(sig_fd, &wake, 1) < 0)
+	{
+		// Pipe is full, the loop is waking up anyway
+	}
+	errno = saved;
+}
+
+/* Function: catchDrain
+ * Parameters: signal number
+ * Overview: SIGUSR2 handler of a worker, the daemon that forked it was
+ * 	replaced and the worker should finish up
+ * Pre: none
+ * Post: serverNextHello lets the connection go
+ */
+static void catchDrain(int sig)
+{
+	(void)sig;
+	worker_drain = 1;
+}
+
+/* Function: timerDel
+ * Parameters: server, slot
+ * Overview: Takes a client's deadline off the wheel
+ * Pre: none
+ * Post: Client has no deadline armed
+ */
+static void timerDel(struct server *srv, int slot)
+{
+	// Set variables
+	struct conn *c = &srv->conns[slot];	// The client
+
+	if (c->timer_slot == -1)
+		return;
+	if (c->timer_prev == -1)
+		srv->wheel[c->timer_slot] = c->timer_next;
+	else
+		srv->conns[c->timer_prev].timer_next = c->timer_next;
+	if (c->timer_next != -1)
+		srv->conns[c->timer_next].timer_prev = c->timer_prev;
+	c->timer_slot = -1;
+}
+
+/* Function: timerAdd
+ * Parameters: server, slot, deadline in ms
+ * Overview: Arms a client's deadline, replacing any it had.  A deadline
+ * 	more than a turn away shares a slot with nearer ones and is simply
+ * 	passed over until its turn comes.
+ * Pre: none
+ * Post: Client is in the wheel slot of its deadline
+ */
+static void timerAdd(struct server *srv, int slot, unsigned long long deadline)
+{
+	// Set variables
+	struct conn *c = &srv->conns[slot];	// The client
+	unsigned long long tick = deadline / WHEEL_TICK_MS;	// Tick it is due
+
+	timerDel(srv, slot);
+	// A deadline already behind the wheel is due at the next turn of it
+	if (tick < srv->wheel_tick)
+		tick = srv->wheel_tick;
+	c->deadline = deadline;
+	c->timer_slot = tick % WHEEL_SLOTS;
+	c->timer_prev = -1;
+	c->timer_next = srv->wheel[c->timer_slot];
+	if (c->timer_next != -1)
+		srv->conns[c->timer_next].timer_prev = slot;
+	srv->wheel[c->timer_slot] = slot;
+}
+
+/* Function: serverDefaults
+ * Parameters: settings, program name, tag, worker entry point
+ * Overview: Fills in the default settings of a daemon
+ * Pre: none
+ * Post: Settings are ready for serverParseArgs
+ */
+void serverDefaults(struct server_conf *conf, const char *prog, const char *tag, server_handler handler)
+{
+	memset(conf, 0, sizeof(*conf));
+	conf->prog = prog;
+	conf->tag = tag;
+	conf->handler = handler;
+	conf->max_workers = 5;
+	conf->small_workers = 2;
+	conf->small_bytes = 1024;
+	conf->age_ms = 1000;
+	conf->queue_len = 64;
+	conf->queue_ms = 5000;
+	conf->hello_ms = 2000;
+	conf->io_ms = 5000;
+	conf->min_rate = 1024;
+	conf->max_inflight = 64ULL << 20;
+	conf->batch_max = 16;
+	conf->batch_us = 100;
+}
+
+/* Function: serverUsage
+ * Parameters: settings
+ * Overview: Prints how to run the daemon
+ * Pre: none
+ * Post: Exits with 1
+ */
+static void serverUsage(struct server_conf *conf)
+{
+	fprintf(stderr, "%s Usage: %s [-c bulk_workers] [-S small_workers] [-s small_bytes] [-a age_ms]\n"
+		"\t[-q queue_len] [-w queue_ms] [-b inflight_bytes] [-L limits_file]\n"
+		"\t[-H hello_ms] [-t io_ms] [-r min_rate] [-B batch_max] [-u batch_us]\n"
+		"\t[-R restart_socket] [-C cpu_list] <port_number>\n",
+		conf->prog, conf->prog);
+	exit(1);
+}
+
+/* Function: serverParseArgs
+ * Parameters: settings, number of arguments, the arguments
+ * Overview: Reads the options and the port number
+ * Pre: serverDefaults was called
+ * Post: Settings are filled in, exits with usage on bad arguments
+ */
+void serverParseArgs(struct server_conf *conf, int argc, char *argv[])
+{
+	// Set variables
+	int opt;		// Current option
+
+	while ((opt = getopt(argc, argv, "c:S:s:a:q:w:b:L:H:t:r:B:u:R:C:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'c': conf->max_workers = atoi(optarg); break;
+		case 'S': conf->small_workers = atoi(optarg); break;
+		case 's': conf->small_bytes = strtoull(optarg, NULL, 10); break;
+		case 'a': conf->age_ms = atoi(optarg); break;
+		case 'q': conf->queue_len = atoi(optarg); break;
+		case 'w': conf->queue_ms = atoi(optarg); break;
+		case 'b': conf->max_inflight = strtoull(optarg, NULL, 10); break;
+		case 'L': conf->limits_path = optarg; break;
+		case 'H': conf->hello_ms = atoi(optarg); break;
+		case 't': conf->io_ms = atoi(optarg); break;
+		case 'r': conf->min_rate = strtoull(optarg, NULL, 10); break;
+		case 'B': conf->batch_max = atoi(optarg); break;
+		case 'u': conf->batch_us = atoi(optarg); break;
+		case 'R': conf->restart_path = optarg; break;
+		case 'C': conf->cpu_list = optarg; break;
+		default: serverUsage(conf);
+		}
+	}
+	// Check to make sure there is one argument of the port number
+	if (optind != argc - 1 || conf->max_workers < 1 || conf->small_workers < 1 || conf->age_ms < 1 || conf->queue_len < 0 || conf->queue_ms < 1 ||
+		conf->hello_ms < 1 || conf->io_ms < 1 || conf->batch_max < 1 || conf->batch_max > BATCH_LIMIT || conf->batch_us < 0)
+		serverUsage(conf);
+	conf->port = atoi(argv[optind]);
+}
+
+/* Function: connDone
+ * Parameters: server, slot
+ * Overview: Lets go of a client the daemon process was holding
+ * Pre: Slot is in use and not on a queue
+ * Post: Socket is closed, slot and the client's reference are free
+ */
+static void connDone(struct server *srv, int slot)
+{
+	// Set variables
+	struct conn *c = &srv->conns[slot];	// The client
+
+	if (c->state == CONN_HELLO)
+		srv->pending--;
+	timerDel(srv, slot);
+	close(c->fd);
+	fairRelease(&srv->fair, c->client);
+	c->state = CONN_FREE;
+}
+
+/* Function: reject
+ * Parameters: server, slot, reply, reason for the metrics log
+ * Overview: Turns a client away and frees its slot
+ * Pre: Slot is in use and already taken off the queue
+ * Post: Client got the reply and is closed
+ */
+static void reject(struct server *srv, int slot, char reply, const char *reason)
+{
+	// Set variables
+	struct conn *c = &srv->conns[slot];	// The client
+
+	metricsEmit("reject reason=%s waited_ms=%llu queued=%d running=%d inflight_bytes=%llu",
+		reason, nowMsec() - c->accepted, srv->queued, srv->running, srv->inflight);
+	if (send(c->fd, &reply, 1, MSG_NOSIGNAL | MSG_DONTWAIT) < 0)
+	{
+		// The client is gone, nothing more to tell it
+	}
+	connDone(srv, slot);
+}
+
+/* Function: workerDetach
+ * Parameters: server, slot the worker serves, -1 for the open batch
+ * Overview: Cuts a freshly forked worker loose from the daemon process.  The
+ * 	worker closes every socket that isn't its own so clients see their
+ * 	hang ups.
+ * Pre: Runs in the child right after fork
+ * Post: Signals are back to default, only the worker's clients are open
+ */
+static void workerDetach(struct server *srv, int slot)
+{
+	// Set variables
+	struct sigaction act;			// Signal settings for the worker
+	int i;					// For the loop
+
+	// Set signals back to default when executing, SIGUSR2 keeps its
+	// handler so a worker forked before the daemon was replaced still
+	// hears about it
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = SIG_DFL;
+	sigaction(SIGINT, &act, NULL);
+	sigaction(SIGCHLD, &act, NULL);
+	sigaction(SIGHUP, &act, NULL);
+	sigaction(SIGPIPE, &act, NULL);
+	// Close the server sockets, the self pipe and every other client
+	if (srv->listen_fd != -1)
+		close(srv->listen_fd);
+	if (srv->handoff_fd != -1)
+		close(srv->handoff_fd);
+	close(srv->sig_pipe[0]);
+	close(srv->sig_pipe[1]);
+	for (i = 0; i < srv->max_conns; i++)
+	{
+		if (srv->conns[i].state == CONN_FREE || i == slot || (slot == -1 && srv->conns[i].state == CONN_BATCH))
+			continue;
+		close(srv->conns[i].fd);
+	}
+	for (i = 0; i < srv->max_running; i++)
+	{
+		if (srv->workers[i].pid != 0 && srv->workers[i].ctl != -1)
+			close(srv->workers[i].ctl);
+	}
+}
+
+/* Function: pickHome
+ * Parameters: server, CPU the client's packets came in on
+ * Overview: Picks the home CPU of a new worker, see the overview
+ * Pre: none
+ * Post: Returns the CPU's index in the list, -1 when workers aren't pinned
+ */
+static int pickHome(struct server *srv, int cpu)
+{
+	// Set variables
+	struct place *pl = &srv->place;	// The CPU list
+	int incoming = placeIndex(pl, cpu);	// The client's CPU in it
+	int node = incoming == -1 ? -1 : pl->nodes[incoming];	// And its node
+	int best = -1;			// Least busy so far
+	int i;				// For the loop
+
+	if (pl->count == 0)
+		return -1;
+	for (i = 0; i < pl->count; i++)
+	{
+		if (best == -1 || srv->cpu_load[i] < srv->cpu_load[best] ||
+			(srv->cpu_load[i] == srv->cpu_load[best] && pl->nodes[i] == node && pl->nodes[best] != node))
+			best = i;
+	}
+	if (incoming != -1 && srv->cpu_load[incoming] <= srv->cpu_load[best])
+		return incoming;
+	return best;
+}
+
+/* Function: startWorker
+ * Parameters: server, slot, lane whose worker runs it
+ * Overview: Forks a worker for an admitted request
+ * Pre: Slot holds a complete hello and the lane has room to run it
+ * Post: Worker is running and the slot is free
+ */
+static void startWorker(struct server *srv, int slot, int lane)
+{
+	// Set variables
+	struct conn *c = &srv->conns[slot];	// The client
+	unsigned long long bytes = helloCharge(&c->hello);	// Bytes it holds
+	int home = pickHome(srv, c->cpu);	// CPU it runs on
+	int ctl[2] = { -1, -1 };		// Control socket of a kept connection
+	pid_t pid;				// Worker process
+	int i;					// For the loop
+
+	// Without a control socket the worker serves only this request
+	if ((ntohl(c->hello.flags) & HELLO_KEEP) && socketpair(AF_UNIX, SOCK_SEQPACKET, 0, ctl) == -1)
+	{
+		ctl[0] = -1;
+		ctl[1] = -1;
+	}
+	pid = fork();
+	if (pid < 0)
+	{
+		fprintf(stderr, "%s ERROR: Failed in fork\n", srv->conf->prog);
+		if (ctl[0] != -1)
+		{
+			close(ctl[0]);
+			close(ctl[1]);
+		}
+		reject(srv, slot, REPLY_BUSY, "fork");
+		return;
+	}
+	if (pid == 0)
+	{
+		workerDetach(srv, slot);
+		if (ctl[0] != -1)
+			close(ctl[0]);
+		worker_ctl = ctl[1];
+		if (home != -1)
+			placeWorker(&srv->place, home, c->lane == LANE_BULK);
+		srv->conf->handler(c->fd, &c->hello);
+		exit(0);
+	}
+
+	metricsEmit("admit lane=%s worker=%s waited_ms=%llu queued=%d running=%d inflight_bytes=%llu length=%llu offset=%llu cpu=%d",
+		srv->lanes[c->lane].name, srv->lanes[lane].name, nowMsec() - c->accepted,
+		srv->queued, srv->running + 1, srv->inflight + bytes, helloLength(&c->hello),
+		(unsigned long long)be64toh(c->hello.offset), home == -1 ? -1 : srv->place.cpus[home]);
+	for (i = 0; i < srv->max_running; i++)
+	{
+		if (srv->workers[i].pid == 0)
+		{
+			srv->workers[i].pid = pid;
+			srv->workers[i].bytes = bytes;
+			srv->workers[i].lane = lane;
+			srv->workers[i].home = home;
+			srv->workers[i].ctl = ctl[0];
+			srv->workers[i].client = c->client;
+			break;
+		}
+	}
+	if (ctl[0] != -1)
+	{
+		close(ctl[1]);
+		fairHold(&srv->fair, c->client);
+	}
+	if (home != -1)
+		srv->cpu_load[home]++;
+	srv->lanes[lane].running++;
+	srv->running++;
+	srv->inflight += bytes;
+	connDone(srv, slot);
+}
+
+/* Function: laneFor
+ * Parameters: server, bytes the request holds, lane it was sorted into
+ * Overview: Picks the lane whose worker a request may run on right now,
+ * 	checking the lane limits and the byte budget.  A small request may
+ * 	use a bulk worker when the small ones are busy and no bulk job is
+ * 	waiting.
+ * Pre: none
+ * Post: Returns the lane to run on, -1 if the request has to wait
+ */
+static int laneFor(struct server *srv, unsigned long long bytes, int lane)
+{
+	// Set variables
+	struct lane *bulk = &srv->lanes[LANE_BULK];	// The bulk lane
+
+	if (srv->inflight + bytes > srv->conf->max_inflight)
+		return -1;
+	if (srv->lanes[lane].running < srv->lanes[lane].workers)
+		return lane;
+	if (lane == LANE_SMALL && bulk->queued == 0 && bulk->running < bulk->workers)
+		return LANE_BULK;
+	return -1;
+}
+
+/* Function: batchable
+ * Parameters: server, slot
+ * Overview: Tells whether a request may go in a batch: a small one that
+ * 	neither keeps its connection, streams, sends a seed, is binary nor
+ * 	carries CRCs, on a daemon that batches
+ * Pre: Slot holds a complete hello and its lane is set
+ * Post: Returns 1 if it may, 0 if it needs a worker of its own
+ */
+static int batchable(struct server *srv, int slot)
+{
+	// Set variables
+	struct conn *c = &srv->conns[slot];	// The client
+
+	return srv->conf->batch != NULL && srv->conf->batch_max > 1 && c->lane == LANE_SMALL &&
+		(ntohl(c->hello.flags) & (HELLO_KEEP | HELLO_STREAM | HELLO_SEED | HELLO_BINARY | HELLO_CRC)) == 0;
+}
+
+/* Function: batchRoom
+ * Parameters: server, bytes the request holds, lane it was sorted into
+ * Overview: Like laneFor for a request that goes in a batch.  An open batch
+ * 	already holds its worker slot, so it only needs room in the byte budget.
+ * Pre: none
+ * Post: Returns the lane of the batch's worker, -1 if the request has to wait
+ */
+static int batchRoom(struct server *srv, unsigned long long bytes, int lane)
+{
+	if (srv->batched == 0)
+		return laneFor(srv, bytes, lane);
+	if (srv->inflight + bytes > srv->conf->max_inflight)
+		return -1;
+	return srv->batch_lane;
+}
+
+/* Function: startBatch
+ * Parameters: server
+ * Overview: Forks one worker for the whole open batch
+ * Pre: A batch is open
+ * Post: Worker is running on the batch's worker slot, no batch is open
+ */
+static void startBatch(struct server *srv)
+{
+	// Set variables
+	int home = pickHome(srv, srv->conns[srv->batch[0]].cpu);	// CPU it runs on
+	pid_t pid;				// Worker process
+	int i;					// For the loops
+
+	pid = fork();
+	if (pid < 0)
+	{
+		fprintf(stderr, "%s ERROR: Failed in fork\n", srv->conf->prog);
+		for (i = 0; i < srv->batched; i++)
+			reject(srv, srv->batch[i], REPLY_BUSY, "fork");
+		srv->lanes[srv->batch_lane].running--;
+		srv->running--;
+		srv->inflight -= srv->batch_bytes;
+		srv->batched = 0;
+		return;
+	}
+	if (pid == 0)
+	{
+		workerDetach(srv, -1);
+		if (home != -1)
+			placeWorker(&srv->place, home, 0);
+		for (i = 0; i < srv->batched; i++)
+		{
+			srv->batch_fds[i] = srv->conns[srv->batch[i]].fd;
+			srv->batch_hellos[i] = srv->conns[srv->batch[i]].hello;
+		}
+		srv->conf->batch(srv->batch_fds, srv->batch_hellos, srv->batched);
+		exit(0);
+	}
+
+	metricsEmit("batch worker=%s requests=%d bytes=%llu held_us=%llu cpu=%d",
+		srv->lanes[srv->batch_lane].name, srv->batched, srv->batch_bytes, nowUsec() - srv->batch_opened,
+		home == -1 ? -1 : srv->place.cpus[home]);
+	for (i = 0; i < srv->max_running; i++)
+	{
+		if (srv->workers[i].pid == 0)
+		{
+			srv->workers[i].pid = pid;
+			srv->workers[i].bytes = srv->batch_bytes;
+			srv->workers[i].lane = srv->batch_lane;
+			srv->workers[i].home = home;
+			srv->workers[i].ctl = -1;
+			break;
+		}
+	}
+	if (home != -1)
+		srv->cpu_load[home]++;
+	for (i = 0; i < srv->batched; i++)
+		connDone(srv, srv->batch[i]);
+	srv->batched = 0;
+}
+
+/* Function: batchAdd
+ * Parameters: server, slot, lane whose worker runs the batch
+ * Overview: Puts an admitted request in the open batch, opening one if there
+ * 	is none.  A new batch takes its worker slot right away so nothing else
+ * 	starts on it while the batch fills up.
+ * Pre: Request is batchable and batchRoom gave the lane
+ * Post: Request is in the batch, which was started if it is full
+ */
+static void batchAdd(struct server *srv, int slot, int lane)
+{
+	// Set variables
+	struct conn *c = &srv->conns[slot];	// The client
+	unsigned long long bytes = helloCharge(&c->hello);	// Bytes it holds
+
+	if (srv->batched == 0)
+	{
+		srv->batch_lane = lane;
+		srv->batch_bytes = 0;
+		srv->batch_opened = nowUsec();
+		srv->lanes[lane].running++;
+		srv->running++;
+	}
+	metricsEmit("admit lane=%s worker=%s waited_ms=%llu queued=%d running=%d inflight_bytes=%llu length=%llu offset=%llu",
+		srv->lanes[c->lane].name, srv->lanes[lane].name, nowMsec() - c->accepted,
+		srv->queued, srv->running, srv->inflight + bytes, helloLength(&c->hello),
+		(unsigned long long)be64toh(c->hello.offset));
+	timerDel(srv, slot);
+	c->state = CONN_BATCH;
+	srv->batch[srv->batched++] = slot;
+	srv->batch_bytes += bytes;
+	srv->inflight += bytes;
+	if (srv->batched == srv->conf->batch_max)
+		startBatch(srv);
+}
+
+/* Function: enqueue
+ * Parameters: server, slot
+ * Overview: Puts a request at the end of its client's queue in its lane,
+ * 	and the client on the lane's round robin list if it wasn't there
+ * Pre: Slot holds a complete hello and its lane is set
+ * Post: Request is queued
+ */
+static void enqueue(struct server *srv, int slot)
+{
+	// Set variables
+	struct conn *c = &srv->conns[slot];		// The client
+	struct lane *l = &srv->lanes[c->lane];		// Its lane
+	struct flow *f = &srv->flows[c->client * LANES + c->lane];	// Its queue
+
+	c->state = CONN_QUEUED;
+	c->next = -1;
+	timerAdd(srv, slot, c->accepted + srv->conf->queue_ms);
+	if (f->tail == -1)
+		f->head = slot;
+	else
+		srv->conns[f->tail].next = slot;
+	f->tail = slot;
+	if (!f->active)
+	{
+		f->active = 1;
+		f->next = -1;
+		if (l->tail == -1)
+			l->head = c->client;
+		else
+			srv->flows[l->tail * LANES + c->lane].next = c->client;
+		l->tail = c->client;
+	}
+	l->queued++;
+	srv->queued++;
+}
+
+/* Function: dequeue
+ * Parameters: server, slot, queued slot before it or -1
+ * Overview: Takes a request out of its client's queue.  The client stays on
+ * 	the round robin list until its turn comes up with nothing queued.
+ * Pre: Slot is queued right after prev
+ * Post: Slot is off the queue
+ */
+static void dequeue(struct server *srv, int slot, int prev)
+{
+	// Set variables
+	struct conn *c = &srv->conns[slot];		// The client
+	struct flow *f = &srv->flows[c->client * LANES + c->lane];	// Its queue
+
+	if (prev == -1)
+		f->head = c->next;
+	else
+		srv->conns[prev].next = c->next;
+	if (f->tail == slot)
+		f->tail = prev;
+	srv->lanes[c->lane].queued--;
+	srv->queued--;
+}
+
+/* Function: pickBulk
+ * Parameters: server, client's bulk queue, current time, slot before the
+ * 	pick to fill in
+ * Overview: Chooses the client's next bulk job: the oldest one that has
+ * 	waited past the aging limit, otherwise the shortest one.  The queue is
+ * 	in arrival order so the first aged job found is the oldest.
+ * Pre: Queue is not empty
+ * Post: Returns the slot, prev is the queued slot before it
+ */
+static int pickBulk(struct server *srv, struct flow *f, unsigned long long now, int *prev)
+{
+	// Set variables
+	int best = -1;			// Shortest job so far
+	int best_prev = -1;		// Slot before it
+	int before = -1;		// Slot before the one checked
+	int slot;			// Slot being checked
+
+	for (slot = f->head; slot != -1; slot = srv->conns[slot].next)
+	{
+		if (now - srv->conns[slot].accepted >= (unsigned long long)srv->conf->age_ms)
+		{
+			*prev = before;
+			return slot;
+		}
+		if (best == -1 || helloLength(&srv->conns[slot].hello) < helloLength(&srv->conns[best].hello))
+		{
+			best = slot;
+			best_prev = before;
+		}
+		before = slot;
+	}
+	*prev = best_prev;
+	return best;
+}
+
+/* Function: dispatchLane
+ * Parameters: server, lane, current time
+ * Overview: Deficit round robin over the clients with requests queued in a
+ * 	lane.  The client at the front gets a quantum of bytes added once per
+ * 	turn and starts requests while they fit in its deficit, then goes to
+ * 	the back.  A client left with nothing queued drops off the list and
+ * 	loses what it had saved up.
+ * Pre: none
+ * Post: Lane has nothing queued or no room for the next request
+ */
+static void dispatchLane(struct server *srv, int lane, unsigned long long now)
+{
+	// Set variables
+	struct lane *l = &srv->lanes[lane];	// The lane
+	struct flow *f;			// Queue of the client at the front
+	int client;			// Client at the front
+	int slot;			// Request to start
+	int prev;			// Queued slot before it
+	int run_on;			// Lane whose worker runs it
+	int batch;			// Request goes in a batch
+	long long cost;			// Round robin cost of the request
+
+	while ((client = l->head) != -1)
+	{
+		f = &srv->flows[client * LANES + lane];
+		if (f->head == -1)
+		{
+			// Nothing left, off the list
+			l->head = f->next;
+			if (l->head == -1)
+				l->tail = -1;
+			f->active = 0;
+			f->topped = 0;
+			f->deficit = 0;
+			continue;
+		}
+		if (!f->topped)
+		{
+			f->deficit += srv->fair.limits.quantum;
+			f->topped = 1;
+		}
+
+		if (lane == LANE_BULK)
+			slot = pickBulk(srv, f, now, &prev);
+		else
+		{
+			slot = f->head;
+			prev = -1;
+		}
+		cost = (long long)helloLength(&srv->conns[slot].hello) + REQ_COST;
+		if (cost > f->deficit)
+		{
+			// Turn is over, to the back of the list
+			f->topped = 0;
+			if (l->tail != client)
+			{
+				l->head = f->next;
+				f->next = -1;
+				srv->flows[l->tail * LANES + lane].next = client;
+				l->tail = client;
+			}
+			continue;
+		}
+
+		batch = batchable(srv, slot);
+		if (batch)
+			run_on = batchRoom(srv, helloCharge(&srv->conns[slot].hello), lane);
+		else
+			run_on = laneFor(srv, helloCharge(&srv->conns[slot].hello), lane);
+		if (run_on == -1)
+			return;
+		f->deficit -= cost;
+		dequeue(srv, slot, prev);
+		if (batch)
+			batchAdd(srv, slot, run_on);
+		else
+			startWorker(srv, slot, run_on);
+	}
+}
+
+/* Function: dispatch
+ * Parameters: server
+ * Overview: Starts queued requests while their lanes have room.  Bulk jobs
+ * 	are started first so a waiting bulk job keeps its workers from being
+ * 	borrowed by small requests.
+ * Pre: none
+ * Post: Neither lane has a request that could run now
+ */
+static void dispatch(struct server *srv)
+{
+	// Set variables
+	unsigned long long now = nowMsec();	// Current time for aging
+
+	dispatchLane(srv, LANE_BULK, now);
+	dispatchLane(srv, LANE_SMALL, now);
+}
+
+/* Function: admit
+ * Parameters: server, slot with a complete hello
+ * Overview: Decides what happens to a request: run, wait or refuse
+ * Pre: Hello is complete
+ * Post: Request is running, queued or turned away
+ */
+static void admit(struct server *srv, int slot)
+{
+	// Set variables
+	struct conn *c = &srv->conns[slot];		// The client
+	unsigned long long bytes = helloLength(&c->hello);	// Declared length
+	unsigned long long charge = helloCharge(&c->hello);	// Bytes it would hold
+	int lane;					// Lane whose worker runs it
+
+	// A client meant for the other daemon
+	if (c->hello.tag[3] != 0 || strcmp(c->hello.tag, srv->conf->tag) != 0)
+	{
+		reject(srv, slot, REPLY_WRONG, "wrong_tag");
+		return;
+	}
+	// A range that can't be part of any file
+	if (bytes > OFFSET_MAX || be64toh(c->hello.offset) > OFFSET_MAX - bytes)
+	{
+		reject(srv, slot, REPLY_WRONG, "bad_offset");
+		return;
+	}
+	// Nothing could ever make room for it
+	if (charge > srv->conf->max_inflight)
+	{
+		reject(srv, slot, REPLY_BUSY, "too_big");
+		return;
+	}
+	// A client over its request or byte rate
+	if (!fairCharge(&srv->fair, c->client, bytes, nowMsec()))
+	{
+		reject(srv, slot, REPLY_BUSY, "rate_limit");
+		return;
+	}
+	// Run right away, or join the batch, only if nobody in its lane is
+	// waiting ahead of it
+	c->lane = bytes <= srv->conf->small_bytes ? LANE_SMALL : LANE_BULK;
+	if (srv->lanes[c->lane].queued == 0 && batchable(srv, slot) && (lane = batchRoom(srv, charge, c->lane)) != -1)
+	{
+		srv->pending--;
+		batchAdd(srv, slot, lane);
+		return;
+	}
+	if (srv->lanes[c->lane].queued == 0 && !batchable(srv, slot) && (lane = laneFor(srv, charge, c->lane)) != -1)
+	{
+		startWorker(srv, slot, lane);
+		return;
+	}
+	if (srv->lanes[c->lane].queued >= srv->conf->queue_len)
+	{
+		reject(srv, slot, REPLY_BUSY, "queue_full");
+		return;
+	}
+	srv->pending--;
+	enqueue(srv, slot);
+}
+
+/* Function: readHello
+ * Parameters: server, slot
+ * Overview: Reads whatever part of the hello has arrived
+ * Pre: Slot is waiting on its hello and its socket is readable
+ * Post: Request is admitted once the hello is complete, dropped on hang up
+ */
+static void readHello(struct server *srv, int slot)
+{
+	// Set variables
+	struct conn *c = &srv->conns[slot];	// The client
+	ssize_t n;				// Result of recv
+
+	n = recv(c->fd, (char *)&c->hello + c->got, sizeof(c->hello) - c->got, 0);
+	if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+	if (n <= 0)
+	{
+		connDone(srv, slot);
+		return;
+	}
+	c->got += n;
+	if (c->got == sizeof(c->hello))
+		admit(srv, slot);
+}
+
+/* Function: acceptClients
+ * Parameters: server
+ * Overview: Accepts every waiting client.  When the connection table is
+ * 	full the client is refused right away.
+ * Pre: Listening socket is readable
+ * Post: New clients are waiting on their hello
+ */
+static void acceptClients(struct server *srv)
+{
+	// Set variables
+	struct sockaddr_in client_addr;		// Client's address structure
+	socklen_t sock_size;			// Size of sockaddr_in
+	int fd;					// Client socket
+	int slot;				// Free slot
+	int client;				// Entry of its source
+	char busy = REPLY_BUSY;			// Reply when full
+
+	while (1)
+	{
+		sock_size = sizeof(client_addr);
+		fd = accept4(srv->listen_fd, (struct sockaddr *)&client_addr, &sock_size, SOCK_NONBLOCK);
+		if (fd == -1)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+				fprintf(stderr, "%s ERROR: Failed to accept client socket\n", srv->conf->prog);
+			return;
+		}
+
+		for (slot = 0; slot < srv->max_conns && srv->conns[slot].state != CONN_FREE; slot++)
+			;
+		if (slot == srv->max_conns)
+		{
+			metricsEmit("reject reason=conn_table_full queued=%d running=%d inflight_bytes=%llu",
+				srv->queued, srv->running, srv->inflight);
+			if (send(fd, &busy, 1, MSG_NOSIGNAL) < 0)
+			{
+				// The client is gone already
+			}
+			close(fd);
+			continue;
+		}
+
+		// Find the client's entry, its buckets carry over between connections
+		client = fairLookup(&srv->fair, client_addr.sin_addr.s_addr, nowMsec());
+		if (client == -1)
+		{
+			metricsEmit("reject reason=client_table_full queued=%d running=%d inflight_bytes=%llu",
+				srv->queued, srv->running, srv->inflight);
+			if (send(fd, &busy, 1, MSG_NOSIGNAL) < 0)
+			{
+				// The client is gone already
+			}
+			close(fd);
+			continue;
+		}
+
+		srv->conns[slot].state = CONN_HELLO;
+		srv->conns[slot].fd = fd;
+		srv->conns[slot].client = client;
+		srv->conns[slot].cpu = srv->place.count > 0 ? placeIncomingCpu(fd) : -1;
+		srv->conns[slot].accepted = nowMsec();
+		srv->conns[slot].timer_slot = -1;
+		timerAdd(srv, slot, srv->conns[slot].accepted + srv->conf->hello_ms);
+		srv->conns[slot].got = 0;
+		srv->pending++;
+	}
+}
+
+/* Function: keptDone
+ * Parameters: server, worker
+ * Overview: Closes the control socket of a worker whose kept connection is
+ * 	over and drops its hold on the client
+ * Pre: none
+ * Post: Worker has no control socket
+ */
+static void keptDone(struct server *srv, int w)
+{
+	if (srv->workers[w].ctl == -1)
+		return;
+	close(srv->workers[w].ctl);
+	srv->workers[w].ctl = -1;
+	fairRelease(&srv->fair, srv->workers[w].client);
+}
+
+/* Function: admitKept
+ * Parameters: server, worker
+ * Overview: Admits the next request of a kept connection, whose hello the
+ * 	worker passed over its control socket, and answers REPLY_GO or
+ * 	REPLY_BUSY.  The checks are those of admit for a request that could
+ * 	start right away, see the overview.
+ * Pre: Control socket is readable
+ * Post: Request is charged and the worker holds its bytes, or it was refused
+ */
+static void admitKept(struct server *srv, int w)
+{
+	// Set variables
+	struct worker *wk = &srv->workers[w];	// The worker
+	struct otp_hello hello;			// Hello of the request
+	unsigned long long bytes;		// Declared length
+	unsigned long long charge;		// Bytes it would hold
+	const char *reason = NULL;		// Why it is refused
+	char reply = REPLY_GO;			// Answer to the worker
+	int lane;				// Lane of the request
+	ssize_t n;				// Result of recv
+
+	n = recv(wk->ctl, &hello, sizeof(hello), MSG_DONTWAIT);
+	if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+	// The worker let its connection go
+	if (n != sizeof(hello))
+	{
+		keptDone(srv, w);
+		return;
+	}
+
+	bytes = helloLength(&hello);
+	charge = helloCharge(&hello);
+	lane = bytes <= srv->conf->small_bytes ? LANE_SMALL : LANE_BULK;
+	if (lane == LANE_BULK && wk->lane == LANE_SMALL)
+		reason = "kept_lane";
+	else if (srv->lanes[lane].queued > 0 || srv->lanes[wk->lane].queued > 0)
+		reason = "kept_queued";
+	else if (srv->inflight - wk->bytes + charge > srv->conf->max_inflight)
+		reason = "kept_inflight";
+	else if (!fairCharge(&srv->fair, wk->client, bytes, nowMsec()))
+		reason = "rate_limit";
+
+	if (reason != NULL)
+	{
+		reply = REPLY_BUSY;
+		metricsEmit("reject reason=%s queued=%d running=%d inflight_bytes=%llu",
+			reason, srv->queued, srv->running, srv->inflight);
+	}
+	else
+	{
+		srv->inflight = srv->inflight - wk->bytes + charge;
+		wk->bytes = charge;
+		metricsEmit("admit lane=%s worker=%s waited_ms=0 queued=%d running=%d inflight_bytes=%llu length=%llu offset=%llu cpu=%d kept=1",
+			srv->lanes[lane].name, srv->lanes[wk->lane].name, srv->queued, srv->running, srv->inflight,
+			bytes, (unsigned long long)be64toh(hello.offset), wk->home == -1 ? -1 : srv->place.cpus[wk->home]);
+	}
+	if (send(wk->ctl, &reply, 1, MSG_DONTWAIT | MSG_NOSIGNAL) != 1)
+		keptDone(srv, w);
+}
+
+/* Function: reapWorkers
+ * Parameters: server
+ * Overview: Collects finished workers and gives back their share of the load
+ * Pre: none
+ * Post: No finished worker is left unreaped
+ */
+static void reapWorkers(struct server *srv)
+{
+	// Set variables
+	pid_t pid;		// Finished worker
+	int status;		// Its exit status
+	int i;			// For the loop
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+	{
+		// In case a worker gets Ctrl-C, print out a statement
+		if (!WIFEXITED(status))
+		{
+			printf("terminated by singal %d\n", status);
+			fflush(stdout);
+		}
+		for (i = 0; i < srv->max_running; i++)
+		{
+			if (srv->workers[i].pid == pid)
+			{
+				srv->workers[i].pid = 0;
+				srv->lanes[srv->workers[i].lane].running--;
+				srv->running--;
+				srv->inflight -= srv->workers[i].bytes;
+				if (srv->workers[i].home != -1)
+					srv->cpu_load[srv->workers[i].home]--;
+				keptDone(srv, i);
+				break;
+			}
+		}
+	}
+}
+
+/* Function: expireConn
+ * Parameters: server, slot
+ * Overview: Refuses a client that has run out of time, whether its hello is
+ * 	still coming or it is queued
+ * Pre: Client's deadline has passed
+ * Post: Client got 'M' and is closed
+ */
+static void expireConn(struct server *srv, int slot)
+{
+	// Set variables
+	struct conn *c = &srv->conns[slot];	// The client
+	int prev;				// Queued slot before it
+
+	if (c->state == CONN_HELLO)
+	{
+		reject(srv, slot, REPLY_BUSY, "hello_deadline");
+		return;
+	}
+	// Find the slot before it in its client's queue
+	prev = srv->flows[c->client * LANES + c->lane].head;
+	if (prev == slot)
+		prev = -1;
+	else
+	{
+		while (srv->conns[prev].next != slot)
+			prev = srv->conns[prev].next;
+	}
+	dequeue(srv, slot, prev);
+	reject(srv, slot, REPLY_BUSY, "queue_deadline");
+}
+
+/* Function: expireDeadlines
+ * Parameters: server, current time
+ * Overview: Turns the timer wheel up to now and refuses every client found
+ * 	past its deadline on the way.  After a long sleep one full turn is
+ * 	enough to visit every slot.
+ * Pre: none
+ * Post: Every held client is within its deadline
+ */
+static void expireDeadlines(struct server *srv, unsigned long long now)
+{
+	// Set variables
+	unsigned long long tick = now / WHEEL_TICK_MS;	// Tick to turn to
+	unsigned long long t;		// Tick being visited
+	int slot;			// Client being checked
+	int next;			// Client after it
+
+	t = tick - srv->wheel_tick >= WHEEL_SLOTS ? tick - WHEEL_SLOTS + 1 : srv->wheel_tick;
+	for (; t <= tick; t++)
+	{
+		slot = srv->wheel[t % WHEEL_SLOTS];
+		while (slot != -1)
+		{
+			next = srv->conns[slot].timer_next;
+			if (srv->conns[slot].deadline <= now)
+				expireConn(srv, slot);
+			slot = next;
+		}
+	}
+	// The current tick is visited again next time for deadlines later in it
+	srv->wheel_tick = tick;
+}
+
+/* Function: nextDeadline
+ * Parameters: server, current time
+ * Overview: Works out how long poll may sleep from the first slot of the
+ * 	wheel that has a deadline due in this turn.  Deadlines further off
+ * 	only keep the sleep to one turn.
+ * Pre: none
+ * Post: Returns milliseconds until the nearest deadline, -1 for none
+ */
+static int nextDeadline(struct server *srv, unsigned long long now)
+{
+	// Set variables
+	unsigned long long nearest = 0;	// Nearest deadline, 0 for none
+	unsigned long long tick;	// Tick of the slot being checked
+	int later = 0;			// Some deadline is more than a turn off
+	int i;				// Slots ahead of the wheel
+	int slot;			// Client being checked
+
+	for (i = 0; i < WHEEL_SLOTS && nearest == 0; i++)
+	{
+		tick = srv->wheel_tick + i;
+		for (slot = srv->wheel[tick % WHEEL_SLOTS]; slot != -1; slot = srv->conns[slot].timer_next)
+		{
+			if (srv->conns[slot].deadline / WHEEL_TICK_MS > tick)
+				later = 1;
+			else if (nearest == 0 || srv->conns[slot].deadline < nearest)
+				nearest = srv->conns[slot].deadline;
+		}
+	}
+	if (nearest == 0)
+		return later ? WHEEL_SLOTS * WHEEL_TICK_MS : -1;
+	return nearest > now ? (int)(nearest - now) : 0;
+}
+
+/* Function: pollWait
+ * Parameters: server, time to fill in
+ * Overview: Works out how long the loop may sleep: until the nearest
+ * 	deadline, or until the open batch's window closes if that is sooner
+ * Pre: none
+ * Post: Returns ts filled in, NULL to sleep until something happens
+ */
+static struct timespec *pollWait(struct server *srv, struct timespec *ts)
+{
+	// Set variables
+	int ms = nextDeadline(srv, nowMsec());	// Until the nearest deadline
+	unsigned long long us;		// Sleep in microseconds
+	unsigned long long now;		// Current time in us
+	unsigned long long close_at;	// When the open batch starts
+
+	if (ms == -1 && srv->batched == 0)
+		return NULL;
+	us = ms == -1 ? ~0ULL : (unsigned long long)ms * 1000;
+	if (srv->batched > 0)
+	{
+		now = nowUsec();
+		close_at = srv->batch_opened + srv->conf->batch_us;
+		if (close_at <= now)
+			us = 0;
+		else if (close_at - now < us)
+			us = close_at - now;
+	}
+	ts->tv_sec = us / 1000000;
+	ts->tv_nsec = us % 1000000 * 1000;
+	return ts;
+}
+
+/* Function: batchDue
+ * Parameters: server
+ * Overview: Tells whether the open batch should start: it is full, its
+ * 	window is over, or requests of the small lane are waiting that it
+ * 	couldn't take
+ * Pre: none
+ * Post: Returns 1 to start it, 0 to keep it open or when none is open
+ */
+static int batchDue(struct server *srv)
+{
+	if (srv->batched == 0)
+		return 0;
+	return srv->batched >= srv->conf->batch_max || srv->lanes[LANE_SMALL].queued > 0 ||
+		nowUsec() - srv->batch_opened >= (unsigned long long)srv->conf->batch_us;
+}
+
+/* Function: handOver
+ * Parameters: server
+ * Overview: Answers a new daemon on the restart socket.  Once it holds the
+ * 	listening socket this daemon stops accepting and drains: clients
+ * 	already accepted are still admitted and served, and running workers
+ * 	are told with SIGUSR2 to let kept connections go.  Workers forked
+ * 	from now on inherit that.
+ * Pre: Restart socket is readable
+ * Post: Daemon is draining if the socket was handed over
+ */
+static void handOver(struct server *srv)
+{
+	// Set variables
+	int i;			// For the loop
+
+	if (handoffServe(srv->handoff_fd, srv->listen_fd, srv->conf->tag, srv->conf->port, srv->conf->prog) == -1)
+		return;
+	metricsEmit("handoff pending=%d queued=%d running=%d inflight_bytes=%llu",
+		srv->pending, srv->queued, srv->running, srv->inflight);
+	close(srv->listen_fd);
+	close(srv->handoff_fd);
+	srv->listen_fd = -1;
+	srv->handoff_fd = -1;
+	srv->draining = 1;
+	worker_drain = 1;
+	for (i = 0; i < srv->max_running; i++)
+	{
+		if (srv->workers[i].pid != 0)
+			kill(srv->workers[i].pid, SIGUSR2);
+	}
+}
+
+/* Function: openListener
+ * Parameters: settings
+ * Overview: Sets up the non-blocking listening socket
+ * Pre: Port is set
+ * Post: Returns the socket, exits on failure
+ */
+static int openListener(struct server_conf *conf)
+{
+	// Set variables
+	int socket_serv_fd;		// server socket file descriptor
+	struct sockaddr_in server_addr;	// Server's address structure
+	int sock_opt = 1;		// Sets the option in socket for reuse
+
+	// Set up the server socket
+	if ((socket_serv_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) == -1)
+	{
+		fprintf(stderr, "%s ERROR: Failed to setup socket file descriptor\n", conf->prog);
+		exit(1);
+	}
+	// Stuff the server socket with address information
+	memset(&server_addr, 0, sizeof(server_addr));
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_port = htons(conf->port);
+	server_addr.sin_addr.s_addr = INADDR_ANY;
+
+	// Create a socket option where we can reuse the address on the server address
+	setsockopt(socket_serv_fd, SOL_SOCKET, SO_REUSEADDR, &sock_opt, sizeof(sock_opt));
+
+	// Bind the server address to the socket using conditional
+	if (bind(socket_serv_fd, (struct sockaddr *)&server_addr, sizeof(struct sockaddr)) == -1)
+	{
+		fprintf(stderr, "%s ERROR: Failed to bind address to socket\n", conf->prog);
+		exit(1);
+	}
+
+	// Start to listen on the port, the queue in front of accept is kept
+	// long since admission now happens after accept
+	if (listen(socket_serv_fd, 128) == -1)
+	{
+		fprintf(stderr, "%s ERROR: Failed at listening on port\n", conf->prog);
+		exit(1);
+	}
+	return socket_serv_fd;
+}
+
+/* Function: serverRun
+ * Parameters: settings
+ * Overview: Runs the daemon: accept, admit, queue and reap, until another
+ * 	daemon takes over its port
+ * Pre: Settings are filled in
+ * Post: Never returns, exits with 0 once drained after a hot restart
+ */
+void serverRun(struct server_conf *conf)
+{
+	// Set variables
+	struct server srv;		// Daemon state
+	int lane;			// For the lane setup
+	int reload;			// SIGHUP came in
+	struct sigaction act;		// Signal structure
+	struct timespec wait;		// Longest sleep of the loop
+	unsigned long long now;		// Current time
+	char drain[64];			// Bytes from the self pipe
+	ssize_t n;			// Bytes read from it
+	int nfds;			// Entries in the poll set
+	int nconns;			// Entries up to the last client
+	int slot;			// For the loops
+	int i;				// For the loops
+
+	memset(&srv, 0, sizeof(srv));
+	srv.conf = conf;
+	worker_conf = conf;
+	srv.lanes[LANE_SMALL].name = "small";
+	srv.lanes[LANE_SMALL].workers = conf->small_workers;
+	srv.lanes[LANE_BULK].name = "bulk";
+	srv.lanes[LANE_BULK].workers = conf->max_workers;
+	for (lane = 0; lane < LANES; lane++)
+	{
+		srv.lanes[lane].head = -1;
+		srv.lanes[lane].tail = -1;
+	}
+	srv.max_running = conf->small_workers + conf->max_workers;
+	srv.max_conns = conf->queue_len * LANES + srv.max_running + conf->batch_max + 64;
+	srv.conns = calloc(srv.max_conns, sizeof(struct conn));
+	srv.workers = calloc(srv.max_running, sizeof(struct worker));
+	srv.batch = calloc(conf->batch_max, sizeof(int));
+	srv.batch_fds = calloc(conf->batch_max, sizeof(int));
+	srv.batch_hellos = calloc(conf->batch_max, sizeof(struct otp_hello));
+	if (fairInit(&srv.fair, srv.max_conns + FAIR_CLIENTS) == -1)
+	{
+		fprintf(stderr, "%s ERROR: Out of memory for client table\n", conf->prog);
+		exit(1);
+	}
+	if (conf->limits_path != NULL && fairLoadLimits(&srv.fair.limits, conf->limits_path) == -1)
+		exit(1);
+	if (conf->cpu_list != NULL && placeParse(&srv.place, conf->cpu_list) == -1)
+	{
+		fprintf(stderr, "%s ERROR: CPU list %s is malformed or names a CPU the daemon can't run on\n", conf->prog, conf->cpu_list);
+		exit(1);
+	}
+	srv.cpu_load = calloc(srv.place.count + 1, sizeof(int));
+	srv.flows = malloc(srv.fair.capacity * LANES * sizeof(struct flow));
+	srv.fds = calloc(srv.max_conns + srv.max_running + 3, sizeof(struct pollfd));
+	srv.fd_conn = calloc(srv.max_conns + srv.max_running + 3, sizeof(int));
+	if (srv.conns == NULL || srv.workers == NULL || srv.flows == NULL || srv.fds == NULL || srv.fd_conn == NULL ||
+		srv.cpu_load == NULL || srv.batch == NULL || srv.batch_fds == NULL || srv.batch_hellos == NULL)
+	{
+		fprintf(stderr, "%s ERROR: Out of memory for connection table\n", conf->prog);
+		exit(1);
+	}
+	for (i = 0; i < srv.fair.capacity * LANES; i++)
+	{
+		srv.flows[i].head = -1;
+		srv.flows[i].tail = -1;
+		srv.flows[i].deficit = 0;
+		srv.flows[i].topped = 0;
+		srv.flows[i].active = 0;
+		srv.flows[i].next = -1;
+	}
+	srv.wheel_tick = nowMsec() / WHEEL_TICK_MS;
+	for (i = 0; i < WHEEL_SLOTS; i++)
+		srv.wheel[i] = -1;
+	ioLimits(conf->io_ms, conf->min_rate);
+
+	// Take the port over from the daemon on the restart socket, if any,
+	// then be the one the next daemon finds there
+	srv.listen_fd = -1;
+	srv.handoff_fd = -1;
+	if (conf->restart_path != NULL)
+	{
+		srv.listen_fd = handoffFetch(conf->restart_path, conf->tag, conf->port, conf->prog);
+		if (srv.listen_fd != -1)
+			metricsEmit("takeover port=%d", conf->port);
+	}
+	if (srv.listen_fd == -1)
+		srv.listen_fd = openListener(conf);
+	if (conf->restart_path != NULL)
+		srv.handoff_fd = handoffListen(conf->restart_path, conf->prog);
+
+	// Finished workers and SIGHUP wake up the poll loop through the self pipe
+	if (pipe2(srv.sig_pipe, O_NONBLOCK | O_CLOEXEC) == -1)
+	{
+		fprintf(stderr, "%s ERROR: Failed to create the signal pipe\n", conf->prog);
+		exit(1);
+	}
+	sig_fd = srv.sig_pipe[1];
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = catchSignal;
+	act.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigaction(SIGCHLD, &act, NULL);
+	sigaction(SIGHUP, &act, NULL);
+	act.sa_handler = catchDrain;
+	act.sa_flags = SA_RESTART;
+	sigaction(SIGUSR2, &act, NULL);
+
+	// Set the signal handler to ignore interrupts and clients that hang up
+	act.sa_handler = SIG_IGN;
+	act.sa_flags = 0;
+	sigaction(SIGINT, &act, NULL);
+	sigaction(SIGPIPE, &act, NULL);
+
+	// Loop to accept clients
+	while (1)
+	{
+		// Poll the listener, the self pipe, the restart socket, every
+		// client still sending its hello and the control socket of every
+		// kept connection, poll skips the ones that are -1
+		srv.fds[0].fd = srv.listen_fd;
+		srv.fds[0].events = POLLIN;
+		srv.fds[1].fd = srv.sig_pipe[0];
+		srv.fds[1].events = POLLIN;
+		srv.fds[2].fd = srv.handoff_fd;
+		srv.fds[2].events = POLLIN;
+		nfds = 3;
+		for (slot = 0; slot < srv.max_conns; slot++)
+		{
+			if (srv.conns[slot].state == CONN_HELLO)
+			{
+				srv.fds[nfds].fd = srv.conns[slot].fd;
+				srv.fds[nfds].events = POLLIN;
+				srv.fd_conn[nfds] = slot;
+				nfds++;
+			}
+		}
+		nconns = nfds;
+		for (i = 0; i < srv.max_running; i++)
+		{
+			if (srv.workers[i].pid != 0 && srv.workers[i].ctl != -1)
+			{
+				srv.fds[nfds].fd = srv.workers[i].ctl;
+				srv.fds[nfds].events = POLLIN;
+				srv.fd_conn[nfds] = i;
+				nfds++;
+			}
+		}
+
+		if (ppoll(srv.fds, nfds, pollWait(&srv, &wait), NULL) == -1 && errno != EINTR)
+		{
+			fprintf(stderr, "%s ERROR: Failed to poll clients\n", conf->prog);
+			exit(1);
+		}
+
+		if (srv.fds[1].revents & POLLIN)
+		{
+			reload = 0;
+			while ((n = read(srv.sig_pipe[0], drain, sizeof(drain))) > 0)
+			{
+				if (memchr(drain, 'H', n) != NULL)
+					reload = 1;
+			}
+			// Read the limits again, a bad file leaves the old ones in place
+			if (reload && conf->limits_path != NULL && fairLoadLimits(&srv.fair.limits, conf->limits_path) == 0)
+				metricsEmit("limits req_rate=%g req_burst=%g byte_rate=%g byte_burst=%g quantum=%llu idle_ms=%d",
+					srv.fair.limits.req_rate, srv.fair.limits.req_burst, srv.fair.limits.byte_rate,
+					srv.fair.limits.byte_burst, srv.fair.limits.quantum, srv.fair.limits.idle_ms);
+		}
+		reapWorkers(&srv);
+
+		// Kept requests go first, they were admitted before the new clients
+		for (i = nconns; i < nfds; i++)
+		{
+			if (srv.fds[i].revents != 0 && srv.workers[srv.fd_conn[i]].ctl == srv.fds[i].fd)
+				admitKept(&srv, srv.fd_conn[i]);
+		}
+		for (i = 3; i < nconns; i++)
+		{
+			if (srv.fds[i].revents != 0 && srv.conns[srv.fd_conn[i]].state == CONN_HELLO)
+				readHello(&srv, srv.fd_conn[i]);
+		}
+		if (srv.fds[0].revents & POLLIN)
+			acceptClients(&srv);
+		if (srv.fds[2].revents & POLLIN)
+			handOver(&srv);
+
+		now = nowMsec();
+		expireDeadlines(&srv, now);
+		if (now - srv.last_expire >= 1000)
+		{
+			fairExpire(&srv.fair, now);
+			srv.last_expire = now;
+		}
+		dispatch(&srv);
+		if (batchDue(&srv))
+			startBatch(&srv);
+
+		// Replaced, and every client this daemon accepted is done
+		if (srv.draining && srv.pending == 0 && srv.queued == 0 && srv.batched == 0 && srv.running == 0)
+		{
+			metricsEmit("drained port=%d", conf->port);
+			exit(0);
+		}
+	}
+}
+
+/* Function: serverNextHello
+ * Parameters: client socket, hello of the request just served
+ * Overview: Waits for the next request on a kept connection and has the
+ * 	daemon admit it.  A request the daemon refuses is refused the same
+ * 	way the daemon would refuse it and the client starts over on a new
+ * 	connection.
+ * Pre: Runs in a worker, the result of the last request was sent
+ * Post: Returns 0 with the next hello in hello, the handler answers it.
+ * 	Returns -1 when the connection is done.
+ */
+int serverNextHello(int client_sock, struct otp_hello *hello)
+{
+	// Set variables
+	struct pollfd pfd;		// Waiting for the hello
+	struct timespec ts;		// Longest wait for it
+	sigset_t drain_mask;		// SIGUSR2 alone
+	sigset_t old_mask;		// Mask to wait with
+	struct io_phase phase;		// Deadline of the rest of the hello
+	unsigned long long bytes;	// Declared length
+	const char *reason = NULL;	// Why the connection is done
+	char reply;			// Refusal to send
+
+	if (!(ntohl(hello->flags) & HELLO_KEEP) || worker_ctl == -1)
+		return -1;
+	if (kept + 1 >= KEEP_MAX)
+		reason = "limit";
+	else
+	{
+		// SIGUSR2 is held off until the wait so it can't slip in between
+		// the check and the wait
+		sigemptyset(&drain_mask);
+		sigaddset(&drain_mask, SIGUSR2);
+		sigprocmask(SIG_BLOCK, &drain_mask, &old_mask);
+		pfd.fd = client_sock;
+		pfd.events = POLLIN;
+		ts.tv_sec = worker_conf->hello_ms / 1000;
+		ts.tv_nsec = worker_conf->hello_ms % 1000 * 1000000L;
+		if (worker_drain)
+			reason = "drain";
+		else if (ppoll(&pfd, 1, &ts, &old_mask) != 1)
+			reason = worker_drain ? "drain" : "idle";
+		sigprocmask(SIG_SETMASK, &old_mask, NULL);
+		ioPhase(&phase, "hello", sizeof(*hello));
+		if (reason == NULL && ioRecv(client_sock, (char *)hello, sizeof(*hello), &phase) == -1)
+			reason = "closed";
+	}
+	if (reason != NULL)
+	{
+		// A client that only ever made one request just hung up
+		if (kept > 0)
+			metricsEmit("keepalive requests=%d reason=%s", kept + 1, reason);
+		return -1;
+	}
+
+	// Refuse what the daemon itself would refuse, then let it admit the
+	// rest.  It answers at once, so waiting for it here is short
+	bytes = helloLength(hello);
+	if (hello->tag[3] != 0 || strcmp(hello->tag, worker_conf->tag) != 0)
+	{
+		reason = "wrong_tag";
+		reply = REPLY_WRONG;
+	}
+	else if (bytes > OFFSET_MAX || be64toh(hello->offset) > OFFSET_MAX - bytes)
+	{
+		reason = "bad_offset";
+		reply = REPLY_WRONG;
+	}
+	else if (send(worker_ctl, hello, sizeof(*hello), MSG_NOSIGNAL) != sizeof(*hello) ||
+		recv(worker_ctl, &reply, 1, 0) != 1)
+	{
+		reason = "daemon_gone";
+		reply = REPLY_BUSY;
+	}
+	else if (reply != REPLY_GO)
+		reason = "refused";
+	else
+	{
+		kept++;
+		return 0;
+	}
+	if (send(client_sock, &reply, 1, MSG_NOSIGNAL) < 0)
+	{
+		// The client is gone, nothing more to tell it
+	}
+	metricsEmit("keepalive requests=%d reason=%s", kept + 1, reason);
+	return -1;
+}
@@ -0,0 +1,63 @@
+/*
+ * File otp_server.h
+ * Author: Jeffrey Schachtsick
+ * Course: CS344 - Operating Systems 1
+ * Assignment: Program 4
+ * Overview: Listening side shared by otp_enc_d and otp_dec_d.  The daemon
+ * 	process accepts clients, reads their hello and decides whether each
+ * 	request runs now, waits in a bounded queue, or is turned away with 'M'.
+ * 	Only admitted requests are handed to a forked worker.  Short and long
+ * 	requests are scheduled in separate lanes with their own workers, and
+ * 	clients share each lane fairly.  Small one-shot requests that arrive
+ * 	together are gathered for a few microseconds and served as a batch by
+ * 	one worker.  A worker whose client asked to keep the connection gets
+ * 	the next requests on it from serverNextHello, each admitted by the
+ * 	daemon like a new one.  A new daemon started
+ * 	with the same restart socket takes over the port without closing it,
+ * 	and the old one exits once its requests are done.  Workers can be
+ * 	pinned to a list of CPUs, near the CPU their client came in on.
+ * Last Update: 06/03/2016
+ */
+
+#ifndef OTP_SERVER_H
+#define OTP_SERVER_H
+
+#include "otp_proto.h"
+
+/* Worker entry point, runs in the forked child with the client socket */
+typedef void (*server_handler)(int client_sock, struct otp_hello *hello);
+
+/* Batch entry point, runs in the forked child with every client of the batch */
+typedef void (*server_batch_handler)(int *client_socks, struct otp_hello *hellos, int count);
+
+/* Settings of a daemon */
+struct server_conf
+{
+	const char *prog;		// Program name for messages, e.g. "otp_enc_d"
+	const char *tag;		// Tag clients must send, "enc" or "dec"
+	server_handler handler;		// Runs one request in a worker
+	server_batch_handler batch;	// Runs a batch of small requests, NULL for none
+	int port;			// Port to listen on
+	int max_workers;		// Bulk requests running at once (-c)
+	int small_workers;		// Small requests running at once (-S)
+	unsigned long long small_bytes;	// Longest request of the small lane (-s)
+	int age_ms;			// Wait after which a bulk job goes first (-a)
+	int queue_len;			// Requests allowed to wait per lane (-q)
+	int queue_ms;			// Longest wait from accept to a worker (-w)
+	unsigned long long max_inflight;	// Declared bytes running at once (-b)
+	int hello_ms;			// Longest wait for the hello (-H)
+	int io_ms;			// Longest stall of a worker's client (-t)
+	unsigned long long min_rate;	// Slowest transfer in bytes per second (-r)
+	const char *limits_path;	// Per client limits, read again on SIGHUP (-L)
+	int batch_max;			// Small requests one worker takes at once (-B)
+	int batch_us;			// Longest a batch waits to fill up (-u)
+	const char *restart_path;	// Unix socket a new daemon takes the port over from (-R)
+	const char *cpu_list;		// CPUs workers are pinned to, NULL for none (-C)
+};
+
+void serverDefaults(struct server_conf *conf, const char *prog, const char *tag, server_handler handler);
+void serverParseArgs(struct server_conf *conf, int argc, char *argv[]);
+void serverRun(struct server_conf *conf);
+int serverNextHello(int client_sock, struct otp_hello *hello);
+
+#endif